@@ -0,0 +1,219 @@
+#include "batch.h"
+#include "geometry.h"
+
+#include <iostream>
+#include <map>
+#include <numeric>
+
+
+namespace
+{
+	// CPU copy of a source mesh, read back once per build
+	struct SourceMesh
+	{
+		Geometry geometry;
+		std::vector<GLuint> indices;
+	};
+
+	// Read the interleaved vertices (and indices) of a mesh back from the GPU.
+	// Non-indexed meshes get a sequential index list.
+	void UReadMesh(const Meshes::GLMesh& mesh, SourceMesh& source)
+	{
+		const VertexFormat format = VertexFormat::PositionNormalUV();
+		std::vector<GLfloat> verts(mesh.nVertices * format.stride);
+
+		glBindBuffer(GL_COPY_READ_BUFFER, mesh.vbos[0]);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(GLfloat) * verts.size(), verts.data());
+		source.geometry.Deinterleave(format, verts.data(), mesh.nVertices);
+
+		if (mesh.nIndices > 0)
+		{
+			source.indices.resize(mesh.nIndices);
+			glBindBuffer(GL_COPY_READ_BUFFER, mesh.vbos[1]);
+			glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(GLuint) * source.indices.size(), source.indices.data());
+		}
+		else
+		{
+			source.indices.resize(mesh.nVertices);
+			std::iota(source.indices.begin(), source.indices.end(), 0u);
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	bool USameMaterial(const StaticBatch& batch, const SceneObject& object, GLuint textureId)
+	{
+		return batch.programId == object.programId && batch.textureId == textureId
+			&& batch.objectColor == object.objectColor;
+	}
+}
+
+
+///////////////////////////////////////////////////
+//	Update(const Scene&, const MaterialPacker&)
+//
+//	scene: scene to batch
+//	packer: the objects' textures, and the pages they may share
+//
+//	Rebuild the batches when any object changed since the last build
+///////////////////////////////////////////////////
+bool StaticBatcher::Update(const Scene& scene, const MaterialPacker& packer)
+{
+	if (mBuilt && !UIsStale(scene))
+		return false;
+
+	UBuild(scene, packer);
+	return true;
+}
+
+
+// Any edit, addition or removal changes the list of revisions
+bool StaticBatcher::UIsStale(const Scene& scene) const
+{
+	if (scene.Size() != mRevisions.size())
+		return true;
+
+	for (size_t i = 0; i < scene.Size(); i++)
+	{
+		if (scene.Revision(i) != mRevisions[i])
+			return true;
+	}
+	return false;
+}
+
+
+///////////////////////////////////////////////////
+//	UBuild(const Scene&, const MaterialPacker&)
+//
+//	Group the static objects by material, apply their model matrices to
+//	the vertex data and merge each group into a single mesh
+///////////////////////////////////////////////////
+void StaticBatcher::UBuild(const Scene& scene, const MaterialPacker& packer)
+{
+	Destroy();
+
+	mBatched.assign(scene.Size(), false);
+	mRevisions.resize(scene.Size());
+	for (size_t i = 0; i < scene.Size(); i++)
+		mRevisions[i] = scene.Revision(i);
+	mBuilt = true;
+
+	// group static objects by material, in scene order
+	std::vector<std::vector<size_t>> members;
+	for (size_t i = 0; i < scene.Size(); i++)
+	{
+		const SceneObject& object = scene.Object(i);
+		if (!object.isStatic || object.mesh == nullptr)
+			continue;
+
+		GLuint textureId = packer.DrawTexture(object.texture);
+		size_t b = 0;
+		while (b < mBatches.size() && !USameMaterial(mBatches[b], object, textureId))
+			b++;
+
+		if (b == mBatches.size())
+		{
+			StaticBatch batch = {};
+			batch.programId = object.programId;
+			batch.textureId = textureId;
+			batch.objectColor = object.objectColor;
+			mBatches.push_back(batch);
+			members.emplace_back();
+		}
+		members[b].push_back(i);
+	}
+
+	std::map<const Meshes::GLMesh*, SourceMesh> sources;
+	size_t objectCount = 0;
+
+	for (size_t b = 0; b < mBatches.size(); b++)
+	{
+		StaticBatch& batch = mBatches[b];
+		Geometry merged;
+		std::vector<GLuint> indices;
+
+		for (size_t i : members[b])
+		{
+			const SceneObject& object = scene.Object(i);
+
+			SourceMesh& source = sources[object.mesh];
+			if (source.geometry.Empty())
+				UReadMesh(*object.mesh, source);
+
+			// pre-transform to world space
+			Geometry world(source.geometry);
+			world.Transform(object.model);
+
+			BatchRange range;
+			range.object = i;
+			range.firstIndex = GLuint(indices.size());
+			range.indexCount = GLuint(source.indices.size());
+			world.ComputeBounds(range.boundsMin, range.boundsMax);
+			batch.ranges.push_back(range);
+
+			GLuint base = GLuint(merged.Size());
+			merged.Append(world);
+			for (GLuint index : source.indices)
+				indices.push_back(base + index);
+
+			mBatched[i] = true;
+		}
+
+		batch.boundsMin = batch.ranges.front().boundsMin;
+		batch.boundsMax = batch.ranges.front().boundsMax;
+		for (const BatchRange& range : batch.ranges)
+		{
+			batch.boundsMin = glm::min(batch.boundsMin, range.boundsMin);
+			batch.boundsMax = glm::max(batch.boundsMax, range.boundsMax);
+		}
+
+		Meshes::UUploadMesh(batch.mesh, merged, indices.data(), GLuint(indices.size()));
+		objectCount += members[b].size();
+	}
+	glBindVertexArray(0);
+
+	std::cout << "INFO: Static batching merged " << objectCount << " objects into "
+		<< mBatches.size() << " draw calls" << std::endl;
+}
+
+
+///////////////////////////////////////////////////
+//	FindRange(size_t, const StaticBatch**)
+//
+//	object: scene index of the object
+//	batch: optionally receives the batch holding the object
+//
+//	Look up where a batched object lives, for culling and picking
+///////////////////////////////////////////////////
+const BatchRange* StaticBatcher::FindRange(size_t object, const StaticBatch** batch) const
+{
+	if (!IsBatched(object))
+		return nullptr;
+
+	for (const StaticBatch& candidate : mBatches)
+	{
+		for (const BatchRange& range : candidate.ranges)
+		{
+			if (range.object == object)
+			{
+				if (batch)
+					*batch = &candidate;
+				return &range;
+			}
+		}
+	}
+	return nullptr;
+}
+
+
+void StaticBatcher::Destroy()
+{
+	for (StaticBatch& batch : mBatches)
+	{
+		glDeleteVertexArrays(1, &batch.mesh.vao);
+		glDeleteBuffers(2, batch.mesh.vbos);
+	}
+	mBatches.clear();
+	mBatched.clear();
+	mRevisions.clear();
+	mBuilt = false;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "material.h"
+#include "mesh.h"
+#include "scene.h"
+
+// Index range of one source object inside a static batch, kept for culling and picking
+struct BatchRange
+{
+	size_t object;			// index in the Scene
+	GLuint firstIndex;
+	GLuint indexCount;
+	glm::vec3 boundsMin;	// world space bounds of the object
+	glm::vec3 boundsMax;
+};
+
+// All static objects sharing a shader, texture and color, pre-transformed
+// to world space and merged into one vertex/index buffer. With a
+// MaterialPacker the objects only need to share a page, so one batch can
+// hold objects with different textures.
+struct StaticBatch
+{
+	GLuint programId;
+	GLuint textureId;		// texture or texture array page to bind
+	glm::vec4 objectColor;
+	Meshes::GLMesh mesh;	// draw with glDrawElements(GL_TRIANGLES, ...) and an identity model matrix
+	std::vector<BatchRange> ranges;
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+};
+
+// Builds static batches from the scene and rebuilds them whenever one of
+// the objects is edited, added or removed
+class StaticBatcher
+{
+public:
+	// Rebuilds the batches if the scene changed since the last build. Returns
+	// true when rebuilt. Objects whose textures the packer packed are grouped
+	// by page.
+	bool Update(const Scene& scene, const MaterialPacker& packer);
+	void Destroy();
+
+	const std::vector<StaticBatch>& Batches() const { return mBatches; }
+
+	// True when the object is drawn as part of a batch rather than on its own
+	bool IsBatched(size_t object) const { return object < mBatched.size() && mBatched[object]; }
+
+	// Batch and range holding the object, or nullptr
+	const BatchRange* FindRange(size_t object, const StaticBatch** batch = nullptr) const;
+
+private:
+	bool UIsStale(const Scene& scene) const;
+	void UBuild(const Scene& scene, const MaterialPacker& packer);
+
+	std::vector<StaticBatch> mBatches;
+	std::vector<bool> mBatched;
+	std::vector<uint64_t> mRevisions;	// scene revisions the batches were built from
+	bool mBuilt = false;
+};
@@ -0,0 +1,509 @@
+#include "bcenc.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+namespace
+{
+	const int BLOCK_PIXELS = 16;
+
+	// Images smaller than this many blocks are not worth starting threads for
+	const size_t PARALLEL_THRESHOLD = 1024;
+
+	// 4x4 texels split into channels, values 0..255
+	struct Block
+	{
+		float c[4][BLOCK_PIXELS];
+	};
+
+	// BC7 4-bit index interpolation weights, out of 64
+	const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// Fraction of the second endpoint in each BC1 palette entry, in index order
+	const float BC1_WEIGHTS[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+	void ULoadBlock(const unsigned char* rgba, int width, int height, int blockX, int blockY, Block& block)
+	{
+		for (int y = 0; y < 4; y++)
+		{
+			int row = std::min(blockY * 4 + y, height - 1);
+			for (int x = 0; x < 4; x++)
+			{
+				int column = std::min(blockX * 4 + x, width - 1);
+				const unsigned char* texel = rgba + (size_t(row) * width + column) * 4;
+				for (int c = 0; c < 4; c++)
+					block.c[c][y * 4 + x] = float(texel[c]);
+			}
+		}
+	}
+
+	// Principal axis of the block's colors by power iteration on the covariance
+	void UPrincipalAxis(const Block& block, int channels, float mean[4], float axis[4])
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			mean[c] = 0.0f;
+			for (int i = 0; i < BLOCK_PIXELS; i++)
+				mean[c] += block.c[c][i];
+			mean[c] /= BLOCK_PIXELS;
+		}
+
+		float covariance[4][4] = {};
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+		{
+			for (int a = 0; a < channels; a++)
+			{
+				for (int b = 0; b < channels; b++)
+					covariance[a][b] += (block.c[a][i] - mean[a]) * (block.c[b][i] - mean[b]);
+			}
+		}
+
+		for (int c = 0; c < 4; c++)
+			axis[c] = c < channels ? 1.0f : 0.0f;
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = {};
+			float length = 0.0f;
+			for (int a = 0; a < channels; a++)
+			{
+				for (int b = 0; b < channels; b++)
+					next[a] += covariance[a][b] * axis[b];
+				length = std::max(length, std::fabs(next[a]));
+			}
+			if (length < 1e-6f)
+				break;
+			for (int a = 0; a < channels; a++)
+				axis[a] = next[a] / length;
+		}
+	}
+
+	// Extremes of the block along its principal axis
+	void UAxisEndpoints(const Block& block, int channels, float low[4], float high[4])
+	{
+		float mean[4], axis[4];
+		UPrincipalAxis(block, channels, mean, axis);
+
+		float tMin = FLT_MAX, tMax = -FLT_MAX;
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+		{
+			float t = 0.0f;
+			for (int c = 0; c < channels; c++)
+				t += (block.c[c][i] - mean[c]) * axis[c];
+			tMin = std::min(tMin, t);
+			tMax = std::max(tMax, t);
+		}
+
+		float axisLength = 0.0f;
+		for (int c = 0; c < channels; c++)
+			axisLength += axis[c] * axis[c];
+		if (axisLength > 0.0f)
+		{
+			tMin /= axisLength;
+			tMax /= axisLength;
+		}
+
+		for (int c = 0; c < 4; c++)
+		{
+			low[c] = std::min(std::max(mean[c] + tMin * axis[c], 0.0f), 255.0f);
+			high[c] = std::min(std::max(mean[c] + tMax * axis[c], 0.0f), 255.0f);
+		}
+	}
+
+	///////////////////////////////////////////////////
+	//	UFitIndices(const Block&, const float[][4], int, int, unsigned char*)
+	//
+	//	Pick the closest palette entry for every texel, comparing the first
+	//	channels channels. Ties go to the lower index. Returns the squared
+	//	error of the block.
+	///////////////////////////////////////////////////
+	float UFitIndices(const Block& block, const float palette[][4], int paletteSize, int channels,
+		unsigned char indices[BLOCK_PIXELS])
+	{
+		float error = 0.0f;
+#if defined(__AVX2__)
+		for (int half = 0; half < BLOCK_PIXELS; half += 8)
+		{
+			__m256 texel[4];
+			for (int c = 0; c < channels; c++)
+				texel[c] = _mm256_loadu_ps(block.c[c] + half);
+
+			__m256 best = _mm256_set1_ps(FLT_MAX);
+			__m256 bestIndex = _mm256_setzero_ps();
+			for (int k = 0; k < paletteSize; k++)
+			{
+				__m256 distance = _mm256_setzero_ps();
+				for (int c = 0; c < channels; c++)
+				{
+					__m256 d = _mm256_sub_ps(texel[c], _mm256_set1_ps(palette[k][c]));
+					distance = _mm256_add_ps(distance, _mm256_mul_ps(d, d));
+				}
+				__m256 closer = _mm256_cmp_ps(distance, best, _CMP_LT_OQ);
+				best = _mm256_blendv_ps(best, distance, closer);
+				bestIndex = _mm256_blendv_ps(bestIndex, _mm256_set1_ps(float(k)), closer);
+			}
+
+			alignas(32) float lanes[8];
+			alignas(32) int32_t lanesIndex[8];
+			_mm256_store_ps(lanes, best);
+			_mm256_store_si256(reinterpret_cast<__m256i*>(lanesIndex), _mm256_cvtps_epi32(bestIndex));
+			for (int i = 0; i < 8; i++)
+			{
+				indices[half + i] = (unsigned char)lanesIndex[i];
+				error += lanes[i];
+			}
+		}
+#else
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+		{
+			float best = FLT_MAX;
+			int bestIndex = 0;
+			for (int k = 0; k < paletteSize; k++)
+			{
+				float distance = 0.0f;
+				for (int c = 0; c < channels; c++)
+				{
+					float d = block.c[c][i] - palette[k][c];
+					distance += d * d;
+				}
+				if (distance < best)
+				{
+					best = distance;
+					bestIndex = k;
+				}
+			}
+			indices[i] = (unsigned char)bestIndex;
+			error += best;
+		}
+#endif
+		return error;
+	}
+
+	// Least squares endpoints for fixed indices, where weights[index] is the
+	// fraction of the second endpoint. Returns false when the system is singular.
+	bool URefineEndpoints(const Block& block, const unsigned char indices[BLOCK_PIXELS], const float* weights,
+		int channels, float low[4], float high[4])
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ax[4] = {}, bx[4] = {};
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+		{
+			float b = weights[indices[i]];
+			float a = 1.0f - b;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < channels; c++)
+			{
+				ax[c] += a * block.c[c][i];
+				bx[c] += b * block.c[c][i];
+			}
+		}
+
+		float determinant = aa * bb - ab * ab;
+		if (std::fabs(determinant) < 1e-6f)
+			return false;
+
+		for (int c = 0; c < channels; c++)
+		{
+			low[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / determinant, 0.0f), 255.0f);
+			high[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / determinant, 0.0f), 255.0f);
+		}
+		return true;
+	}
+
+	inline uint16_t UPack565(const float color[4])
+	{
+		int r = int(std::lround(color[0] * 31.0f / 255.0f));
+		int g = int(std::lround(color[1] * 63.0f / 255.0f));
+		int b = int(std::lround(color[2] * 31.0f / 255.0f));
+		return uint16_t((r << 11) | (g << 5) | b);
+	}
+
+	inline void UUnpack565(uint16_t packed, float color[4])
+	{
+		int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+		color[0] = float((r << 3) | (r >> 2));
+		color[1] = float((g << 2) | (g >> 4));
+		color[2] = float((b << 3) | (b >> 2));
+		color[3] = 255.0f;
+	}
+
+	// Quantize the endpoints and fit the indices of a four color BC1 block.
+	// Returns the squared error.
+	float UQuantizeBC1(const Block& block, const float low[4], const float high[4], uint16_t endpoints[2],
+		unsigned char indices[BLOCK_PIXELS])
+	{
+		endpoints[0] = UPack565(high);
+		endpoints[1] = UPack565(low);
+		if (endpoints[0] < endpoints[1])
+			std::swap(endpoints[0], endpoints[1]);
+
+		float palette[4][4];
+		UUnpack565(endpoints[0], palette[0]);
+		UUnpack565(endpoints[1], palette[1]);
+		for (int c = 0; c < 4; c++)
+		{
+			palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+			palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+		}
+
+		// equal endpoints decode in three color mode, where only index 0 is safe
+		if (endpoints[0] == endpoints[1])
+			return UFitIndices(block, palette, 1, 3, indices);
+		return UFitIndices(block, palette, 4, 3, indices);
+	}
+
+	void UEncodeBC1(const Block& block, unsigned char* out)
+	{
+		float low[4], high[4];
+		UAxisEndpoints(block, 3, low, high);
+
+		uint16_t endpoints[2];
+		unsigned char indices[BLOCK_PIXELS];
+		float error = UQuantizeBC1(block, low, high, endpoints, indices);
+
+		// one least squares pass on the chosen indices
+		if (endpoints[0] != endpoints[1] && URefineEndpoints(block, indices, BC1_WEIGHTS, 3, low, high))
+		{
+			uint16_t refined[2];
+			unsigned char refinedIndices[BLOCK_PIXELS];
+			if (UQuantizeBC1(block, low, high, refined, refinedIndices) < error)
+			{
+				memcpy(endpoints, refined, sizeof(endpoints));
+				memcpy(indices, refinedIndices, sizeof(indices));
+			}
+		}
+
+		uint32_t bits = 0;
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+			bits |= uint32_t(indices[i]) << (2 * i);
+
+		out[0] = (unsigned char)(endpoints[0] & 0xFF);
+		out[1] = (unsigned char)(endpoints[0] >> 8);
+		out[2] = (unsigned char)(endpoints[1] & 0xFF);
+		out[3] = (unsigned char)(endpoints[1] >> 8);
+		for (int b = 0; b < 4; b++)
+			out[4 + b] = (unsigned char)(bits >> (8 * b));
+	}
+
+	// BC3/BC4 alpha block in eight value mode
+	void UEncodeAlpha(const Block& block, unsigned char* out)
+	{
+		float minAlpha = 255.0f, maxAlpha = 0.0f;
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+		{
+			minAlpha = std::min(minAlpha, block.c[3][i]);
+			maxAlpha = std::max(maxAlpha, block.c[3][i]);
+		}
+
+		int a0 = int(maxAlpha), a1 = int(minAlpha);
+		out[0] = (unsigned char)a0;
+		out[1] = (unsigned char)a1;
+
+		float palette[8];
+		palette[0] = float(a0);
+		palette[1] = float(a1);
+		for (int k = 1; k < 7; k++)
+			palette[k + 1] = float((7 - k) * a0 + k * a1) / 7.0f;
+
+		uint64_t bits = 0;
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+		{
+			int bestIndex = 0;
+			float best = FLT_MAX;
+			for (int k = 0; k < (a0 > a1 ? 8 : 1); k++)
+			{
+				float d = std::fabs(block.c[3][i] - palette[k]);
+				if (d < best)
+				{
+					best = d;
+					bestIndex = k;
+				}
+			}
+			bits |= uint64_t(bestIndex) << (3 * i);
+		}
+		for (int b = 0; b < 6; b++)
+			out[2 + b] = (unsigned char)(bits >> (8 * b));
+	}
+
+	void UEncodeBC3(const Block& block, unsigned char* out)
+	{
+		UEncodeAlpha(block, out);
+		UEncodeBC1(block, out + 8);
+	}
+
+	// 7-bit endpoint plus the shared bit that gives the smallest error
+	void UQuantizeBC7Endpoint(const float color[4], int quantized[4], int& pBit)
+	{
+		float bestError = FLT_MAX;
+		for (int p = 0; p < 2; p++)
+		{
+			int candidate[4];
+			float error = 0.0f;
+			for (int c = 0; c < 4; c++)
+			{
+				candidate[c] = std::min(std::max(int(std::lround((color[c] - p) / 2.0f)), 0), 127);
+				float d = float((candidate[c] << 1) | p) - color[c];
+				error += d * d;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				pBit = p;
+				memcpy(quantized, candidate, sizeof(candidate));
+			}
+		}
+	}
+
+	float UQuantizeBC7(const Block& block, const float low[4], const float high[4], int endpoints[2][4], int pBits[2],
+		unsigned char indices[BLOCK_PIXELS])
+	{
+		UQuantizeBC7Endpoint(low, endpoints[0], pBits[0]);
+		UQuantizeBC7Endpoint(high, endpoints[1], pBits[1]);
+
+		float palette[16][4];
+		for (int k = 0; k < 16; k++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				int e0 = (endpoints[0][c] << 1) | pBits[0];
+				int e1 = (endpoints[1][c] << 1) | pBits[1];
+				palette[k][c] = float(((64 - BC7_WEIGHTS[k]) * e0 + BC7_WEIGHTS[k] * e1 + 32) >> 6);
+			}
+		}
+		return UFitIndices(block, palette, 16, 4, indices);
+	}
+
+	inline void UPutBits(unsigned char* out, int& position, uint32_t value, int bits)
+	{
+		for (int b = 0; b < bits; b++, position++)
+		{
+			if ((value >> b) & 1)
+				out[position >> 3] |= (unsigned char)(1 << (position & 7));
+		}
+	}
+
+	// BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a shared bit, 4-bit indices
+	void UEncodeBC7(const Block& block, unsigned char* out)
+	{
+		float low[4], high[4];
+		UAxisEndpoints(block, 4, low, high);
+
+		int endpoints[2][4], pBits[2];
+		unsigned char indices[BLOCK_PIXELS];
+		float error = UQuantizeBC7(block, low, high, endpoints, pBits, indices);
+
+		float weights[16];
+		for (int k = 0; k < 16; k++)
+			weights[k] = BC7_WEIGHTS[k] / 64.0f;
+		if (URefineEndpoints(block, indices, weights, 4, low, high))
+		{
+			int refined[2][4], refinedBits[2];
+			unsigned char refinedIndices[BLOCK_PIXELS];
+			if (UQuantizeBC7(block, low, high, refined, refinedBits, refinedIndices) < error)
+			{
+				memcpy(endpoints, refined, sizeof(endpoints));
+				memcpy(pBits, refinedBits, sizeof(pBits));
+				memcpy(indices, refinedIndices, sizeof(indices));
+			}
+		}
+
+		// the first index is stored without its top bit, so it must be below 8
+		if (indices[0] & 8)
+		{
+			for (int c = 0; c < 4; c++)
+				std::swap(endpoints[0][c], endpoints[1][c]);
+			std::swap(pBits[0], pBits[1]);
+			for (int i = 0; i < BLOCK_PIXELS; i++)
+				indices[i] = (unsigned char)(15 - indices[i]);
+		}
+
+		memset(out, 0, 16);
+		int position = 0;
+		UPutBits(out, position, 1 << 6, 7);
+		for (int c = 0; c < 4; c++)
+		{
+			UPutBits(out, position, endpoints[0][c], 7);
+			UPutBits(out, position, endpoints[1][c], 7);
+		}
+		UPutBits(out, position, pBits[0], 1);
+		UPutBits(out, position, pBits[1], 1);
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+			UPutBits(out, position, indices[i], i == 0 ? 3 : 4);
+	}
+
+	// Run fn(begin, end) over [0, count), split across hardware threads for large inputs
+	template <typename Fn>
+	void UParallelFor(size_t count, size_t itemsPerUnit, Fn fn)
+	{
+		unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+		if (count * itemsPerUnit < PARALLEL_THRESHOLD || threads == 1)
+		{
+			fn(size_t(0), count);
+			return;
+		}
+
+		std::vector<std::thread> workers;
+		size_t chunk = (count + threads - 1) / threads;
+		for (size_t begin = 0; begin < count; begin += chunk)
+			workers.emplace_back(fn, begin, std::min(count, begin + chunk));
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+}
+
+
+size_t UBlockBytes(BlockFormat format)
+{
+	return format == BLOCK_BC1 ? 8 : 16;
+}
+
+
+size_t UCompressedSize(BlockFormat format, int width, int height)
+{
+	return size_t((width + 3) / 4) * size_t((height + 3) / 4) * UBlockBytes(format);
+}
+
+
+///////////////////////////////////////////////////
+//	UCompressImage(BlockFormat, const unsigned char*, int, int, std::vector<unsigned char>&)
+//
+//	format: block format to write
+//	rgba: width * height RGBA8 texels, first row first
+//	blocks: receives the blocks, row by row in the same order as the texels
+///////////////////////////////////////////////////
+void UCompressImage(BlockFormat format, const unsigned char* rgba, int width, int height,
+	std::vector<unsigned char>& blocks)
+{
+	const int blocksX = (width + 3) / 4;
+	const int blocksY = (height + 3) / 4;
+	const size_t blockBytes = UBlockBytes(format);
+	blocks.resize(UCompressedSize(format, width, height));
+
+	UParallelFor(size_t(blocksY), size_t(blocksX), [&](size_t begin, size_t end) {
+		Block block;
+		for (size_t y = begin; y < end; y++)
+		{
+			for (int x = 0; x < blocksX; x++)
+			{
+				ULoadBlock(rgba, width, height, x, int(y), block);
+				unsigned char* out = &blocks[(y * blocksX + x) * blockBytes];
+				if (format == BLOCK_BC1)
+					UEncodeBC1(block, out);
+				else if (format == BLOCK_BC3)
+					UEncodeBC3(block, out);
+				else
+					UEncodeBC7(block, out);
+			}
+		}
+	});
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+
+#include <cstddef>
+#include <vector>
+
+// Block compression formats written by the texture bake
+enum BlockFormat
+{
+	BLOCK_BC1,		// RGB, 8 bytes per 4x4 block
+	BLOCK_BC3,		// RGBA, BC1 color plus an 8 byte alpha block
+	BLOCK_BC7		// RGBA, 16 bytes per block (mode 6 only)
+};
+
+// Bytes of one 4x4 block
+size_t UBlockBytes(BlockFormat format);
+
+// Bytes of a width x height image once compressed
+size_t UCompressedSize(BlockFormat format, int width, int height);
+
+// Compress a tightly packed RGBA8 image. Edge blocks of images whose size
+// is not a multiple of four repeat the last row and column. Block rows are
+// shared out between hardware threads; the output does not depend on the
+// number of threads.
+void UCompressImage(BlockFormat format, const unsigned char* rgba, int width, int height,
+	std::vector<unsigned char>& blocks);
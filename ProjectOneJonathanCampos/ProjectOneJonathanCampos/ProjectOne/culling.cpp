@@ -0,0 +1,279 @@
+#include "culling.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <iostream>
+
+
+namespace
+{
+	// Must match local_size_x below
+	const GLuint workGroupSize = 64;
+
+	// Per object input of the culling shader (std430 layout)
+	struct CullObject
+	{
+		glm::vec4 boundsMin;	// world space, w unused
+		glm::vec4 boundsMax;
+		GLuint firstIndex;
+		GLuint indexCount;
+		GLuint batch;
+		GLuint firstCommand;	// first command of the batch
+		GLuint object;			// scene index, passed to the draw as its base instance
+		GLuint padding[3];
+	};
+
+	/* Frustum culling Compute Shader Source Code*/
+	const GLchar* cullShaderSource = GLSL(440,
+
+		layout(local_size_x = 64) in;
+
+	struct CullObject
+	{
+		vec4 boundsMin;
+		vec4 boundsMax;
+		uint firstIndex;
+		uint indexCount;
+		uint batch;
+		uint firstCommand;
+		uint object;
+	};
+
+	struct DrawCommand
+	{
+		uint count;
+		uint instanceCount;
+		uint firstIndex;
+		int baseVertex;
+		uint baseInstance;
+	};
+
+	layout(std430, binding = 0) readonly buffer ObjectBuffer { CullObject objects[]; };
+	layout(std430, binding = 1) writeonly buffer CommandBuffer { DrawCommand commands[]; };
+	layout(std430, binding = 2) buffer CountBuffer { uint counts[]; };
+
+	uniform vec4 uPlanes[6];	// frustum planes, normals pointing inside
+	uniform uint uObjectCount;
+	uniform bool uCompact;		// append visible objects, or keep every command and zero the culled ones
+
+	bool insideFrustum(vec3 boundsMin, vec3 boundsMax)
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			// corner furthest along the plane normal
+			vec3 corner = mix(boundsMin, boundsMax, step(vec3(0.0), uPlanes[i].xyz));
+			if (dot(uPlanes[i].xyz, corner) + uPlanes[i].w < 0.0)
+				return false;
+		}
+		return true;
+	}
+
+	void main()
+	{
+		uint id = gl_GlobalInvocationID.x;
+		if (id >= uObjectCount)
+			return;
+
+		CullObject object = objects[id];
+		bool visible = insideFrustum(object.boundsMin.xyz, object.boundsMax.xyz);
+
+		DrawCommand command;
+		command.count = object.indexCount;
+		command.instanceCount = visible ? 1u : 0u;
+		command.firstIndex = object.firstIndex;
+		command.baseVertex = 0;
+		command.baseInstance = object.object;
+
+		if (!uCompact)
+			commands[id] = command;
+		else if (visible)
+			commands[object.firstCommand + atomicAdd(counts[object.batch], 1u)] = command;
+	}
+	);
+
+	// Planes of the frustum of a view-projection matrix (Gribb/Hartmann),
+	// normalized, with normals pointing inside
+	void UFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+	{
+		glm::mat4 m = glm::transpose(viewProjection);
+		planes[0] = m[3] + m[0];	// left
+		planes[1] = m[3] - m[0];	// right
+		planes[2] = m[3] + m[1];	// bottom
+		planes[3] = m[3] - m[1];	// top
+		planes[4] = m[3] + m[2];	// near
+		planes[5] = m[3] - m[2];	// far
+		for (int i = 0; i < 6; i++)
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+}
+
+
+///////////////////////////////////////////////////
+//	Create()
+//
+//	Compile the culling compute shader and pick the draw path
+///////////////////////////////////////////////////
+bool GpuCuller::Create()
+{
+	if (!UCreateComputeProgram(cullShaderSource, mProgramId))
+		return false;
+
+	mIndirectCount = GLEW_VERSION_4_6 || GLEW_ARB_indirect_parameters;
+	if (!mIndirectCount)
+		std::cout << "INFO: No indirect draw count support, culled draws are kept with zero instances" << std::endl;
+
+	glGenBuffers(1, &mObjectBuffer);
+	glGenBuffers(1, &mCommandBuffer);
+	glGenBuffers(1, &mCountBuffer);
+	glGenBuffers(1, &mSceneIndexBuffer);
+	return true;
+}
+
+
+void GpuCuller::Destroy()
+{
+	glDeleteBuffers(1, &mObjectBuffer);
+	glDeleteBuffers(1, &mCommandBuffer);
+	glDeleteBuffers(1, &mCountBuffer);
+	glDeleteBuffers(1, &mSceneIndexBuffer);
+	glDeleteProgram(mProgramId);
+	mObjectBuffer = mCommandBuffer = mCountBuffer = mSceneIndexBuffer = mProgramId = 0;
+	mObjectCount = 0;
+	mFirstCommand.clear();
+	mCommandCount.clear();
+}
+
+
+///////////////////////////////////////////////////
+//	Build(const StaticBatcher&)
+//
+//	batcher: batches whose objects are culled
+//
+//	Each batch owns a run of commands as long as its object list, so the
+//	visible objects of a batch can never overflow into the next batch
+///////////////////////////////////////////////////
+void GpuCuller::Build(const StaticBatcher& batcher)
+{
+	std::vector<CullObject> objects;
+	size_t sceneObjects = 1;
+	mFirstCommand.clear();
+	mCommandCount.clear();
+
+	for (size_t b = 0; b < batcher.Batches().size(); b++)
+	{
+		const StaticBatch& batch = batcher.Batches()[b];
+		mFirstCommand.push_back(GLuint(objects.size()));
+		mCommandCount.push_back(GLuint(batch.ranges.size()));
+
+		for (const BatchRange& range : batch.ranges)
+		{
+			CullObject object;
+			object.boundsMin = glm::vec4(range.boundsMin, 0.0f);
+			object.boundsMax = glm::vec4(range.boundsMax, 0.0f);
+			object.firstIndex = range.firstIndex;
+			object.indexCount = range.indexCount;
+			object.batch = GLuint(b);
+			object.firstCommand = mFirstCommand.back();
+			object.object = GLuint(range.object);
+			objects.push_back(object);
+			sceneObjects = std::max(sceneObjects, range.object + 1);
+		}
+	}
+	mObjectCount = GLuint(objects.size());
+
+	// The base instance of each command is the object's scene index. Read
+	// through an instanced attribute of 0, 1, 2, ... it reaches the vertex
+	// shader as the index of the object's DrawMaterial.
+	std::vector<GLuint> sceneIndices(sceneObjects);
+	for (size_t i = 0; i < sceneIndices.size(); i++)
+		sceneIndices[i] = GLuint(i);
+	glBindBuffer(GL_ARRAY_BUFFER, mSceneIndexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * sceneIndices.size(), sceneIndices.data(), GL_STATIC_DRAW);
+
+	for (const StaticBatch& batch : batcher.Batches())
+		BindSceneIndices(batch.mesh.vao);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mObjectBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(CullObject) * objects.size(), objects.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mCommandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawCommand) * objects.size(), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mCountBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * mCommandCount.size(), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+
+void GpuCuller::BindSceneIndices(GLuint vao) const
+{
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, mSceneIndexBuffer);
+	glVertexAttribIPointer(MaterialPacker::MATERIAL_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+	glVertexAttribDivisor(MaterialPacker::MATERIAL_ATTRIBUTE, 1);
+	glEnableVertexAttribArray(MaterialPacker::MATERIAL_ATTRIBUTE);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+///////////////////////////////////////////////////
+//	Cull(const glm::mat4&)
+//
+//	viewProjection: camera projection * view
+//
+//	Reset the per batch counters and run the culling shader. The barrier
+//	makes the commands and counts visible to the following draws.
+///////////////////////////////////////////////////
+void GpuCuller::Cull(const glm::mat4& viewProjection)
+{
+	if (mObjectCount == 0)
+		return;
+
+	glm::vec4 planes[6];
+	UFrustumPlanes(viewProjection, planes);
+
+	const GLuint zero = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mCountBuffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glUseProgram(mProgramId);
+	glUniform4fv(glGetUniformLocation(mProgramId, "uPlanes"), 6, &planes[0][0]);
+	glUniform1ui(glGetUniformLocation(mProgramId, "uObjectCount"), mObjectCount);
+	glUniform1i(glGetUniformLocation(mProgramId, "uCompact"), mIndirectCount);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mObjectBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mCommandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, mCountBuffer);
+	glDispatchCompute((mObjectCount + workGroupSize - 1) / workGroupSize, 1, 1);
+
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+}
+
+
+///////////////////////////////////////////////////
+//	Draw(size_t)
+//
+//	Correct triangle drawing command:
+//
+//	glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, ...)
+///////////////////////////////////////////////////
+void GpuCuller::Draw(size_t batch) const
+{
+	const GLintptr commands = GLintptr(sizeof(DrawCommand)) * mFirstCommand[batch];
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mCommandBuffer);
+	if (mIndirectCount)
+	{
+		const GLintptr count = GLintptr(sizeof(GLuint) * batch);
+
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, mCountBuffer);
+		if (GLEW_VERSION_4_6)
+			glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)commands, count, mCommandCount[batch], 0);
+		else
+			glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)commands, count, mCommandCount[batch], 0);
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+	}
+	else
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)commands, mCommandCount[batch], 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "batch.h"
+
+// Frustum culls the objects inside the static batches with a compute
+// shader. Each visible object appends an indirect draw command for its
+// index range, so a batch is drawn with one multi-draw whose count is read
+// from the GPU and the CPU cost per frame does not grow with the number of
+// objects. Without GL 4.6 or ARB_indirect_parameters every object keeps
+// its command and culled ones get an instance count of zero.
+class GpuCuller
+{
+public:
+	bool Create();
+	void Destroy();
+
+	// Uploads the bounds and index ranges of every batched object and adds
+	// the per-instance scene index attribute to the batch VAOs. Call after
+	// the batches are rebuilt.
+	void Build(const StaticBatcher& batcher);
+
+	// Adds the per-instance scene index attribute to another VAO drawing a
+	// batch's indices with Draw(), such as a depth-only one
+	void BindSceneIndices(GLuint vao) const;
+
+	// Culls every batch against the frustum of viewProjection
+	void Cull(const glm::mat4& viewProjection);
+
+	// Draws the visible objects of a batch; its VAO must be bound
+	void Draw(size_t batch) const;
+
+	bool UsesIndirectCount() const { return mIndirectCount; }
+
+private:
+	// One entry per indirect draw command, laid out as in the compute shader
+	struct DrawCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	GLuint mProgramId = 0;
+	GLuint mObjectBuffer = 0;		// CullObject per batched object (SSBO)
+	GLuint mCommandBuffer = 0;		// DrawCommand per batched object (GL_DRAW_INDIRECT_BUFFER)
+	GLuint mCountBuffer = 0;		// visible object count per batch (GL_PARAMETER_BUFFER)
+	GLuint mSceneIndexBuffer = 0;	// 0, 1, 2, ... read per instance from the base instance
+	GLuint mObjectCount = 0;
+	bool mIndirectCount = false;
+
+	// first command and object count of each batch
+	std::vector<GLuint> mFirstCommand;
+	std::vector<GLuint> mCommandCount;
+};
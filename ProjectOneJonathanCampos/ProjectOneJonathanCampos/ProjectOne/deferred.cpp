@@ -0,0 +1,187 @@
+#include "deferred.h"
+#include "permutation.h"
+#include "shader.h"
+
+#include <string>
+
+
+const GLint DeferredRenderer::ALBEDO_UNIT;
+const GLint DeferredRenderer::NORMAL_UNIT;
+const GLint DeferredRenderer::DEPTH_UNIT;
+
+
+namespace
+{
+	/* Full-screen triangle Vertex Shader Source Code*/
+	const GLchar* fullScreenVertexSource = GLSL(440,
+
+	void main()
+	{
+		// vertices 0, 1, 2 cover the viewport with one triangle
+		gl_Position = vec4(vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2)) * 2.0f - 1.0f, 0.0f, 1.0f);
+	}
+	);
+
+	/* Lighting pass Fragment Shader Source Code*/
+	// The lighting library and its defines are inserted after the #version line
+	const GLchar* lightingPassSource = GLSL(440,
+
+		layout(binding = 2) uniform sampler2D gBufferAlbedo;	// DeferredRenderer::ALBEDO_UNIT
+	layout(binding = 3) uniform sampler2D gBufferNormal;	// NORMAL_UNIT
+	layout(binding = 4) uniform sampler2D gBufferDepth;		// DEPTH_UNIT
+
+	uniform mat4 inverseViewProjection;
+
+	out vec4 fragmentColor;
+
+	void main()
+	{
+		ivec2 pixel = ivec2(gl_FragCoord.xy);
+		float depth = texelFetch(gBufferDepth, pixel, 0).r;
+		if (depth == 1.0f)
+			discard; // nothing was drawn here
+
+		vec4 albedo = texelFetch(gBufferAlbedo, pixel, 0);
+		vec3 norm = decodeNormal(texelFetch(gBufferNormal, pixel, 0).rg);
+
+		// world position of the pixel, back from its depth
+		vec2 ndc = gl_FragCoord.xy / vec2(textureSize(gBufferDepth, 0)) * 2.0f - 1.0f;
+		vec4 position = inverseViewProjection * vec4(ndc, depth * 2.0f - 1.0f, 1.0f);
+		position /= position.w;
+
+		vec3 viewDir = ORTHO == 1 ? viewDirection : normalize(viewPosition - position.xyz);
+		fragmentColor = vec4(shadePhong(position.xyz, norm, viewDir, albedo.a) * albedo.rgb, 1.0f);
+	}
+	);
+}
+
+
+///////////////////////////////////////////////////
+//	Create(const char*, int)
+//
+//	lightingLibrary: defines shadePhong() and decodeNormal()
+//	lightCount: key lights of the scene
+//
+//	The passes light with specular on; the G-buffer says how much of it
+//	each pixel gets
+///////////////////////////////////////////////////
+bool DeferredRenderer::Create(const char* lightingLibrary, int lightCount)
+{
+	Destroy();
+
+	ShaderFeatures features;
+	features.textured = false;
+	features.lightCount = lightCount;
+	features.specular = true;
+	for (int ortho = 0; ortho < 2; ortho++)
+	{
+		features.ortho = ortho != 0;
+		std::string header = features.Defines() + lightingLibrary + "\n";
+		GLuint programId;
+		bool linked = UCreateShaderProgram(fullScreenVertexSource, lightingPassSource, header.c_str(), programId);
+		mPrograms.push_back(programId);
+		if (!linked)
+			return false;
+	}
+
+	glGenVertexArrays(1, &mVao);
+	return true;
+}
+
+
+void DeferredRenderer::Destroy()
+{
+	DestroyTargets();
+	for (GLuint programId : mPrograms)
+		glDeleteProgram(programId);
+	mPrograms.clear();
+	glDeleteVertexArrays(1, &mVao);
+	mVao = 0;
+}
+
+
+void DeferredRenderer::BeginGeometry(int width, int height)
+{
+	if (mFramebuffer == 0 || width != mWidth || height != mHeight)
+		CreateTargets(width, height);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+
+///////////////////////////////////////////////////
+//	Light(bool, const glm::mat4&, GLuint)
+//
+//	ortho: pick the orthographic pass
+//	viewProjection: matrix the G-buffer was drawn with
+//	framebuffer: target of the lit pixels
+//
+//	Pixels nothing was drawn on are discarded and keep the clear color
+///////////////////////////////////////////////////
+void DeferredRenderer::Light(bool ortho, const glm::mat4& viewProjection, GLuint framebuffer)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+	GLuint programId = mPrograms[ortho ? 1 : 0];
+	glUseProgram(programId);
+	glm::mat4 inverseViewProjection = glm::inverse(viewProjection);
+	glUniformMatrix4fv(glGetUniformLocation(programId, "inverseViewProjection"), 1, GL_FALSE, &inverseViewProjection[0][0]);
+
+	glActiveTexture(GL_TEXTURE0 + ALBEDO_UNIT);
+	glBindTexture(GL_TEXTURE_2D, mAlbedo);
+	glActiveTexture(GL_TEXTURE0 + NORMAL_UNIT);
+	glBindTexture(GL_TEXTURE_2D, mNormal);
+	glActiveTexture(GL_TEXTURE0 + DEPTH_UNIT);
+	glBindTexture(GL_TEXTURE_2D, mDepth);
+
+	glDisable(GL_DEPTH_TEST);
+	glBindVertexArray(mVao);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+	glEnable(GL_DEPTH_TEST);
+}
+
+
+void DeferredRenderer::CreateTargets(int width, int height)
+{
+	DestroyTargets();
+	mWidth = width;
+	mHeight = height;
+
+	struct Target { GLuint* texture; GLenum format; GLenum attachment; };
+	const Target targets[] = {
+		{ &mAlbedo, GL_SRGB8_ALPHA8, GL_COLOR_ATTACHMENT0 },
+		{ &mNormal, GL_RG16, GL_COLOR_ATTACHMENT1 },
+		{ &mDepth, GL_DEPTH_COMPONENT24, GL_DEPTH_ATTACHMENT },
+	};
+
+	// created on a unit of their own, so the scene's bound textures stay put
+	glActiveTexture(GL_TEXTURE0 + ALBEDO_UNIT);
+	glGenFramebuffers(1, &mFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+	for (const Target& target : targets)
+	{
+		glGenTextures(1, target.texture);
+		glBindTexture(GL_TEXTURE_2D, *target.texture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, target.format, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, target.attachment, GL_TEXTURE_2D, *target.texture, 0);
+	}
+
+	const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, drawBuffers);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+void DeferredRenderer::DestroyTargets()
+{
+	glDeleteFramebuffers(1, &mFramebuffer);
+	glDeleteTextures(1, &mAlbedo);
+	glDeleteTextures(1, &mNormal);
+	glDeleteTextures(1, &mDepth);
+	mFramebuffer = mAlbedo = mNormal = mDepth = 0;
+	mWidth = mHeight = 0;
+}
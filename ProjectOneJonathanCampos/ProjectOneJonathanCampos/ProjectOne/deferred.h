@@ -0,0 +1,57 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Deferred shading. The scene is drawn once into a compact G-buffer, then
+// lit by one full-screen pass, so every pixel is lit once however many
+// surfaces were drawn over it:
+//
+//	target 0, SRGB8_ALPHA8: albedo, and specular in alpha; the linear
+//	  albedo is stored sRGB encoded so dark colors keep their precision
+//	target 1, RG16: octahedral normal
+//	depth, 24 bit: the world position is rebuilt from it
+//
+// The G-buffer is written by the DEFERRED variants of the scene shader
+// (see ShaderPermutations); the lighting pass uses the same lighting code
+// as the forward shader, so both paths give the same picture.
+class DeferredRenderer
+{
+public:
+	// Texture units the lighting pass reads the G-buffer from
+	static const GLint ALBEDO_UNIT = 2;
+	static const GLint NORMAL_UNIT = 3;
+	static const GLint DEPTH_UNIT = 4;
+
+	// lightingLibrary: the shared lighting functions, inserted after the
+	// feature defines; lightCount: key lights it is built for. Builds the
+	// perspective and orthographic lighting passes.
+	bool Create(const char* lightingLibrary, int lightCount);
+	void Destroy();
+
+	// Binds the G-buffer, sized to the viewport, and clears it
+	void BeginGeometry(int width, int height);
+
+	// Lights the G-buffer into framebuffer, the default one unless given
+	void Light(bool ortho, const glm::mat4& viewProjection, GLuint framebuffer = 0);
+
+	// The lighting passes, for their frame uniforms
+	const std::vector<GLuint>& Programs() const { return mPrograms; }
+
+private:
+	void CreateTargets(int width, int height);
+	void DestroyTargets();
+
+	std::vector<GLuint> mPrograms;	// perspective, orthographic
+	GLuint mVao = 0;				// the full-screen triangle has no vertex data
+	GLuint mFramebuffer = 0;
+	GLuint mAlbedo = 0;
+	GLuint mNormal = 0;
+	GLuint mDepth = 0;
+	int mWidth = 0;
+	int mHeight = 0;
+};
@@ -0,0 +1,677 @@
+#include "geometry.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <malloc.h>
+#endif
+
+
+namespace
+{
+	const size_t ALIGNMENT = 64;
+	const size_t FLOATS_PER_LINE = ALIGNMENT / sizeof(float);
+
+	// 32-bit lane constants for the hash (xxHash32 primes)
+	const uint32_t HASH_PRIME1 = 0x9E3779B1u;
+	const uint32_t HASH_PRIME2 = 0x85EBCA77u;
+	const int HASH_LANES = 8;
+
+	float* UAlignedAlloc(size_t floats)
+	{
+		size_t bytes = std::max<size_t>(floats, 1) * sizeof(float);
+#ifdef _MSC_VER
+		return static_cast<float*>(_aligned_malloc(bytes, ALIGNMENT));
+#else
+		return static_cast<float*>(aligned_alloc(ALIGNMENT, (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT));
+#endif
+	}
+
+	void UAlignedFree(float* block)
+	{
+#ifdef _MSC_VER
+		_aligned_free(block);
+#else
+		free(block);
+#endif
+	}
+
+	// Round a stream capacity up to whole cache lines
+	size_t UPaddedCapacity(size_t capacity)
+	{
+		return (capacity + FLOATS_PER_LINE - 1) / FLOATS_PER_LINE * FLOATS_PER_LINE;
+	}
+
+	inline uint32_t URotl32(uint32_t x, int r)
+	{
+		return (x << r) | (x >> (32 - r));
+	}
+
+	inline uint32_t UHashRound(uint32_t lane, uint32_t word)
+	{
+		return URotl32(lane + word * HASH_PRIME2, 13) * HASH_PRIME1;
+	}
+
+	// Hash a run of 32-bit words into eight independent lanes; word i always
+	// lands in lane i % 8 so the scalar and AVX2 paths agree bit for bit.
+	void UHashWords(const uint32_t* words, size_t count, uint32_t lanes[HASH_LANES])
+	{
+		size_t i = 0;
+#if defined(__AVX2__)
+		__m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes));
+		const __m256i prime1 = _mm256_set1_epi32(int(HASH_PRIME1));
+		const __m256i prime2 = _mm256_set1_epi32(int(HASH_PRIME2));
+		for (; i + HASH_LANES <= count; i += HASH_LANES)
+		{
+			__m256i k = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+			h = _mm256_add_epi32(h, _mm256_mullo_epi32(k, prime2));
+			h = _mm256_or_si256(_mm256_slli_epi32(h, 13), _mm256_srli_epi32(h, 19));
+			h = _mm256_mullo_epi32(h, prime1);
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), h);
+#endif
+		for (; i < count; i++)
+			lanes[i % HASH_LANES] = UHashRound(lanes[i % HASH_LANES], words[i]);
+	}
+
+	void UHashInit(uint32_t lanes[HASH_LANES], uint64_t seed)
+	{
+		for (int l = 0; l < HASH_LANES; l++)
+			lanes[l] = uint32_t(seed) + uint32_t(seed >> 32) + HASH_PRIME1 * uint32_t(l + 1);
+	}
+
+	uint64_t UHashFinish(const uint32_t lanes[HASH_LANES], uint64_t length)
+	{
+		uint64_t acc = length * 0x9E3779B97F4A7C15ull;
+		for (int l = 0; l < HASH_LANES; l++)
+			acc = (acc ^ lanes[l]) * 0x100000001B3ull;
+
+		// final avalanche
+		acc ^= acc >> 33;
+		acc *= 0xFF51AFD7ED558CCDull;
+		acc ^= acc >> 33;
+		acc *= 0xC4CEB9FE1A85EC53ull;
+		acc ^= acc >> 33;
+		return acc;
+	}
+
+#if defined(__AVX2__)
+	// In-place transpose of an 8x8 block of floats held in eight registers
+	inline void UTranspose8x8(__m256 r[8])
+	{
+		__m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+		__m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+		__m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+		__m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+		__m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+		__m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+		__m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+		__m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+
+		__m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+		r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+		r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+		r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+		r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+		r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+		r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+		r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+		r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+	}
+#endif
+}
+
+
+///////////////////////////////////////////////////
+//	VertexFormat
+///////////////////////////////////////////////////
+VertexFormat VertexFormat::PositionNormalUV()
+{
+	VertexFormat format;
+	format.attributes.push_back({ STREAM_PX, 3, 0 });
+	format.attributes.push_back({ STREAM_NX, 3, 3 });
+	format.attributes.push_back({ STREAM_U, 2, 6 });
+	format.stride = 8;
+	return format;
+}
+
+VertexFormat VertexFormat::Position()
+{
+	VertexFormat format;
+	format.attributes.push_back({ STREAM_PX, 3, 0 });
+	format.stride = 3;
+	return format;
+}
+
+// True when the format is exactly the eight streams in order, which maps onto an 8x8 transpose
+bool VertexFormat::IsPositionNormalUV() const
+{
+	if (stride != STREAM_COUNT)
+		return false;
+
+	GLuint covered = 0;
+	for (const VertexAttribute& attribute : attributes)
+	{
+		if (attribute.offset != attribute.firstStream)
+			return false;
+		covered += attribute.components;
+	}
+	return covered == STREAM_COUNT;
+}
+
+
+///////////////////////////////////////////////////
+//	Geometry construction and storage
+///////////////////////////////////////////////////
+Geometry::Geometry() : mBlock(nullptr), mCount(0), mCapacity(0)
+{
+	for (int s = 0; s < STREAM_COUNT; s++)
+		mStreams[s] = nullptr;
+}
+
+Geometry::Geometry(size_t count) : Geometry()
+{
+	Resize(count);
+}
+
+Geometry::Geometry(const Geometry& other) : Geometry()
+{
+	*this = other;
+}
+
+Geometry::Geometry(Geometry&& other) noexcept : Geometry()
+{
+	*this = std::move(other);
+}
+
+Geometry& Geometry::operator=(const Geometry& other)
+{
+	if (this != &other)
+	{
+		Resize(other.mCount);
+		for (int s = 0; s < STREAM_COUNT; s++)
+			std::memcpy(mStreams[s], other.mStreams[s], sizeof(float) * mCount);
+	}
+	return *this;
+}
+
+Geometry& Geometry::operator=(Geometry&& other) noexcept
+{
+	if (this != &other)
+	{
+		UAlignedFree(mBlock);
+		mBlock = other.mBlock;
+		mCount = other.mCount;
+		mCapacity = other.mCapacity;
+		for (int s = 0; s < STREAM_COUNT; s++)
+			mStreams[s] = other.mStreams[s];
+
+		other.mBlock = nullptr;
+		other.mCount = 0;
+		other.mCapacity = 0;
+		for (int s = 0; s < STREAM_COUNT; s++)
+			other.mStreams[s] = nullptr;
+	}
+	return *this;
+}
+
+Geometry::~Geometry()
+{
+	UAlignedFree(mBlock);
+}
+
+// All streams live in one block, each starting on a 64-byte boundary
+void Geometry::UReallocate(size_t capacity)
+{
+	size_t padded = UPaddedCapacity(capacity);
+	float* block = UAlignedAlloc(padded * STREAM_COUNT);
+
+	for (int s = 0; s < STREAM_COUNT; s++)
+	{
+		float* stream = block + padded * s;
+		if (mCount > 0)
+			std::memcpy(stream, mStreams[s], sizeof(float) * mCount);
+		mStreams[s] = stream;
+	}
+
+	UAlignedFree(mBlock);
+	mBlock = block;
+	mCapacity = padded;
+}
+
+void Geometry::Reserve(size_t capacity)
+{
+	if (capacity > mCapacity || mBlock == nullptr)
+		UReallocate(std::max(capacity, mCapacity));
+}
+
+void Geometry::Resize(size_t count)
+{
+	Reserve(count);
+	mCount = count;
+}
+
+void Geometry::PushVertex(const glm::vec3& position, const glm::vec3& normal, const glm::vec2& uv)
+{
+	if (mCount == mCapacity || mBlock == nullptr)
+		UReallocate(std::max<size_t>(mCapacity * 2, FLOATS_PER_LINE));
+
+	mStreams[STREAM_PX][mCount] = position.x;
+	mStreams[STREAM_PY][mCount] = position.y;
+	mStreams[STREAM_PZ][mCount] = position.z;
+	mStreams[STREAM_NX][mCount] = normal.x;
+	mStreams[STREAM_NY][mCount] = normal.y;
+	mStreams[STREAM_NZ][mCount] = normal.z;
+	mStreams[STREAM_U][mCount] = uv.x;
+	mStreams[STREAM_V][mCount] = uv.y;
+	mCount++;
+}
+
+// Append every vertex of other after the current ones
+void Geometry::Append(const Geometry& other)
+{
+	size_t base = mCount;
+	if (base + other.mCount > mCapacity || mBlock == nullptr)
+		UReallocate(std::max(base + other.mCount, mCapacity * 2));
+
+	for (int s = 0; s < STREAM_COUNT; s++)
+		std::memcpy(mStreams[s] + base, other.mStreams[s], sizeof(float) * other.mCount);
+	mCount = base + other.mCount;
+}
+
+glm::vec3 Geometry::Position(size_t i) const
+{
+	return glm::vec3(mStreams[STREAM_PX][i], mStreams[STREAM_PY][i], mStreams[STREAM_PZ][i]);
+}
+
+glm::vec3 Geometry::Normal(size_t i) const
+{
+	return glm::vec3(mStreams[STREAM_NX][i], mStreams[STREAM_NY][i], mStreams[STREAM_NZ][i]);
+}
+
+glm::vec2 Geometry::UV(size_t i) const
+{
+	return glm::vec2(mStreams[STREAM_U][i], mStreams[STREAM_V][i]);
+}
+
+
+///////////////////////////////////////////////////
+//	ComputeBounds(glm::vec3&, glm::vec3&)
+//
+//	Axis aligned bounding box of the positions
+///////////////////////////////////////////////////
+void Geometry::ComputeBounds(glm::vec3& minCorner, glm::vec3& maxCorner) const
+{
+	minCorner = glm::vec3(FLT_MAX);
+	maxCorner = glm::vec3(-FLT_MAX);
+
+	const float* px = mStreams[STREAM_PX];
+	const float* py = mStreams[STREAM_PY];
+	const float* pz = mStreams[STREAM_PZ];
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	if (mCount >= 8)
+	{
+		__m256 minX = _mm256_set1_ps(FLT_MAX), minY = minX, minZ = minX;
+		__m256 maxX = _mm256_set1_ps(-FLT_MAX), maxY = maxX, maxZ = maxX;
+		for (; i + 8 <= mCount; i += 8)
+		{
+			__m256 x = _mm256_load_ps(px + i);
+			__m256 y = _mm256_load_ps(py + i);
+			__m256 z = _mm256_load_ps(pz + i);
+			minX = _mm256_min_ps(minX, x);
+			minY = _mm256_min_ps(minY, y);
+			minZ = _mm256_min_ps(minZ, z);
+			maxX = _mm256_max_ps(maxX, x);
+			maxY = _mm256_max_ps(maxY, y);
+			maxZ = _mm256_max_ps(maxZ, z);
+		}
+
+		alignas(32) float lanes[6][8];
+		_mm256_store_ps(lanes[0], minX);
+		_mm256_store_ps(lanes[1], minY);
+		_mm256_store_ps(lanes[2], minZ);
+		_mm256_store_ps(lanes[3], maxX);
+		_mm256_store_ps(lanes[4], maxY);
+		_mm256_store_ps(lanes[5], maxZ);
+		for (int l = 0; l < 8; l++)
+		{
+			minCorner = glm::min(minCorner, glm::vec3(lanes[0][l], lanes[1][l], lanes[2][l]));
+			maxCorner = glm::max(maxCorner, glm::vec3(lanes[3][l], lanes[4][l], lanes[5][l]));
+		}
+	}
+#endif
+
+	for (; i < mCount; i++)
+	{
+		glm::vec3 p(px[i], py[i], pz[i]);
+		minCorner = glm::min(minCorner, p);
+		maxCorner = glm::max(maxCorner, p);
+	}
+}
+
+
+///////////////////////////////////////////////////
+//	ComputeBoundingSphere(glm::vec3&, float&)
+//
+//	Sphere centered on the bounding box, with the radius of the farthest
+//	vertex from that center
+///////////////////////////////////////////////////
+void Geometry::ComputeBoundingSphere(glm::vec3& center, float& radius) const
+{
+	glm::vec3 minCorner, maxCorner;
+	ComputeBounds(minCorner, maxCorner);
+	center = mCount > 0 ? (minCorner + maxCorner) * 0.5f : glm::vec3(0.0f);
+
+	const float* px = mStreams[STREAM_PX];
+	const float* py = mStreams[STREAM_PY];
+	const float* pz = mStreams[STREAM_PZ];
+	float maxDistance2 = 0.0f;
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	if (mCount >= 8)
+	{
+		const __m256 cx = _mm256_set1_ps(center.x);
+		const __m256 cy = _mm256_set1_ps(center.y);
+		const __m256 cz = _mm256_set1_ps(center.z);
+		__m256 best = _mm256_setzero_ps();
+		for (; i + 8 <= mCount; i += 8)
+		{
+			__m256 dx = _mm256_sub_ps(_mm256_load_ps(px + i), cx);
+			__m256 dy = _mm256_sub_ps(_mm256_load_ps(py + i), cy);
+			__m256 dz = _mm256_sub_ps(_mm256_load_ps(pz + i), cz);
+			__m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_add_ps(_mm256_mul_ps(dy, dy), _mm256_mul_ps(dz, dz)));
+			best = _mm256_max_ps(best, d2);
+		}
+
+		alignas(32) float lanes[8];
+		_mm256_store_ps(lanes, best);
+		for (int l = 0; l < 8; l++)
+			maxDistance2 = std::max(maxDistance2, lanes[l]);
+	}
+#endif
+
+	for (; i < mCount; i++)
+	{
+		float dx = px[i] - center.x;
+		float dy = py[i] - center.y;
+		float dz = pz[i] - center.z;
+		maxDistance2 = std::max(maxDistance2, dx * dx + dy * dy + dz * dz);
+	}
+
+	radius = std::sqrt(maxDistance2);
+}
+
+
+///////////////////////////////////////////////////
+//	Transform(const glm::mat4&)
+//
+//	model: affine transform to apply
+//
+//	Transform positions by the model matrix and normals by its inverse
+//	transpose, renormalizing the normals afterwards
+///////////////////////////////////////////////////
+void Geometry::Transform(const glm::mat4& model)
+{
+	const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+
+	float* px = mStreams[STREAM_PX];
+	float* py = mStreams[STREAM_PY];
+	float* pz = mStreams[STREAM_PZ];
+	float* nx = mStreams[STREAM_NX];
+	float* ny = mStreams[STREAM_NY];
+	float* nz = mStreams[STREAM_NZ];
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	__m256 m[4][3];
+	__m256 n[3][3];
+	for (int c = 0; c < 4; c++)
+		for (int r = 0; r < 3; r++)
+			m[c][r] = _mm256_set1_ps(model[c][r]);
+	for (int c = 0; c < 3; c++)
+		for (int r = 0; r < 3; r++)
+			n[c][r] = _mm256_set1_ps(normalMatrix[c][r]);
+	const __m256 tiny = _mm256_set1_ps(1e-20f);
+
+	for (; i + 8 <= mCount; i += 8)
+	{
+		__m256 x = _mm256_load_ps(px + i);
+		__m256 y = _mm256_load_ps(py + i);
+		__m256 z = _mm256_load_ps(pz + i);
+		for (int r = 0; r < 3; r++)
+		{
+			__m256 result = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[0][r], x), _mm256_mul_ps(m[1][r], y)),
+				_mm256_add_ps(_mm256_mul_ps(m[2][r], z), m[3][r]));
+			_mm256_store_ps(mStreams[STREAM_PX + r] + i, result);
+		}
+
+		x = _mm256_load_ps(nx + i);
+		y = _mm256_load_ps(ny + i);
+		z = _mm256_load_ps(nz + i);
+		__m256 t[3];
+		for (int r = 0; r < 3; r++)
+			t[r] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(n[0][r], x), _mm256_mul_ps(n[1][r], y)), _mm256_mul_ps(n[2][r], z));
+		__m256 length = _mm256_sqrt_ps(_mm256_max_ps(tiny,
+			_mm256_add_ps(_mm256_mul_ps(t[0], t[0]), _mm256_add_ps(_mm256_mul_ps(t[1], t[1]), _mm256_mul_ps(t[2], t[2])))));
+		for (int r = 0; r < 3; r++)
+			_mm256_store_ps(mStreams[STREAM_NX + r] + i, _mm256_div_ps(t[r], length));
+	}
+#endif
+
+	for (; i < mCount; i++)
+	{
+		glm::vec3 p = glm::vec3(model * glm::vec4(px[i], py[i], pz[i], 1.0f));
+		px[i] = p.x;
+		py[i] = p.y;
+		pz[i] = p.z;
+
+		glm::vec3 normal = normalMatrix * glm::vec3(nx[i], ny[i], nz[i]);
+		normal /= std::sqrt(std::max(1e-20f, glm::dot(normal, normal)));
+		nx[i] = normal.x;
+		ny[i] = normal.y;
+		nz[i] = normal.z;
+	}
+}
+
+
+///////////////////////////////////////////////////
+//	Interleave(const VertexFormat&, std::vector<GLfloat>&)
+//
+//	format: layout of the interleaved vertices
+//	out: receives Size() * format.stride floats
+//
+//	Build the interleaved vertex buffer that is sent to the GPU
+///////////////////////////////////////////////////
+void Geometry::Interleave(const VertexFormat& format, std::vector<GLfloat>& out) const
+{
+	out.resize(mCount * format.stride);
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	// the full eight-float layout is an 8x8 transpose of the streams
+	if (format.IsPositionNormalUV())
+	{
+		__m256 r[8];
+		for (; i + 8 <= mCount; i += 8)
+		{
+			for (int s = 0; s < STREAM_COUNT; s++)
+				r[s] = _mm256_load_ps(mStreams[s] + i);
+			UTranspose8x8(r);
+			for (int k = 0; k < 8; k++)
+				_mm256_storeu_ps(&out[(i + k) * 8], r[k]);
+		}
+	}
+#endif
+
+	for (const VertexAttribute& attribute : format.attributes)
+	{
+		for (GLuint c = 0; c < attribute.components; c++)
+		{
+			const float* stream = mStreams[attribute.firstStream + c];
+			GLfloat* dst = out.data() + attribute.offset + c;
+			for (size_t v = i; v < mCount; v++)
+				dst[v * format.stride] = stream[v];
+		}
+	}
+}
+
+
+///////////////////////////////////////////////////
+//	Deinterleave(const VertexFormat&, const GLfloat*, size_t)
+//
+//	format: layout of the interleaved vertices
+//	in: interleaved vertex data
+//	count: number of vertices in `in`
+//
+//	Replace the contents with interleaved data; streams the format does not
+//	cover are zeroed
+///////////////////////////////////////////////////
+void Geometry::Deinterleave(const VertexFormat& format, const GLfloat* in, size_t count)
+{
+	Resize(count);
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	if (format.IsPositionNormalUV())
+	{
+		__m256 r[8];
+		for (; i + 8 <= mCount; i += 8)
+		{
+			for (int k = 0; k < 8; k++)
+				r[k] = _mm256_loadu_ps(in + (i + k) * 8);
+			UTranspose8x8(r);
+			for (int s = 0; s < STREAM_COUNT; s++)
+				_mm256_store_ps(mStreams[s] + i, r[s]);
+		}
+	}
+#endif
+
+	bool covered[STREAM_COUNT] = {};
+	for (const VertexAttribute& attribute : format.attributes)
+	{
+		for (GLuint c = 0; c < attribute.components; c++)
+		{
+			float* stream = mStreams[attribute.firstStream + c];
+			const GLfloat* src = in + attribute.offset + c;
+			for (size_t v = i; v < mCount; v++)
+				stream[v] = src[v * format.stride];
+			covered[attribute.firstStream + c] = true;
+		}
+	}
+
+	for (int s = 0; s < STREAM_COUNT; s++)
+	{
+		if (!covered[s])
+			std::fill(mStreams[s], mStreams[s] + mCount, 0.0f);
+	}
+}
+
+
+///////////////////////////////////////////////////
+//	Hash()
+//
+//	64-bit content hash over every stream. Equal geometry gives equal
+//	hashes regardless of capacity or whether AVX2 is available.
+///////////////////////////////////////////////////
+uint64_t Geometry::Hash() const
+{
+	uint32_t lanes[HASH_LANES];
+	UHashInit(lanes, mCount);
+
+	for (int s = 0; s < STREAM_COUNT; s++)
+	{
+		// streams are hashed as independent runs so lane assignment restarts per stream
+		uint32_t streamLanes[HASH_LANES];
+		UHashInit(streamLanes, uint64_t(s) + 1);
+		UHashWords(reinterpret_cast<const uint32_t*>(mStreams[s]), mCount, streamLanes);
+		for (int l = 0; l < HASH_LANES; l++)
+			lanes[l] = UHashRound(lanes[l], streamLanes[l]);
+	}
+
+	return UHashFinish(lanes, uint64_t(mCount) * STREAM_COUNT * sizeof(float));
+}
+
+
+///////////////////////////////////////////////////
+//	UHashBytes(const void*, size_t, uint64_t)
+//
+//	64-bit content hash of an arbitrary byte range
+///////////////////////////////////////////////////
+uint64_t UHashBytes(const void* data, size_t size, uint64_t seed)
+{
+	uint32_t lanes[HASH_LANES];
+	UHashInit(lanes, seed);
+
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	const size_t words = size / sizeof(uint32_t);
+
+	// hash whole words in chunks so unaligned input never needs a full copy
+	uint32_t chunk[1024];
+	size_t done = 0;
+	while (done < words)
+	{
+		size_t n = std::min<size_t>(words - done, 1024);
+		std::memcpy(chunk, bytes + done * sizeof(uint32_t), n * sizeof(uint32_t));
+
+		// keep lane assignment continuous across chunks (chunk size is a multiple of 8)
+		UHashWords(chunk, n, lanes);
+		done += n;
+	}
+
+	size_t tail = size - words * sizeof(uint32_t);
+	if (tail > 0)
+	{
+		uint32_t last = 0;
+		std::memcpy(&last, bytes + words * sizeof(uint32_t), tail);
+		lanes[words % HASH_LANES] = UHashRound(lanes[words % HASH_LANES], last);
+	}
+
+	return UHashFinish(lanes, size);
+}
+
+
+///////////////////////////////////////////////////
+//	UCpuSupportsBuild()
+//
+//	AVX2 needs the CPUID feature bits and the OS saving the YMM registers
+//	(OSXSAVE, then XCR0 bits 1 and 2)
+///////////////////////////////////////////////////
+bool UCpuSupportsBuild()
+{
+#if defined(__AVX2__) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	const int OSXSAVE = 1 << 27, AVX = 1 << 28, FMA = 1 << 12;
+	if ((info[2] & (OSXSAVE | AVX | FMA)) != (OSXSAVE | AVX | FMA) || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(__AVX2__)
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+	return true;
+#endif
+}
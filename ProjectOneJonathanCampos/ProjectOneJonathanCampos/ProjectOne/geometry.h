@@ -0,0 +1,98 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Structure-of-arrays streams held by Geometry
+enum GeometryStream
+{
+	STREAM_PX,
+	STREAM_PY,
+	STREAM_PZ,
+	STREAM_NX,
+	STREAM_NY,
+	STREAM_NZ,
+	STREAM_U,
+	STREAM_V,
+	STREAM_COUNT
+};
+
+// One attribute of an interleaved vertex, read from consecutive streams
+struct VertexAttribute
+{
+	GLuint firstStream;	// first GeometryStream the attribute reads from
+	GLuint components;	// number of consecutive streams (and floats)
+	GLuint offset;		// float offset inside the interleaved vertex
+};
+
+// Layout of an interleaved vertex buffer
+struct VertexFormat
+{
+	std::vector<VertexAttribute> attributes;
+	GLuint stride;		// floats per interleaved vertex
+
+	// position, normal, texture coords: the layout of every mesh in Meshes
+	static VertexFormat PositionNormalUV();
+	static VertexFormat Position();
+
+	bool IsPositionNormalUV() const;
+};
+
+// CPU-side vertex data shared by the mesh generators, importers and bake
+// tools. Every stream is 64-byte aligned and padded to a multiple of 16
+// floats so the AVX2 kernels below can use aligned loads.
+class Geometry
+{
+public:
+	Geometry();
+	explicit Geometry(size_t count);
+	Geometry(const Geometry& other);
+	Geometry(Geometry&& other) noexcept;
+	Geometry& operator=(const Geometry& other);
+	Geometry& operator=(Geometry&& other) noexcept;
+	~Geometry();
+
+	size_t Size() const { return mCount; }
+	bool Empty() const { return mCount == 0; }
+	void Resize(size_t count);
+	void Reserve(size_t capacity);
+	void Clear() { mCount = 0; }
+
+	void PushVertex(const glm::vec3& position, const glm::vec3& normal, const glm::vec2& uv);
+	void Append(const Geometry& other);
+	glm::vec3 Position(size_t i) const;
+	glm::vec3 Normal(size_t i) const;
+	glm::vec2 UV(size_t i) const;
+
+	float* Stream(GeometryStream stream) { return mStreams[stream]; }
+	const float* Stream(GeometryStream stream) const { return mStreams[stream]; }
+
+	// Kernels
+	void ComputeBounds(glm::vec3& minCorner, glm::vec3& maxCorner) const;
+	void ComputeBoundingSphere(glm::vec3& center, float& radius) const;
+	void Transform(const glm::mat4& model);
+	void Interleave(const VertexFormat& format, std::vector<GLfloat>& out) const;
+	void Deinterleave(const VertexFormat& format, const GLfloat* in, size_t count);
+	uint64_t Hash() const;
+
+private:
+	void UReallocate(size_t capacity);
+
+	float* mBlock;
+	float* mStreams[STREAM_COUNT];
+	size_t mCount;
+	size_t mCapacity;
+};
+
+// Content hash of raw bytes, using the same vectorized mixing as Geometry::Hash
+uint64_t UHashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+// False when this build uses AVX2 (the project compiles with /arch:AVX2)
+// and the CPU or the OS does not support it. Checked once at startup.
+bool UCpuSupportsBuild();
@@ -0,0 +1,171 @@
+#include "imagedecoder.h"
+#include "jpegdecoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "stb_image.h"
+
+
+namespace
+{
+	// Every format stb_image reads, at full size only
+	class StbImageDecoder : public ImageDecoder
+	{
+	public:
+		const char* Name() const override { return "stb_image"; }
+
+		bool CanDecode(const unsigned char* data, size_t size) const override
+		{
+			int width, height;
+			return ReadSize(data, size, width, height);
+		}
+
+		bool ReadSize(const unsigned char* data, size_t size, int& width, int& height) const override
+		{
+			int channels;
+			return stbi_info_from_memory(data, int(size), &width, &height, &channels) != 0;
+		}
+
+		bool Decode(const unsigned char* data, size_t size, int scaleShift, Image& image) const override
+		{
+			if (scaleShift != 0)
+				return false;
+			image.pixels = stbi_load_from_memory(data, int(size), &image.width, &image.height, &image.channels, 0);
+			return image.pixels != nullptr;
+		}
+	};
+
+	JpegDecoder gJpegDecoder;
+	StbImageDecoder gStbImageDecoder;
+
+	std::vector<const ImageDecoder*>& UDecoderList()
+	{
+		static std::vector<const ImageDecoder*> decoders = { &gJpegDecoder, &gStbImageDecoder };
+		return decoders;
+	}
+
+	// Largest scale shift the decoder allows that keeps the longest side at least minSize
+	int UScaleShift(const ImageDecoder& decoder, int width, int height, int minSize)
+	{
+		if (minSize <= 0)
+			return 0;
+
+		const int size = std::max(width, height);
+		int shift = 0;
+		while (shift < decoder.MaxScaleShift() && ((size + (2 << shift) - 1) >> (shift + 1)) >= minSize)
+			shift++;
+		return shift;
+	}
+
+	bool UReadFile(const char* filename, std::vector<unsigned char>& bytes)
+	{
+		std::ifstream file(filename, std::ios::binary);
+		if (!file)
+			return false;
+		bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		return !bytes.empty();
+	}
+}
+
+
+void URegisterImageDecoder(const ImageDecoder* decoder)
+{
+	std::vector<const ImageDecoder*>& decoders = UDecoderList();
+	decoders.insert(decoders.begin(), decoder);
+}
+
+
+const std::vector<const ImageDecoder*>& UImageDecoders()
+{
+	return UDecoderList();
+}
+
+
+///////////////////////////////////////////////////
+//	UDecodeImageData(const unsigned char*, size_t, int, Image&)
+//
+//	data, size: the image file
+//	minSize: smallest longest side wanted; 0 for the full image
+//	image: receives the decoded image
+//
+//	Each decoder that recognizes the file is tried in turn, at the
+//	smallest scale it can reach without going under minSize
+///////////////////////////////////////////////////
+bool UDecodeImageData(const unsigned char* data, size_t size, int minSize, Image& image)
+{
+	for (const ImageDecoder* decoder : UDecoderList())
+	{
+		int width, height;
+		if (!decoder->CanDecode(data, size) || !decoder->ReadSize(data, size, width, height))
+			continue;
+		if (decoder->Decode(data, size, UScaleShift(*decoder, width, height, minSize), image))
+			return true;
+	}
+	return false;
+}
+
+
+bool UDecodeImage(const char* filename, Image& image, int minSize)
+{
+	std::vector<unsigned char> bytes;
+	return UReadFile(filename, bytes) && UDecodeImageData(bytes.data(), bytes.size(), minSize, image);
+}
+
+
+///////////////////////////////////////////////////
+//	UBenchmarkImageDecoders(const std::vector<std::string>&, int)
+//
+//	filenames: images to decode, read into memory first
+//	repeats: decodes per decoder and scale; the fastest one is reported
+//
+//	Logs one INFO line per file, decoder and scale
+///////////////////////////////////////////////////
+void UBenchmarkImageDecoders(const std::vector<std::string>& filenames, int repeats)
+{
+	for (const std::string& filename : filenames)
+	{
+		std::vector<unsigned char> bytes;
+		if (!UReadFile(filename.c_str(), bytes))
+		{
+			std::cout << "ERROR::DECODER::CANNOT_READ " << filename << std::endl;
+			continue;
+		}
+
+		for (const ImageDecoder* decoder : UDecoderList())
+		{
+			if (!decoder->CanDecode(bytes.data(), bytes.size()))
+				continue;
+
+			for (int shift = 0; shift <= decoder->MaxScaleShift(); shift++)
+			{
+				double best = 0.0;
+				Image image;
+				for (int i = 0; i < repeats; i++)
+				{
+					auto start = std::chrono::steady_clock::now();
+					bool decoded = decoder->Decode(bytes.data(), bytes.size(), shift, image);
+					double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+					if (!decoded)
+						break;
+					best = i == 0 ? ms : std::min(best, ms);
+					if (i + 1 < repeats)
+						UFreeImage(image);
+				}
+
+				if (!image.pixels)
+				{
+					std::cout << "INFO: Decoder " << decoder->Name() << ": " << filename << " 1/" << (1 << shift)
+						<< " failed" << std::endl;
+					continue;
+				}
+				std::cout << "INFO: Decoder " << decoder->Name() << ": " << filename << " 1/" << (1 << shift) << " "
+					<< image.width << "x" << image.height << ", " << best << " ms" << std::endl;
+				UFreeImage(image);
+			}
+		}
+	}
+}
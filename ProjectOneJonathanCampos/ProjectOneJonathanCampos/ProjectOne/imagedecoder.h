@@ -0,0 +1,51 @@
+#pragma once
+
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "texture.h"
+
+// A way of turning the bytes of an image file into an Image. Decoders are
+// tried in the order they were registered and the first one that
+// recognizes a file decodes it; when that fails the next one is tried, so a
+// fast decoder only has to handle the common cases. Decode() is called
+// from the loader's worker threads and must not keep state between calls.
+class ImageDecoder
+{
+public:
+	virtual ~ImageDecoder() {}
+
+	virtual const char* Name() const = 0;
+
+	// True when the decoder reads files starting with these bytes
+	virtual bool CanDecode(const unsigned char* data, size_t size) const = 0;
+
+	// Full size of the image, read from its header
+	virtual bool ReadSize(const unsigned char* data, size_t size, int& width, int& height) const = 0;
+
+	// Largest scaleShift Decode() accepts; 0 when it only decodes at full size
+	virtual int MaxScaleShift() const { return 0; }
+
+	// Decode at 1 / (1 << scaleShift) of the full size, each side rounded
+	// up. The pixels are allocated with malloc, so UFreeImage releases them.
+	virtual bool Decode(const unsigned char* data, size_t size, int scaleShift, Image& image) const = 0;
+};
+
+// Add a decoder in front of the ones already registered. The decoder must
+// outlive every decode; register before any image is loaded.
+void URegisterImageDecoder(const ImageDecoder* decoder);
+
+// The registered decoders, most preferred first. A baseline JPEG decoder
+// (see jpegdecoder.h) and stb_image are always there.
+const std::vector<const ImageDecoder*>& UImageDecoders();
+
+// Decode image bytes with the first decoder that handles them, at the
+// smallest scale that still keeps the longest side at least minSize (0
+// for full size)
+bool UDecodeImageData(const unsigned char* data, size_t size, int minSize, Image& image);
+
+// Time every decoder on each file, at every scale it supports, and log the
+// fastest of repeats runs
+void UBenchmarkImageDecoders(const std::vector<std::string>& filenames, int repeats);
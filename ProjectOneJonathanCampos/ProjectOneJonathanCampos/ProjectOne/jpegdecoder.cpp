@@ -0,0 +1,921 @@
+#include "jpegdecoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+namespace
+{
+	// Huffman codes up to this long are decoded with one table lookup
+	const int FAST_BITS = 9;
+
+	const int MAX_COMPONENTS = 3;
+
+	// Position in the 8x8 block of each coefficient, in file order
+	const uint8_t DEZIGZAG[64] = {
+		0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+		12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+		35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+		58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+	};
+
+	struct HuffmanTable
+	{
+		uint8_t fastLength[1 << FAST_BITS];	// 0 when the code is longer than FAST_BITS
+		uint8_t fastSymbol[1 << FAST_BITS];
+		// AC code and coefficient together, when both fit in FAST_BITS:
+		// value << 8 | run << 4 | bits used; 0 when they do not
+		int16_t fastAc[1 << FAST_BITS];
+		int32_t maxCode[17];				// largest code of each length, -1 for none
+		int32_t symbolOffset[17];			// code + offset indexes symbols
+		uint8_t symbols[256];
+		bool defined;
+	};
+
+	struct Component
+	{
+		int id;
+		int h;
+		int v;
+		int quant;
+		int dcTable;
+		int acTable;
+		int blocksX;						// blocks in the plane, whole MCUs
+		int blocksY;
+		int predictor;						// DC of the previous block
+		std::vector<uint8_t> plane;			// samples, blocksX * blockSize wide
+	};
+
+	struct Frame
+	{
+		int width;
+		int height;
+		int componentCount;
+		int hMax;
+		int vMax;
+		int mcusX;
+		int mcusY;
+		int restartInterval;
+		int adobeTransform;					// APP14 color transform, -1 without the marker
+		bool isRgb;							// Adobe transform 0: components are R, G, B
+		Component components[MAX_COMPONENTS];
+		float quant[4][64];					// block order
+		HuffmanTable dc[4];
+		HuffmanTable ac[4];
+	};
+
+	// Entropy coded bits, most significant first. Stuffed zero bytes are
+	// dropped; at a marker the reader stops and feeds zeros.
+	struct BitReader
+	{
+		const uint8_t* data;
+		size_t size;
+		size_t position;
+		uint64_t bits;		// left aligned
+		int count;
+		bool atMarker;
+
+		// Top up the buffer. Called with fewer than 32 bits left, so a code
+		// and the coefficient after it can be read without checking again.
+		void Fill()
+		{
+			while (count <= 56)
+			{
+				uint32_t byte = 0;
+				if (!atMarker && position < size)
+				{
+					byte = data[position];
+					if (byte != 0xFF)
+						position++;
+					else if (position + 1 < size && data[position + 1] == 0)
+						position += 2;
+					else
+					{
+						atMarker = true;
+						byte = 0;
+					}
+				}
+				bits |= uint64_t(byte) << (56 - count);
+				count += 8;
+			}
+		}
+
+		uint32_t Peek(int n) const { return uint32_t(bits >> (64 - n)); }
+
+		void Skip(int n)
+		{
+			bits <<= n;
+			count -= n;
+		}
+
+		// n (1..16) bits as a signed value, in the JPEG magnitude coding
+		int Receive(int n)
+		{
+			int value = int(Peek(n));
+			Skip(n);
+			return value < (1 << (n - 1)) ? value - (1 << n) + 1 : value;
+		}
+	};
+
+	// Scaled inverse DCT, per scale shift: gIdct[s][n][u] is the weight of
+	// frequency u in sample n of the 8 >> s samples a block shrinks to, and
+	// gIdctTransposed[s][u][n] the same weight, zero for n past the samples
+	float gIdct[4][8][8];
+	alignas(32) float gIdctTransposed[4][8][8];
+
+	void UInitIdctTables()
+	{
+		const float pi = 3.14159265358979f;
+		for (int s = 0; s < 4; s++)
+		{
+			const int size = 8 >> s;
+			for (int n = 0; n < 8; n++)
+			{
+				for (int u = 0; u < 8; u++)
+				{
+					float weight = 0.0f;
+					if (n < size && u < size)
+						weight = 0.5f * (u == 0 ? std::sqrt(0.5f) : 1.0f) * std::cos((2 * n + 1) * u * pi / (2 * size));
+					gIdct[s][n][u] = weight;
+					gIdctTransposed[s][u][n] = weight;
+				}
+			}
+		}
+	}
+
+	bool UBuildHuffmanTable(const uint8_t counts[16], const uint8_t* symbols, HuffmanTable& table)
+	{
+		memset(table.fastLength, 0, sizeof(table.fastLength));
+		int code = 0;
+		int k = 0;
+		for (int length = 1; length <= 16; length++)
+		{
+			// an oversubscribed length would write past the fast tables
+			if (code + counts[length - 1] > (1 << length))
+				return false;
+
+			table.symbolOffset[length] = k - code;
+			for (int i = 0; i < counts[length - 1]; i++, code++, k++)
+			{
+				table.symbols[k] = symbols[k];
+				if (length <= FAST_BITS)
+				{
+					int first = code << (FAST_BITS - length);
+					for (int j = 0; j < 1 << (FAST_BITS - length); j++)
+					{
+						table.fastLength[first + j] = uint8_t(length);
+						table.fastSymbol[first + j] = symbols[k];
+					}
+				}
+			}
+			table.maxCode[length] = counts[length - 1] ? code - 1 : -1;
+			code <<= 1;
+		}
+
+		// codes short enough to leave room for the coefficient bits
+		for (int look = 0; look < 1 << FAST_BITS; look++)
+		{
+			table.fastAc[look] = 0;
+			const int length = table.fastLength[look];
+			const int run = table.fastSymbol[look] >> 4;
+			const int size = table.fastSymbol[look] & 15;
+			if (length == 0 || size == 0 || length + size > FAST_BITS)
+				continue;
+
+			int value = (look >> (FAST_BITS - length - size)) & ((1 << size) - 1);
+			if (value < (1 << (size - 1)))
+				value -= (1 << size) - 1;
+			if (value >= -128 && value <= 127)
+				table.fastAc[look] = int16_t(value * 256 + run * 16 + length + size);
+		}
+
+		table.defined = true;
+		return true;
+	}
+
+	// Next Huffman coded symbol, or -1 for a code that is not in the table
+	inline int UDecodeSymbol(BitReader& reader, const HuffmanTable& table)
+	{
+		if (reader.count < 32)
+			reader.Fill();
+		uint32_t look = reader.Peek(FAST_BITS);
+		if (table.fastLength[look])
+		{
+			reader.Skip(table.fastLength[look]);
+			return table.fastSymbol[look];
+		}
+
+		for (int length = FAST_BITS + 1; length <= 16; length++)
+		{
+			int32_t code = int32_t(reader.Peek(length));
+			if (code <= table.maxCode[length])
+			{
+				reader.Skip(length);
+				return table.symbols[code + table.symbolOffset[length]];
+			}
+		}
+		return -1;
+	}
+
+	///////////////////////////////////////////////////
+	//	UDecodeCoefficients(BitReader&, const HuffmanTable&, const HuffmanTable&, const float*, int&, float*, int&)
+	//
+	//	Read the coefficients of one block, dequantized, into block (which
+	//	must be zero on entry). rowMask receives a bit per block row holding a
+	//	nonzero coefficient; 0 means only the DC is set.
+	///////////////////////////////////////////////////
+	inline bool UDecodeCoefficients(BitReader& reader, const HuffmanTable& dc, const HuffmanTable& ac, const float* quant,
+		int& predictor, float block[64], int& rowMask)
+	{
+		int size = UDecodeSymbol(reader, dc);
+		if (size < 0 || size > 11)
+			return false;
+		if (size)
+			predictor += reader.Receive(size);
+		block[0] = float(predictor) * quant[0];
+
+		rowMask = 0;
+		for (int k = 1; k < 64;)
+		{
+			if (reader.count < 32)
+				reader.Fill();
+			const int fast = ac.fastAc[reader.Peek(FAST_BITS)];
+			if (fast)
+			{
+				reader.Skip(fast & 15);
+				k += (fast >> 4) & 15;
+				if (k > 63)
+					return false;
+				int position = DEZIGZAG[k++];
+				block[position] = float(fast >> 8) * quant[position];
+				rowMask |= 1 << (position >> 3);
+				continue;
+			}
+
+			int symbol = UDecodeSymbol(reader, ac);
+			if (symbol < 0)
+				return false;
+
+			int run = symbol >> 4;
+			size = symbol & 15;
+			if (size == 0)
+			{
+				if (run != 15)
+					break;		// end of block
+				k += 16;
+				continue;
+			}
+
+			k += run;
+			if (k > 63)
+				return false;
+			int position = DEZIGZAG[k++];
+			block[position] = float(reader.Receive(size)) * quant[position];
+			rowMask |= 1 << (position >> 3);
+		}
+		return true;
+	}
+
+	// UDecodeCoefficients on a copy of the reader, which the compiler can
+	// keep in registers while the block is written
+	bool UDecodeBlock(BitReader& state, const HuffmanTable& dc, const HuffmanTable& ac, const float* quant,
+		int& predictor, float block[64], int& rowMask)
+	{
+		BitReader reader = state;
+		bool decoded = UDecodeCoefficients(reader, dc, ac, quant, predictor, block, rowMask);
+		state = reader;
+		return decoded;
+	}
+
+	///////////////////////////////////////////////////
+	//	UInverseDct(const float*, int, int, uint8_t*, size_t)
+	//
+	//	Write the 8 >> scaleShift square of samples of a block. Frequencies
+	//	above the output size are dropped, which low-pass filters the block
+	//	as it shrinks; rows without coefficients are skipped.
+	///////////////////////////////////////////////////
+	void UInverseDct(const float block[64], int rowMask, int scaleShift, uint8_t* out, size_t stride)
+	{
+		const int size = 8 >> scaleShift;
+		if (rowMask == 0)
+		{
+			// flat block: the DC alone is the mean
+			int value = int(std::lround(block[0] * 0.125f)) + 128;
+			uint8_t sample = uint8_t(std::min(std::max(value, 0), 255));
+			for (int n = 0; n < size; n++)
+				memset(out + n * stride, sample, size);
+			return;
+		}
+		rowMask |= 1;
+
+		const float (*table)[8] = gIdct[scaleShift];
+		const float (*transposed)[8] = gIdctTransposed[scaleShift];
+#if defined(__AVX2__)
+		// columns: row n of the result sums the block rows weighted by table[n]
+		__m256 columns[8];
+		for (int n = 0; n < size; n++)
+		{
+			__m256 sum = _mm256_setzero_ps();
+			for (int u = 0; u < size; u++)
+			{
+				if (rowMask & (1 << u))
+					sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(table[n][u]), _mm256_loadu_ps(block + u * 8)));
+			}
+			columns[n] = sum;
+		}
+
+		// rows: sample m of row n sums the row's frequencies weighted by table[m]
+		for (int n = 0; n < size; n++)
+		{
+			alignas(32) float frequencies[8];
+			_mm256_store_ps(frequencies, columns[n]);
+			__m256 sum = _mm256_set1_ps(128.0f);
+			for (int u = 0; u < size; u++)
+				sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(frequencies[u]), _mm256_load_ps(transposed[u])));
+			sum = _mm256_min_ps(_mm256_max_ps(sum, _mm256_setzero_ps()), _mm256_set1_ps(255.0f));
+
+			alignas(32) int32_t samples[8];
+			_mm256_store_si256(reinterpret_cast<__m256i*>(samples), _mm256_cvtps_epi32(sum));
+			for (int m = 0; m < size; m++)
+				out[n * stride + m] = uint8_t(samples[m]);
+		}
+#else
+		(void)transposed;
+		float columns[8][8];
+		for (int n = 0; n < size; n++)
+		{
+			for (int x = 0; x < size; x++)
+			{
+				float sum = 0.0f;
+				for (int u = 0; u < size; u++)
+					sum += table[n][u] * block[u * 8 + x];
+				columns[n][x] = sum;
+			}
+		}
+		for (int n = 0; n < size; n++)
+		{
+			for (int m = 0; m < size; m++)
+			{
+				float sum = 128.0f;
+				for (int u = 0; u < size; u++)
+					sum += table[m][u] * columns[n][u];
+				int value = int(std::lround(sum));
+				out[n * stride + m] = uint8_t(std::min(std::max(value, 0), 255));
+			}
+		}
+#endif
+	}
+
+	// Skip to the restart marker the reader stopped at and start over after it
+	void URestart(BitReader& reader, Frame& frame)
+	{
+		const uint8_t* data = reader.data;
+		size_t position = reader.position;
+		while (position + 1 < reader.size && !(data[position] == 0xFF && data[position + 1] >= 0xD0 && data[position + 1] <= 0xD7))
+			position++;
+		reader.position = std::min(reader.size, position + 2);
+		reader.bits = 0;
+		reader.count = 0;
+		reader.atMarker = false;
+		for (int c = 0; c < frame.componentCount; c++)
+			frame.components[c].predictor = 0;
+	}
+
+	///////////////////////////////////////////////////
+	//	UDecodeScan(Frame&, const uint8_t*, size_t, size_t&, int)
+	//
+	//	frame: tables and planes so far
+	//	data, size: the file
+	//	position: start of the scan header; receives the end of the scan
+	//	scaleShift: block size is 8 >> scaleShift
+	//
+	//	A scan holding one component codes its blocks in raster order;
+	//	otherwise every MCU holds h x v blocks of each component in turn
+	///////////////////////////////////////////////////
+	bool UDecodeScan(Frame& frame, const uint8_t* data, size_t size, size_t& position, int scaleShift)
+	{
+		const size_t length = size_t(data[position]) << 8 | data[position + 1];
+		const uint8_t* header = data + position + 2;
+		const int scanCount = header[0];
+		if (scanCount < 1 || scanCount > frame.componentCount || length < size_t(6 + 2 * scanCount))
+			return false;
+
+		Component* scan[MAX_COMPONENTS];
+		for (int i = 0; i < scanCount; i++)
+		{
+			int id = header[1 + 2 * i];
+			int tables = header[2 + 2 * i];
+			scan[i] = nullptr;
+			for (int c = 0; c < frame.componentCount; c++)
+			{
+				if (frame.components[c].id == id)
+					scan[i] = &frame.components[c];
+			}
+			if (!scan[i] || !frame.dc[tables >> 4 & 3].defined || !frame.ac[tables & 3].defined)
+				return false;
+			scan[i]->dcTable = tables >> 4 & 3;
+			scan[i]->acTable = tables & 3;
+			scan[i]->predictor = 0;
+		}
+
+		BitReader reader = { data, size, position + length, 0, 0, false };
+		const int blockSize = 8 >> scaleShift;
+		alignas(32) float block[64] = {};
+		int mcu = 0;
+
+		auto decode = [&](Component& component, int blockX, int blockY) {
+			int rowMask;
+			if (!UDecodeBlock(reader, frame.dc[component.dcTable], frame.ac[component.acTable],
+				frame.quant[component.quant], component.predictor, block, rowMask))
+				return false;
+			size_t stride = size_t(component.blocksX) * blockSize;
+			UInverseDct(block, rowMask, scaleShift,
+				&component.plane[size_t(blockY) * blockSize * stride + size_t(blockX) * blockSize], stride);
+
+			// clear the rows that were set for the next block
+			rowMask |= 1;
+			for (int row = 0; row < 8; row++)
+			{
+				if (rowMask & (1 << row))
+					memset(block + row * 8, 0, 8 * sizeof(float));
+			}
+			return true;
+		};
+		auto restart = [&]() {
+			if (frame.restartInterval && mcu > 0 && mcu % frame.restartInterval == 0)
+				URestart(reader, frame);
+			mcu++;
+		};
+
+		if (scanCount == 1)
+		{
+			Component& component = *scan[0];
+			const int width = (frame.width * component.h + frame.hMax - 1) / frame.hMax;
+			const int height = (frame.height * component.v + frame.vMax - 1) / frame.vMax;
+			for (int blockY = 0; blockY < (height + 7) / 8; blockY++)
+			{
+				for (int blockX = 0; blockX < (width + 7) / 8; blockX++)
+				{
+					restart();
+					if (!decode(component, blockX, blockY))
+						return false;
+				}
+			}
+		}
+		else
+		{
+			for (int mcuY = 0; mcuY < frame.mcusY; mcuY++)
+			{
+				for (int mcuX = 0; mcuX < frame.mcusX; mcuX++)
+				{
+					restart();
+					for (int i = 0; i < scanCount; i++)
+					{
+						Component& component = *scan[i];
+						for (int y = 0; y < component.v; y++)
+						{
+							for (int x = 0; x < component.h; x++)
+							{
+								if (!decode(component, mcuX * component.h + x, mcuY * component.v + y))
+									return false;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		// the marker that ended the scan, or the end of the file
+		position = reader.position;
+		return true;
+	}
+
+	bool UReadFrame(const uint8_t* segment, size_t length, Frame& frame)
+	{
+		if (length < 6 || segment[0] != 8)
+			return false;
+
+		frame.height = segment[1] << 8 | segment[2];
+		frame.width = segment[3] << 8 | segment[4];
+		frame.componentCount = segment[5];
+		if (frame.width == 0 || frame.height == 0 || (frame.componentCount != 1 && frame.componentCount != 3)
+			|| length < size_t(6 + 3 * frame.componentCount))
+			return false;
+
+		frame.hMax = frame.vMax = 1;
+		for (int c = 0; c < frame.componentCount; c++)
+		{
+			Component& component = frame.components[c];
+			component.id = segment[6 + 3 * c];
+			component.h = segment[7 + 3 * c] >> 4;
+			component.v = segment[7 + 3 * c] & 15;
+			component.quant = segment[8 + 3 * c] & 3;
+			if (component.h < 1 || component.h > 4 || component.v < 1 || component.v > 4)
+				return false;
+			if (frame.componentCount == 1)
+				component.h = component.v = 1;		// a lone component's blocks are always in raster order
+			frame.hMax = std::max(frame.hMax, component.h);
+			frame.vMax = std::max(frame.vMax, component.v);
+		}
+		// APP14 comes before the frame header, so its transform is applied here;
+		// without it, component ids R, G, B mark an RGB file
+		if (frame.componentCount == 3 && frame.adobeTransform >= 0)
+			frame.isRgb = frame.adobeTransform == 0;
+		else if (frame.componentCount == 3 && frame.components[0].id == 'R' && frame.components[1].id == 'G'
+			&& frame.components[2].id == 'B')
+			frame.isRgb = true;
+
+		frame.mcusX = (frame.width + 8 * frame.hMax - 1) / (8 * frame.hMax);
+		frame.mcusY = (frame.height + 8 * frame.vMax - 1) / (8 * frame.vMax);
+		for (int c = 0; c < frame.componentCount; c++)
+		{
+			Component& component = frame.components[c];
+			if (frame.hMax % component.h || frame.vMax % component.v)
+				return false;
+			component.blocksX = frame.mcusX * component.h;
+			component.blocksY = frame.mcusY * component.v;
+		}
+		return true;
+	}
+
+	// Walk the markers up to the frame header. Returns its segment.
+	const uint8_t* UFindFrame(const uint8_t* data, size_t size, size_t& length)
+	{
+		size_t position = 2;
+		while (position + 4 <= size)
+		{
+			if (data[position] != 0xFF)
+				return nullptr;
+			uint8_t marker = data[position + 1];
+			if (marker == 0xFF)
+			{
+				position++;
+				continue;
+			}
+			length = size_t(data[position + 2]) << 8 | data[position + 3];
+			if (length < 2 || position + 2 + length > size)
+				return nullptr;
+			if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+			{
+				length -= 2;
+				return data + position + 4;
+			}
+			position += 2 + length;
+		}
+		return nullptr;
+	}
+
+	// Samples of plane row y of a component, widened to the output row:
+	// chroma is upsampled by linear interpolation between sample centers
+	void UUpsampleRow(const Component& component, int ratioX, int ratioY, int width,
+		int componentWidth, int componentHeight, int blockSize, int y, float* vertical, float* out)
+	{
+		const size_t stride = size_t(component.blocksX) * blockSize;
+		const uint8_t* plane = component.plane.data();
+
+		int near = std::min(y / ratioY, componentHeight - 1);
+		const uint8_t* a = plane + near * stride;
+		const uint8_t* b = a;
+		float nearWeight = 1.0f;
+		if (ratioY == 2)
+		{
+			int far = std::min(std::max((y & 1) ? near + 1 : near - 1, 0), componentHeight - 1);
+			b = plane + far * stride;
+			nearWeight = 0.75f;
+		}
+
+		// full width components go straight to out
+		if (ratioX == 1)
+			vertical = out;
+
+		int x = 0;
+#if defined(__AVX2__)
+		const __m256 weightA = _mm256_set1_ps(nearWeight);
+		const __m256 weightB = _mm256_set1_ps(1.0f - nearWeight);
+		for (; x + 8 <= componentWidth; x += 8)
+		{
+			__m256 sampleA = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + x))));
+			__m256 sampleB = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + x))));
+			_mm256_storeu_ps(vertical + x, _mm256_add_ps(_mm256_mul_ps(sampleA, weightA), _mm256_mul_ps(sampleB, weightB)));
+		}
+#endif
+		for (; x < componentWidth; x++)
+			vertical[x] = a[x] * nearWeight + b[x] * (1.0f - nearWeight);
+
+		if (ratioX == 2)
+		{
+			auto upsample = [&](int i) {
+				float center = 0.75f * vertical[i];
+				if (2 * i < width)
+					out[2 * i] = center + 0.25f * vertical[std::max(i - 1, 0)];
+				if (2 * i + 1 < width)
+					out[2 * i + 1] = center + 0.25f * vertical[std::min(i + 1, componentWidth - 1)];
+			};
+
+			int i = 0;
+#if defined(__AVX2__)
+			// away from the edges, eight samples at a time
+			upsample(i++);
+			const __m256 three = _mm256_set1_ps(0.75f);
+			const __m256 one = _mm256_set1_ps(0.25f);
+			for (; i + 9 <= componentWidth && 2 * (i + 8) <= width; i += 8)
+			{
+				__m256 center = _mm256_mul_ps(_mm256_loadu_ps(vertical + i), three);
+				__m256 even = _mm256_add_ps(center, _mm256_mul_ps(_mm256_loadu_ps(vertical + i - 1), one));
+				__m256 odd = _mm256_add_ps(center, _mm256_mul_ps(_mm256_loadu_ps(vertical + i + 1), one));
+				__m256 low = _mm256_unpacklo_ps(even, odd);
+				__m256 high = _mm256_unpackhi_ps(even, odd);
+				_mm256_storeu_ps(out + 2 * i, _mm256_permute2f128_ps(low, high, 0x20));
+				_mm256_storeu_ps(out + 2 * i + 8, _mm256_permute2f128_ps(low, high, 0x31));
+			}
+#endif
+			for (; i < componentWidth; i++)
+				upsample(i);
+		}
+		else
+		{
+			for (int i = 0; i < width; i++)
+				out[i] = vertical[std::min(i / ratioX, componentWidth - 1)];
+		}
+	}
+
+	// One output row from full width Y, Cb, Cr rows (or R, G, B)
+	void UConvertRow(const float* y, const float* cb, const float* cr, int width, bool isRgb, uint8_t* out)
+	{
+		int x = 0;
+		if (!isRgb)
+		{
+#if defined(__AVX2__)
+			// pack eight pixels' channels to bytes (saturating), then shuffle
+			// them into 24 bytes of RGB
+			const __m256 offset = _mm256_set1_ps(128.0f);
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i fromRg0 = _mm_setr_epi8(0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5);
+			const __m128i fromB0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+			const __m128i fromRg1 = _mm_setr_epi8(13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+			const __m128i fromB1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+			for (; x + 8 <= width; x += 8)
+			{
+				__m256 luma = _mm256_loadu_ps(y + x);
+				__m256 blue = _mm256_sub_ps(_mm256_loadu_ps(cb + x), offset);
+				__m256 red = _mm256_sub_ps(_mm256_loadu_ps(cr + x), offset);
+
+				__m256 r = _mm256_add_ps(luma, _mm256_mul_ps(red, _mm256_set1_ps(1.402f)));
+				__m256 g = _mm256_sub_ps(luma, _mm256_add_ps(_mm256_mul_ps(blue, _mm256_set1_ps(0.344136f)),
+					_mm256_mul_ps(red, _mm256_set1_ps(0.714136f))));
+				__m256 b = _mm256_add_ps(luma, _mm256_mul_ps(blue, _mm256_set1_ps(1.772f)));
+
+				// 16 bit lanes come out as r0-3 g0-3 | r4-7 g4-7; reorder the 64 bit halves
+				__m256i rg = _mm256_permute4x64_epi64(_mm256_packus_epi32(_mm256_cvtps_epi32(r), _mm256_cvtps_epi32(g)), 0xD8);
+				__m256i bz = _mm256_permute4x64_epi64(_mm256_packus_epi32(_mm256_cvtps_epi32(b), _mm256_setzero_si256()), 0xD8);
+				__m128i rg8 = _mm_packus_epi16(_mm256_castsi256_si128(rg), _mm256_extracti128_si256(rg, 1));	// r0-7 g0-7
+				__m128i b8 = _mm_packus_epi16(_mm256_castsi256_si128(bz), zero);								// b0-7
+
+				__m128i first = _mm_or_si128(_mm_shuffle_epi8(rg8, fromRg0), _mm_shuffle_epi8(b8, fromB0));
+				__m128i second = _mm_or_si128(_mm_shuffle_epi8(rg8, fromRg1), _mm_shuffle_epi8(b8, fromB1));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 3), first);
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * 3 + 16), second);
+			}
+#endif
+		}
+
+		for (; x < width; x++)
+		{
+			float rgb[3] = { y[x], cb[x], cr[x] };
+			if (!isRgb)
+			{
+				float blue = cb[x] - 128.0f;
+				float red = cr[x] - 128.0f;
+				rgb[0] = y[x] + 1.402f * red;
+				rgb[1] = y[x] - 0.344136f * blue - 0.714136f * red;
+				rgb[2] = y[x] + 1.772f * blue;
+			}
+			for (int c = 0; c < 3; c++)
+				out[x * 3 + c] = uint8_t(std::min(std::max(int(std::lround(rgb[c])), 0), 255));
+		}
+	}
+}
+
+
+bool JpegDecoder::CanDecode(const unsigned char* data, size_t size) const
+{
+	return size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+}
+
+
+bool JpegDecoder::ReadSize(const unsigned char* data, size_t size, int& width, int& height) const
+{
+	size_t length = 0;
+	const uint8_t* frame = CanDecode(data, size) ? UFindFrame(data, size, length) : nullptr;
+	if (!frame || length < 5)
+		return false;
+
+	height = frame[1] << 8 | frame[2];
+	width = frame[3] << 8 | frame[4];
+	return width > 0 && height > 0;
+}
+
+
+///////////////////////////////////////////////////
+//	Verify()
+//
+//	Builds a complete table, which must be accepted, and one with more
+//	codes of length 1 than there is room for, which must be rejected
+///////////////////////////////////////////////////
+bool JpegDecoder::Verify()
+{
+	uint8_t symbols[256] = {};
+	uint8_t complete[16] = { 2 };
+	uint8_t oversubscribed[16] = { 200 };
+
+	std::unique_ptr<HuffmanTable> table(new HuffmanTable());
+	bool passed = true;
+	if (!UBuildHuffmanTable(complete, symbols, *table))
+	{
+		std::cout << "ERROR::DECODER::a complete Huffman table was rejected" << std::endl;
+		passed = false;
+	}
+	if (UBuildHuffmanTable(oversubscribed, symbols, *table))
+	{
+		std::cout << "ERROR::DECODER::an oversubscribed Huffman table was accepted" << std::endl;
+		passed = false;
+	}
+	return passed;
+}
+
+
+///////////////////////////////////////////////////
+//	Decode(const unsigned char*, size_t, int, Image&)
+//
+//	data, size: the file
+//	scaleShift: 0 to 3; each block decodes to 8 >> scaleShift samples square
+//	image: receives a grey or RGB image
+//
+//	The scans are decoded into a plane per component at its own
+//	resolution, then chroma is upsampled and converted a row at a time
+///////////////////////////////////////////////////
+bool JpegDecoder::Decode(const unsigned char* data, size_t size, int scaleShift, Image& image) const
+{
+	static bool tablesReady = (UInitIdctTables(), true);
+	(void)tablesReady;
+
+	if (!CanDecode(data, size) || scaleShift < 0 || scaleShift > MaxScaleShift())
+		return false;
+
+	std::unique_ptr<Frame> frame(new Frame());
+	frame->adobeTransform = -1;
+	bool haveFrame = false;
+	bool done = false;
+	const int blockSize = 8 >> scaleShift;
+
+	size_t position = 2;
+	while (!done && position + 4 <= size)
+	{
+		if (data[position] != 0xFF)
+		{
+			position++;		// junk between segments
+			continue;
+		}
+		const uint8_t marker = data[position + 1];
+		position += 2;
+		if (marker == 0xFF)
+		{
+			position--;
+			continue;
+		}
+		if (marker == 0xD9)
+			break;
+		if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8))
+			continue;
+
+		const size_t length = size_t(data[position]) << 8 | data[position + 1];
+		if (length < 2 || position + length > size)
+			return false;
+		const uint8_t* segment = data + position + 2;
+		const size_t segmentLength = length - 2;
+
+		switch (marker)
+		{
+		case 0xDB:		// quantization tables
+			for (size_t i = 0; i < segmentLength;)
+			{
+				const int precision = segment[i] >> 4;
+				const int table = segment[i] & 3;
+				if (precision > 1 || i + 1 + 64 * (precision + 1) > segmentLength)
+					return false;
+				for (int k = 0; k < 64; k++)
+				{
+					const uint8_t* value = segment + i + 1 + k * (precision + 1);
+					frame->quant[table][DEZIGZAG[k]] = float(precision ? value[0] << 8 | value[1] : value[0]);
+				}
+				i += 1 + 64 * (precision + 1);
+			}
+			break;
+
+		case 0xC4:		// Huffman tables
+			for (size_t i = 0; i < segmentLength;)
+			{
+				if (i + 17 > segmentLength)
+					return false;
+				const int tableClass = segment[i] >> 4;
+				const int table = segment[i] & 3;
+				const uint8_t* counts = segment + i + 1;
+				int total = 0;
+				for (int k = 0; k < 16; k++)
+					total += counts[k];
+				if (tableClass > 1 || total > 256 || i + 17 + total > segmentLength)
+					return false;
+				if (!UBuildHuffmanTable(counts, segment + i + 17, tableClass ? frame->ac[table] : frame->dc[table]))
+					return false;
+				i += 17 + total;
+			}
+			break;
+
+		case 0xC0:		// baseline
+		case 0xC1:		// extended sequential, Huffman coded
+			if (haveFrame || !UReadFrame(segment, segmentLength, *frame))
+				return false;
+			for (int c = 0; c < frame->componentCount; c++)
+			{
+				Component& component = frame->components[c];
+				component.plane.resize(size_t(component.blocksX) * component.blocksY * blockSize * blockSize);
+			}
+			haveFrame = true;
+			break;
+
+		case 0xDD:		// restart interval
+			if (segmentLength < 2)
+				return false;
+			frame->restartInterval = segment[0] << 8 | segment[1];
+			break;
+
+		case 0xEE:		// Adobe
+			if (segmentLength >= 12 && memcmp(segment, "Adobe", 5) == 0)
+				frame->adobeTransform = segment[11];
+			break;
+
+		case 0xDA:		// scan
+			if (!haveFrame || !UDecodeScan(*frame, data, size, position, scaleShift))
+				return false;
+			continue;	// position is past the scan data
+
+		default:
+			// progressive, lossless, arithmetic coded and hierarchical frames
+			if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC8)
+				return false;
+			break;
+		}
+		position += length;
+	}
+	if (!haveFrame)
+		return false;
+
+	const int width = (frame->width + (1 << scaleShift) - 1) >> scaleShift;
+	const int height = (frame->height + (1 << scaleShift) - 1) >> scaleShift;
+	const int channels = frame->componentCount;
+	unsigned char* pixels = (unsigned char*)std::malloc(size_t(width) * height * channels);
+	if (!pixels)
+		return false;
+
+	if (channels == 1)
+	{
+		const Component& grey = frame->components[0];
+		for (int y = 0; y < height; y++)
+			memcpy(pixels + size_t(y) * width, &grey.plane[size_t(y) * grey.blocksX * blockSize], width);
+	}
+	else
+	{
+		std::vector<float> rows[MAX_COMPONENTS];
+		std::vector<float> vertical(size_t(frame->mcusX) * frame->hMax * blockSize);
+		for (int y = 0; y < height; y++)
+		{
+			for (int c = 0; c < channels; c++)
+			{
+				const Component& component = frame->components[c];
+				const int componentWidth = std::min(component.blocksX * blockSize, (width * component.h + frame->hMax - 1) / frame->hMax);
+				const int componentHeight = std::min(component.blocksY * blockSize, (height * component.v + frame->vMax - 1) / frame->vMax);
+				rows[c].resize(width);
+				UUpsampleRow(component, frame->hMax / component.h, frame->vMax / component.v, width,
+					componentWidth, componentHeight, blockSize, y, vertical.data(), rows[c].data());
+			}
+			UConvertRow(rows[0].data(), rows[1].data(), rows[2].data(), width, frame->isRgb,
+				pixels + size_t(y) * width * channels);
+		}
+	}
+
+	image.width = width;
+	image.height = height;
+	image.channels = channels;
+	image.pixels = pixels;
+	return true;
+}
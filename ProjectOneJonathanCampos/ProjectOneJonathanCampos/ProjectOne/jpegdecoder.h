@@ -0,0 +1,24 @@
+#pragma once
+
+
+#include "imagedecoder.h"
+
+// Baseline JPEG decoder (sequential, Huffman coded, 8 bit) for grey and
+// YCbCr images with any chroma subsampling. It can decode at 1/2, 1/4 or
+// 1/8 size by running a smaller inverse DCT on the low frequencies of each
+// block, which skips most of the work when only a small image is wanted.
+// The inverse DCT, chroma upsampling and YCbCr to RGB conversion use AVX2
+// when built with it. Progressive, arithmetic coded, 12 bit and CMYK files
+// are left to the next decoder.
+class JpegDecoder : public ImageDecoder
+{
+public:
+	const char* Name() const override { return "jpeg"; }
+	bool CanDecode(const unsigned char* data, size_t size) const override;
+	bool ReadSize(const unsigned char* data, size_t size, int& width, int& height) const override;
+	int MaxScaleShift() const override { return 3; }
+	bool Decode(const unsigned char* data, size_t size, int scaleShift, Image& image) const override;
+
+	// Checks that malformed Huffman tables are rejected before anything is written
+	static bool Verify();
+};
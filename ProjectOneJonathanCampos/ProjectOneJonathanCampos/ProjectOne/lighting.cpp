@@ -0,0 +1,190 @@
+#include "lighting.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+const GLuint LightClusterer::LIGHT_BINDING;
+const GLuint LightClusterer::CLUSTER_BINDING;
+const GLuint LightClusterer::LIGHT_INDEX_BINDING;
+const int LightClusterer::TILE_SIZE;
+const int LightClusterer::DEPTH_SLICES;
+
+
+namespace
+{
+	// Point at a view depth on the ray through an NDC position, for either
+	// kind of projection: the ray runs from the near to the far plane
+	glm::vec3 UViewPoint(const glm::mat4& inverseProjection, float x, float y, float depth)
+	{
+		glm::vec4 nearPoint = inverseProjection * glm::vec4(x, y, -1.0f, 1.0f);
+		glm::vec4 farPoint = inverseProjection * glm::vec4(x, y, 1.0f, 1.0f);
+		glm::vec3 a = glm::vec3(nearPoint) / nearPoint.w;
+		glm::vec3 b = glm::vec3(farPoint) / farPoint.w;
+		return a + (b - a) * ((depth + a.z) / (a.z - b.z));
+	}
+
+	bool USphereTouchesBox(const glm::vec3& center, float radius, const glm::vec3& boxMin, const glm::vec3& boxMax)
+	{
+		glm::vec3 offset = center - glm::clamp(center, boxMin, boxMax);
+		return glm::dot(offset, offset) <= radius * radius;
+	}
+
+	void UUploadStorage(GLuint& buffer, GLuint binding, GLsizeiptr size, const void* data)
+	{
+		if (buffer == 0)
+			glGenBuffers(1, &buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_STREAM_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+	}
+}
+
+
+///////////////////////////////////////////////////
+//	Update(const std::vector<PointLight>&, const glm::mat4&, const glm::mat4&, float, float, int, int)
+//
+//	lights: every point light of the scene
+//	view, projection: matrices of this frame
+//	nearPlane, farPlane: depth range of projection
+//	width, height: viewport size in pixels
+//
+//	Each light is tested only against the clusters of the depth slices
+//	its range spans; the hits are then sorted by cluster into one
+//	compact index list
+///////////////////////////////////////////////////
+void LightClusterer::Update(const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection,
+	float nearPlane, float farPlane, int width, int height)
+{
+	width = std::max(width, 1);
+	height = std::max(height, 1);
+	if (mBounds.empty() || projection != mBoundsProjection || width != mBoundsWidth || height != mBoundsHeight
+		|| nearPlane != mNearPlane || farPlane != mFarPlane)
+		BuildBounds(projection, nearPlane, farPlane, width, height);
+
+	mGrid.depthPlane = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+
+	const uint32_t tiles = mGrid.size.x * mGrid.size.y;
+	mHits.clear();
+	for (size_t i = 0; i < lights.size(); i++)
+	{
+		const PointLight& light = lights[i];
+		glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+		float depth = -center.z;
+		if (light.range <= 0.0f || depth + light.range < nearPlane || depth - light.range > farPlane)
+			continue;
+
+		int lastSlice = Slice(depth + light.range);
+		for (int slice = Slice(std::max(depth - light.range, nearPlane)); slice <= lastSlice; slice++)
+		{
+			for (uint32_t tile = 0; tile < tiles; tile++)
+			{
+				uint32_t cluster = uint32_t(slice) * tiles + tile;
+				if (USphereTouchesBox(center, light.range, mBounds[cluster].min, mBounds[cluster].max))
+					mHits.push_back(std::make_pair(cluster, uint32_t(i)));
+			}
+		}
+	}
+
+	// counting sort of the hits by cluster
+	std::fill(mRanges.begin(), mRanges.end(), glm::uvec2(0));
+	for (const std::pair<uint32_t, uint32_t>& hit : mHits)
+		mRanges[hit.first].y++;
+	GLuint first = 0;
+	for (glm::uvec2& range : mRanges)
+	{
+		range.x = first;
+		first += range.y;
+		range.y = 0;
+	}
+	mIndices.resize(std::max<size_t>(mHits.size(), 1));
+	for (const std::pair<uint32_t, uint32_t>& hit : mHits)
+	{
+		glm::uvec2& range = mRanges[hit.first];
+		mIndices[range.x + range.y++] = hit.second;
+	}
+
+	// the shader reads index 0 of each buffer even when there are no lights
+	PointLight none = {};
+	UUploadStorage(mLightBuffer, LIGHT_BINDING, sizeof(PointLight) * std::max<size_t>(lights.size(), 1),
+		lights.empty() ? &none : lights.data());
+	UUploadStorage(mIndexBuffer, LIGHT_INDEX_BINDING, sizeof(GLuint) * mIndices.size(), mIndices.data());
+
+	UUploadStorage(mClusterBuffer, CLUSTER_BINDING, sizeof(ClusterGrid) + sizeof(glm::uvec2) * mRanges.size(), nullptr);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mClusterBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(ClusterGrid), &mGrid);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(ClusterGrid), sizeof(glm::uvec2) * mRanges.size(), mRanges.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+
+void LightClusterer::Destroy()
+{
+	glDeleteBuffers(1, &mLightBuffer);
+	glDeleteBuffers(1, &mClusterBuffer);
+	glDeleteBuffers(1, &mIndexBuffer);
+	mLightBuffer = mClusterBuffer = mIndexBuffer = 0;
+	mBounds.clear();
+	mRanges.clear();
+	mIndices.clear();
+	mHits.clear();
+}
+
+
+///////////////////////////////////////////////////
+//	BuildBounds(const glm::mat4&, float, float, int, int)
+//
+//	View space box around each cluster: the corners of its tile on the
+//	planes at the depths its slice starts and ends. Only changes with the
+//	projection or the viewport.
+///////////////////////////////////////////////////
+void LightClusterer::BuildBounds(const glm::mat4& projection, float nearPlane, float farPlane, int width, int height)
+{
+	mBoundsProjection = projection;
+	mBoundsWidth = width;
+	mBoundsHeight = height;
+	mNearPlane = nearPlane;
+	mFarPlane = farPlane;
+
+	const uint32_t tilesX = uint32_t((width + TILE_SIZE - 1) / TILE_SIZE);
+	const uint32_t tilesY = uint32_t((height + TILE_SIZE - 1) / TILE_SIZE);
+	const float logRange = std::log(farPlane / nearPlane);
+	mGrid.size = glm::uvec4(tilesX, tilesY, DEPTH_SLICES, TILE_SIZE);
+	mGrid.slicing = glm::vec4(DEPTH_SLICES / logRange, -DEPTH_SLICES * std::log(nearPlane) / logRange, 0.0f, 0.0f);
+
+	const glm::mat4 inverseProjection = glm::inverse(projection);
+	mBounds.resize(size_t(tilesX) * tilesY * DEPTH_SLICES);
+	mRanges.resize(mBounds.size());
+	for (int slice = 0; slice < DEPTH_SLICES; slice++)
+	{
+		float depths[2] = { nearPlane * std::pow(farPlane / nearPlane, float(slice) / DEPTH_SLICES),
+			nearPlane * std::pow(farPlane / nearPlane, float(slice + 1) / DEPTH_SLICES) };
+
+		for (uint32_t y = 0; y < tilesY; y++)
+		{
+			float ndcY[2] = { 2.0f * y * TILE_SIZE / height - 1.0f, std::min(2.0f * (y + 1) * TILE_SIZE / height - 1.0f, 1.0f) };
+			for (uint32_t x = 0; x < tilesX; x++)
+			{
+				float ndcX[2] = { 2.0f * x * TILE_SIZE / width - 1.0f, std::min(2.0f * (x + 1) * TILE_SIZE / width - 1.0f, 1.0f) };
+
+				Bounds& bounds = mBounds[(size_t(slice) * tilesY + y) * tilesX + x];
+				bounds.min = glm::vec3(INFINITY);
+				bounds.max = glm::vec3(-INFINITY);
+				for (int corner = 0; corner < 8; corner++)
+				{
+					glm::vec3 point = UViewPoint(inverseProjection, ndcX[corner & 1], ndcY[(corner >> 1) & 1], depths[corner >> 2]);
+					bounds.min = glm::min(bounds.min, point);
+					bounds.max = glm::max(bounds.max, point);
+				}
+			}
+		}
+	}
+}
+
+
+int LightClusterer::Slice(float depth) const
+{
+	int slice = int(std::floor(std::log(depth) * mGrid.slicing.x + mGrid.slicing.y));
+	return std::min(std::max(slice, 0), DEPTH_SLICES - 1);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// A light that only reaches as far as its range, laid out as the fragment
+// shader reads it (std430: position and range, then color and intensity)
+struct PointLight
+{
+	glm::vec3 position;		// world space
+	float range;			// no light at all past this distance
+	glm::vec3 color;
+	float intensity;
+};
+
+// Clustered forward lighting. The view frustum is cut into screen tiles
+// and exponential depth slices; each frame every point light is listed in
+// the clusters its range reaches, and the fragment shader loops only over
+// the lights of its own cluster. A light costs nothing where it does not
+// reach, so the scene can hold hundreds of small ones.
+//
+// Lights, cluster ranges and light indices are SSBOs at LIGHT_BINDING,
+// CLUSTER_BINDING and LIGHT_INDEX_BINDING.
+class LightClusterer
+{
+public:
+	static const GLuint LIGHT_BINDING = 6;
+	static const GLuint CLUSTER_BINDING = 7;
+	static const GLuint LIGHT_INDEX_BINDING = 8;
+
+	static const int TILE_SIZE = 64;	// pixels on a side
+	static const int DEPTH_SLICES = 24;
+
+	// Assigns the lights to the clusters of this frame's view and uploads
+	// the lists. nearPlane and farPlane are those of projection; width and
+	// height are the viewport's size in pixels.
+	void Update(const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection,
+		float nearPlane, float farPlane, int width, int height);
+	void Destroy();
+
+private:
+	// Header of the cluster buffer, ahead of its (first, count) pairs (std430)
+	struct ClusterGrid
+	{
+		glm::uvec4 size;		// tiles across, tiles down, depth slices, tile size
+		glm::vec4 depthPlane;	// view depth of a world space point p: dot(depthPlane, vec4(p, 1))
+		glm::vec4 slicing;		// slice of a view depth: log(depth) * x + y
+	};
+
+	struct Bounds
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+	};
+
+	void BuildBounds(const glm::mat4& projection, float nearPlane, float farPlane, int width, int height);
+	int Slice(float depth) const;
+
+	ClusterGrid mGrid;
+	std::vector<Bounds> mBounds;		// view space bounds of each cluster
+	glm::mat4 mBoundsProjection;		// projection and viewport mBounds were built for
+	int mBoundsWidth = 0;
+	int mBoundsHeight = 0;
+	float mNearPlane = 0.0f;
+	float mFarPlane = 0.0f;
+
+	std::vector<std::pair<uint32_t, uint32_t>> mHits;	// (cluster, light) of this frame
+	std::vector<glm::uvec2> mRanges;					// first index and count per cluster
+	std::vector<GLuint> mIndices;
+
+	GLuint mLightBuffer = 0;
+	GLuint mClusterBuffer = 0;
+	GLuint mIndexBuffer = 0;
+};
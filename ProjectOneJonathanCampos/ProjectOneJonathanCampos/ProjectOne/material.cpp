@@ -0,0 +1,441 @@
+#include "material.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+
+const size_t MaterialPacker::INVALID_HANDLE;
+const GLuint MaterialPacker::MATERIAL_BINDING;
+const GLuint MaterialPacker::MATERIAL_ATTRIBUTE;
+
+
+namespace
+{
+	// Atlas entries start on multiples of ALIGN texels and keep GUTTER
+	// texels apart, so the first ATLAS_LEVELS mips of every entry are
+	// whole 4x4 blocks that do not touch their neighbours
+	const GLint ATLAS_LEVELS = 5;
+	const GLint ALIGN = 4 << (ATLAS_LEVELS - 1);
+	const GLint GUTTER = ALIGN;
+
+	inline GLint URoundUp(GLint value, GLint multiple)
+	{
+		return (value + multiple - 1) / multiple * multiple;
+	}
+
+	int UMipLevels(int width, int height)
+	{
+		int levels = 1;
+		while ((width | height) >> levels)
+			levels++;
+		return levels;
+	}
+
+	// Bits per texel of the formats the texture loaders create, for the log
+	size_t UTexelBits(GLint internalFormat)
+	{
+		switch (internalFormat)
+		{
+		case GL_R8:
+			return 8;
+		case GL_RG8:
+			return 16;
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+			return 4;
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+		case GL_COMPRESSED_RGBA_BPTC_UNORM:
+		case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+			return 8;
+		default:
+			return 32;
+		}
+	}
+}
+
+
+size_t MaterialPacker::Add(GLuint textureId)
+{
+	if (textureId == 0)
+		return INVALID_HANDLE;
+
+	for (size_t i = 0; i < mEntries.size(); i++)
+	{
+		if (mEntries[i].textureId == textureId)
+			return i;
+	}
+
+	Entry entry = {};
+	entry.textureId = textureId;
+	mEntries.push_back(entry);
+	return mEntries.size() - 1;
+}
+
+
+///////////////////////////////////////////////////
+//	Pack()
+//
+//	With bindless textures every immutable texture is made resident as is.
+//	Otherwise group the textures by format; within a group, sizes shared by
+//	two or more textures become texture arrays and the rest go into an atlas.
+//	The copies in the pages replace the packed textures, which are deleted.
+///////////////////////////////////////////////////
+bool MaterialPacker::Pack()
+{
+	std::vector<Source> sources;
+	for (size_t i = 0; i < mEntries.size(); i++)
+	{
+		const GLuint textureId = mEntries[i].textureId;
+		if (!glIsTexture(textureId))
+			continue;
+
+		Source source = {};
+		GLint immutable = 0;
+		source.handle = i;
+		source.textureId = textureId;
+		glBindTexture(GL_TEXTURE_2D, textureId);
+		glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_IMMUTABLE_FORMAT, &immutable);
+		glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_IMMUTABLE_LEVELS, &source.levels);
+		glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, source.swizzle);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &source.internalFormat);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &source.width);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &source.height);
+		if (immutable)
+			sources.push_back(source);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	if (BindlessSupported())
+	{
+		size_t resident = 0;
+		for (const Source& source : sources)
+		{
+			GLuint64 handle = glGetTextureHandleARB(source.textureId);
+			if (handle == 0)
+				continue;
+			glMakeTextureHandleResidentARB(handle);
+			mEntries[source.handle].residentHandle = handle;
+			resident++;
+		}
+		std::cout << "INFO: Made " << resident << " textures resident for bindless access" << std::endl;
+		return true;
+	}
+
+	std::vector<bool> grouped(sources.size(), false);
+	for (size_t i = 0; i < sources.size(); i++)
+	{
+		if (grouped[i])
+			continue;
+
+		std::vector<Source> sameFormat;
+		for (size_t j = i; j < sources.size(); j++)
+		{
+			// textures that may share a page: same format and swizzle
+			if (!grouped[j] && sources[j].internalFormat == sources[i].internalFormat
+				&& memcmp(sources[j].swizzle, sources[i].swizzle, sizeof(sources[i].swizzle)) == 0)
+			{
+				sameFormat.push_back(sources[j]);
+				grouped[j] = true;
+			}
+		}
+
+		std::vector<Source> atlas;
+		std::vector<bool> arrayed(sameFormat.size(), false);
+		for (size_t a = 0; a < sameFormat.size(); a++)
+		{
+			if (arrayed[a])
+				continue;
+
+			std::vector<Source> sameSize(1, sameFormat[a]);
+			for (size_t b = a + 1; b < sameFormat.size(); b++)
+			{
+				if (!arrayed[b] && sameFormat[b].width == sameFormat[a].width && sameFormat[b].height == sameFormat[a].height
+					&& sameFormat[b].levels == sameFormat[a].levels)
+				{
+					sameSize.push_back(sameFormat[b]);
+					arrayed[b] = true;
+				}
+			}
+
+			if (sameSize.size() > 1)
+				UPackArray(sameSize);
+			else
+				atlas.push_back(sameFormat[a]);
+		}
+		if (!atlas.empty())
+			UPackAtlas(atlas);
+	}
+
+	// the pages hold the only copy from here on
+	size_t packed = 0;
+	for (Entry& entry : mEntries)
+	{
+		if (!entry.packed)
+			continue;
+		glDeleteTextures(1, &entry.textureId);
+		entry.textureId = 0;
+		packed++;
+	}
+
+	if (!mPages.empty())
+	{
+		std::cout << "INFO: Packed " << packed << " textures into " << mPages.size()
+			<< " texture array pages (" << mPageBytes / 1024 << " KB)" << std::endl;
+	}
+	return true;
+}
+
+
+bool MaterialPacker::BindlessSupported()
+{
+	return GLEW_ARB_bindless_texture != 0;
+}
+
+
+void MaterialPacker::Destroy()
+{
+	for (Entry& entry : mEntries)
+	{
+		if (entry.residentHandle != 0)
+			glMakeTextureHandleNonResidentARB(entry.residentHandle);
+		glDeleteTextures(1, &entry.textureId);
+	}
+	mEntries.clear();
+
+	if (!mPages.empty())
+		glDeleteTextures(GLsizei(mPages.size()), mPages.data());
+	glDeleteBuffers(1, &mMaterialBuffer);
+	mPages.clear();
+	mPageBytes = 0;
+	mMaterialBuffer = 0;
+}
+
+
+GLuint MaterialPacker::Texture(size_t handle) const
+{
+	return handle < mEntries.size() ? mEntries[handle].textureId : 0;
+}
+
+
+GLuint MaterialPacker::DrawTexture(size_t handle) const
+{
+	if (handle >= mEntries.size() || mEntries[handle].residentHandle != 0)
+		return 0;
+
+	const Entry& entry = mEntries[handle];
+	return entry.packed ? entry.page.pageId : entry.textureId;
+}
+
+
+bool MaterialPacker::IsPage(GLuint textureId) const
+{
+	return std::find(mPages.begin(), mPages.end(), textureId) != mPages.end();
+}
+
+
+///////////////////////////////////////////////////
+//	UpdateMaterials(const Scene&)
+//
+//	scene: objects to describe, in scene order
+//
+//	One DrawMaterial per object, so any draw can find its texture from
+//	the scene index alone
+///////////////////////////////////////////////////
+void MaterialPacker::UpdateMaterials(const Scene& scene)
+{
+	std::vector<DrawMaterial> materials(std::max<size_t>(scene.Size(), 1));
+	for (size_t i = 0; i < materials.size(); i++)
+	{
+		DrawMaterial& material = materials[i];
+		material = DrawMaterial();
+		material.layer = -1;
+		if (i >= scene.Size())
+			continue;
+
+		const size_t handle = scene.Object(i).texture;
+		if (handle >= mEntries.size())
+			continue;
+
+		const Entry& entry = mEntries[handle];
+		material.handle = entry.residentHandle;
+		if (entry.packed)
+		{
+			material.uvTransform = entry.page.uvTransform;
+			material.uvClamp = entry.page.uvClamp;
+			material.layer = entry.page.layer;
+		}
+	}
+
+	if (mMaterialBuffer == 0)
+		glGenBuffers(1, &mMaterialBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mMaterialBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawMaterial) * materials.size(), materials.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_BINDING, mMaterialBuffer);
+}
+
+
+// Allocate a page with the format, swizzle and sampling state of the source
+GLuint MaterialPacker::UCreatePage(const Source& format, GLint width, GLint height, GLint levels, GLint layers)
+{
+	GLuint pageId = 0;
+	glGenTextures(1, &pageId);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, pageId);
+
+	// set the texture wrapping parameters
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	// set texture filtering parameters
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, format.swizzle);
+
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GLenum(format.internalFormat), width, height, layers);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	for (GLint level = 0; level < levels; level++)
+	{
+		mPageBytes += size_t(std::max(1, width >> level)) * std::max(1, height >> level) * layers
+			* UTexelBits(format.internalFormat) / 8;
+	}
+	mPages.push_back(pageId);
+	return pageId;
+}
+
+
+// Copy the first levels of a source texture into a page, GPU side
+void MaterialPacker::UCopy(const Source& source, GLuint pageId, GLint levels, GLint x, GLint y, GLint layer)
+{
+	for (GLint level = 0; level < levels; level++)
+	{
+		glCopyImageSubData(source.textureId, GL_TEXTURE_2D, level, 0, 0, 0,
+			pageId, GL_TEXTURE_2D_ARRAY, level, x >> level, y >> level, layer,
+			std::max(1, source.width >> level), std::max(1, source.height >> level), 1);
+	}
+}
+
+
+// Same size textures: one layer each, sampled exactly as before
+void MaterialPacker::UPackArray(const std::vector<Source>& sources)
+{
+	GLint maxLayers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+	const Source& first = sources.front();
+	for (size_t start = 0; start < sources.size(); start += size_t(maxLayers))
+	{
+		GLint layers = GLint(std::min(sources.size() - start, size_t(maxLayers)));
+		GLuint pageId = UCreatePage(first, first.width, first.height, first.levels, layers);
+
+		for (GLint layer = 0; layer < layers; layer++)
+		{
+			const Source& source = sources[start + layer];
+			UCopy(source, pageId, source.levels, 0, 0, layer);
+
+			PackedTexture packed;
+			packed.pageId = pageId;
+			packed.layer = layer;
+			packed.uvTransform = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);
+			packed.uvClamp = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+			mEntries[source.handle].page = packed;
+			mEntries[source.handle].packed = true;
+		}
+	}
+}
+
+
+///////////////////////////////////////////////////
+//	UPackAtlas(const std::vector<Source>&)
+//
+//	sources: textures of one format that share their size with no other
+//
+//	Shelf pack the textures, tallest first, into layers about as wide as
+//	they are tall. UVs are clamped half a texel inside each entry, which
+//	samples level 0 the same way GL_CLAMP_TO_EDGE did on the source.
+///////////////////////////////////////////////////
+void MaterialPacker::UPackAtlas(const std::vector<Source>& sources)
+{
+	GLint maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	maxSize = maxSize / ALIGN * ALIGN;
+
+	std::vector<Source> sorted;
+	double area = 0.0;
+	GLint widest = 0;
+	for (const Source& source : sources)
+	{
+		GLint width = URoundUp(source.width + GUTTER, ALIGN);
+		GLint height = URoundUp(source.height + GUTTER, ALIGN);
+		if (width > maxSize || height > maxSize)
+			continue;
+		sorted.push_back(source);
+		area += double(width) * height;
+		widest = std::max(widest, width);
+	}
+	if (sorted.empty())
+		return;
+
+	std::sort(sorted.begin(), sorted.end(), [](const Source& a, const Source& b) { return a.height > b.height; });
+
+	const GLint pageWidth = std::min(maxSize, std::max(widest, URoundUp(GLint(std::ceil(std::sqrt(area))), ALIGN)));
+	GLint pageHeight = 0;
+	GLint levels = ATLAS_LEVELS;
+
+	struct Placement
+	{
+		GLint x;
+		GLint y;
+		GLint layer;
+	};
+	std::vector<Placement> placements;
+	GLint x = 0, y = 0, shelfHeight = 0, layer = 0;
+
+	for (const Source& source : sorted)
+	{
+		GLint width = URoundUp(source.width + GUTTER, ALIGN);
+		GLint height = URoundUp(source.height + GUTTER, ALIGN);
+
+		if (x + width > pageWidth)
+		{
+			x = 0;
+			y += shelfHeight;
+			shelfHeight = 0;
+		}
+		if (y + height > maxSize)
+		{
+			x = y = shelfHeight = 0;
+			layer++;
+		}
+
+		placements.push_back({ x, y, layer });
+		x += width;
+		shelfHeight = std::max(shelfHeight, height);
+		pageHeight = std::max(pageHeight, y + height);
+		levels = std::min(levels, source.levels);
+	}
+	levels = std::min(levels, UMipLevels(pageWidth, pageHeight));
+
+	GLuint pageId = UCreatePage(sorted.front(), pageWidth, pageHeight, levels, layer + 1);
+	const glm::vec2 pageSize = glm::vec2(pageWidth, pageHeight);
+
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		const Source& source = sorted[i];
+		const Placement& placement = placements[i];
+		UCopy(source, pageId, levels, placement.x, placement.y, placement.layer);
+
+		glm::vec2 origin(float(placement.x), float(placement.y));
+		glm::vec2 size(float(source.width), float(source.height));
+
+		PackedTexture packed;
+		packed.pageId = pageId;
+		packed.layer = placement.layer;
+		packed.uvTransform = glm::vec4(size / pageSize, origin / pageSize);
+		packed.uvClamp = glm::vec4((origin + 0.5f) / pageSize, (origin + size - 0.5f) / pageSize);
+		mEntries[source.handle].page = packed;
+		mEntries[source.handle].packed = true;
+	}
+}
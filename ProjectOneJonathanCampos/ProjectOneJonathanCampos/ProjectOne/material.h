@@ -0,0 +1,117 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "scene.h"
+
+// Where a source texture ended up once packed
+struct PackedTexture
+{
+	GLuint pageId;			// GL_TEXTURE_2D_ARRAY holding the texture
+	int layer;
+	glm::vec4 uvTransform;	// texture UV to page UV: xy scale, zw offset
+	glm::vec4 uvClamp;		// page UVs are clamped to this rectangle (xy min, zw max)
+};
+
+// Material of one scene object as the fragment shader reads it (std430)
+struct DrawMaterial
+{
+	glm::vec4 uvTransform;
+	glm::vec4 uvClamp;
+	GLint layer;			// -1 when the object's own texture is bound to unit 0
+	GLint padding;
+	GLuint64 handle;		// bindless texture handle (uvec2 in the shader), 0 for none
+};
+
+// Lets objects with different textures share a draw. With
+// ARB_bindless_texture every texture is made resident once and the shader
+// samples it through the handle in the object's material, so nothing is
+// bound between draws. Without it the textures are packed into texture
+// array pages: textures of the same format and size become layers of one
+// array; the rest of each format are packed into the layers of an atlas
+// array, with gutters between them. Each object finds its handle, or its
+// layer and UV transform, through the material buffer, indexed by the
+// object's scene index, which the vertex shader receives in the
+// per-instance attribute MATERIAL_ATTRIBUTE.
+//
+// Objects refer to their texture by the handle Add() returns, which stays
+// valid once the texture itself is deleted after packing.
+class MaterialPacker
+{
+public:
+	static const size_t INVALID_HANDLE = ~size_t(0);
+
+	// Shader storage binding of the DrawMaterial buffer
+	static const GLuint MATERIAL_BINDING = 4;
+
+	// Vertex attribute holding the scene index of the object being drawn
+	static const GLuint MATERIAL_ATTRIBUTE = 3;
+
+	// True when Pack() makes textures resident instead of packing them;
+	// the fragment shader has to be built for the same path
+	static bool BindlessSupported();
+
+	// Takes over a texture and returns its handle; adding the same texture
+	// again returns the same handle. Call before Pack().
+	size_t Add(GLuint textureId);
+
+	// Makes the textures resident, or copies them into pages and deletes
+	// the copied ones, so a packed texture is only in memory once. Textures
+	// without immutable storage (streamed ones) are left out: their levels
+	// change, which a texture with a handle does not allow. Call once,
+	// before the static batches are first built.
+	bool Pack();
+
+	// Deletes the pages and every texture still held
+	void Destroy();
+
+	// The texture itself, or 0 once it was packed into a page
+	GLuint Texture(size_t handle) const;
+
+	// Texture an object's draw binds: 0 for a resident texture, its page
+	// when packed, else its own
+	GLuint DrawTexture(size_t handle) const;
+
+	bool IsPage(GLuint textureId) const;
+
+	// Writes the DrawMaterial of every scene object and binds the buffer
+	// to MATERIAL_BINDING. Call whenever the scene changes.
+	void UpdateMaterials(const Scene& scene);
+
+private:
+	// Source texture as found by Pack()
+	struct Source
+	{
+		size_t handle;
+		GLuint textureId;
+		GLint internalFormat;
+		GLint width;
+		GLint height;
+		GLint levels;
+		GLint swizzle[4];
+	};
+
+	// A texture added to the packer
+	struct Entry
+	{
+		GLuint textureId;		// 0 once packed
+		GLuint64 residentHandle;	// bindless handle, 0 when not resident
+		bool packed;
+		PackedTexture page;
+	};
+
+	GLuint UCreatePage(const Source& format, GLint width, GLint height, GLint levels, GLint layers);
+	void UCopy(const Source& source, GLuint pageId, GLint levels, GLint x, GLint y, GLint layer);
+	void UPackArray(const std::vector<Source>& sources);
+	void UPackAtlas(const std::vector<Source>& sources);
+
+	std::vector<Entry> mEntries;
+	std::vector<GLuint> mPages;
+	size_t mPageBytes = 0;
+	GLuint mMaterialBuffer = 0;
+};
@@ -1,4 +1,8 @@
 #include "mesh.h"
+#include "geometry.h"
+#include "weld.h"
+
+#include <iostream>
 #include <vector>
 
 
@@ -71,39 +75,11 @@ void Meshes::UCreatePlaneMesh(GLMesh& mesh)
 		0,3,2
 	};
 
-	// total float values per each type
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	// store vertex and index count
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-	mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
-
-	// Generate the VAO for the mesh
-	glGenVertexArrays(1, &mesh.vao);
-	glBindVertexArray(mesh.vao);	// activate the VAO
-
-	// Create VBOs for the mesh
-	glGenBuffers(2, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends data to the GPU
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]); // Activates the buffer
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-	// Strides between vertex coordinates
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	// split into streams and send to the GPU
+	const VertexFormat format = VertexFormat::PositionNormalUV();
+	Geometry geometry;
+	geometry.Deinterleave(format, verts, sizeof(verts) / (sizeof(verts[0]) * format.stride));
+	UUploadMesh(mesh, geometry, indices, sizeof(indices) / sizeof(indices[0]));
 }
 
 
@@ -178,37 +154,11 @@ void Meshes::UCreateBoxMesh(GLMesh& mesh)
 		20,23,22
 	};
 
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-	mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(2, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]); // Activates the buffer
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
-
+	// split into streams and send to the GPU
+	const VertexFormat format = VertexFormat::PositionNormalUV();
+	Geometry geometry;
+	geometry.Deinterleave(format, verts, sizeof(verts) / (sizeof(verts[0]) * format.stride));
+	UUploadMesh(mesh, geometry, indices, sizeof(indices) / sizeof(indices[0]));
 }
 
 ///////////////////////////////////////////////////
@@ -1004,60 +954,25 @@ void Meshes::UCreateSphereMesh(GLMesh& mesh)
 
 	// total float values per each type
 	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	// store vertex and index count
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex));
-	mesh.nIndices = sizeof(indices) / (sizeof(indices[0]));
 
 	glm::vec3 normal;
 	glm::vec3 vert;
 	glm::vec3 center(0.0f, 0.0f, 0.0f);
 	float u, v;
-	std::vector<GLfloat> combined_values;
+	Geometry geometry;
+	geometry.Reserve(sizeof(verts) / (sizeof(verts[0]) * floatsPerVertex));
 
-	// combine interleaved vertices, normals, and texture coords
+	// derive normals and texture coords from the positions
 	for (int i = 0; i < sizeof(verts) / (sizeof(verts[0])); i += 3)
 	{
 		vert = glm::vec3(verts[i], verts[i + 1], verts[i + 2]);
 		normal = normalize(vert - center);
 		u = atan2(normal.x, normal.z) / (2 * M_PI) + 0.5;
 		v = normal.y * 0.5 + 0.5;
-		combined_values.push_back(vert.x);
-		combined_values.push_back(vert.y);
-		combined_values.push_back(vert.z);
-		combined_values.push_back(normal.x);
-		combined_values.push_back(normal.y);
-		combined_values.push_back(normal.z);
-		combined_values.push_back(u);
-		combined_values.push_back(v);
+		geometry.PushVertex(vert, normal, glm::vec2(u, v));
 	}
 
-	// Create VAO
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create VBOs
-	glGenBuffers(2, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the vertex buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * combined_values.size(), combined_values.data(), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]); // Activates the index buffer
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-	// Strides between vertex coordinates
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	UUploadMesh(mesh, geometry, indices, sizeof(indices) / (sizeof(indices[0])));
 }
 
 
@@ -1068,16 +983,38 @@ void Meshes::UCreateSphereMesh(GLMesh& mesh)
 //
 //	Create a torus mesh and store it in a VAO/VBO
 //
+//	The generator emits a plain triangle list; welding turns it into an
+//	indexed mesh when uploaded.
+//
 //	Correct triangle drawing command:
 //
-//	glDrawArrays(GL_TRIANGLES, 0, meshes.gTorusMesh.nVertices);
+//	glDrawElements(GL_TRIANGLES, meshes.gTorusMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
 ///////////////////////////////////////////////////
 void Meshes::UCreateTorusMesh(GLMesh& mesh)
 {
-	int _mainSegments = 30;
-	int _tubeSegments = 30;
-	float _mainRadius = 1.0f;
-	float _tubeRadius = .1f;
+	Geometry geometry;
+
+	// generate the torus vertices
+	UGenerateTorus(30, 30, 1.0f, .1f, geometry);
+
+	UUploadMesh(mesh, geometry, nullptr, 0);
+}
+
+
+///////////////////////////////////////////////////
+//	UGenerateTorus(int, int, float, float, Geometry&)
+//
+//	mainSegments: segments around the main ring
+//	tubeSegments: segments around the tube
+//	mainRadius: distance from the center to the middle of the tube
+//	tubeRadius: radius of the tube
+//	geometry: receives the triangle list vertices
+//
+//	Generate the torus triangle list used by UCreateTorusMesh
+///////////////////////////////////////////////////
+void Meshes::UGenerateTorus(int _mainSegments, int _tubeSegments, float _mainRadius, float _tubeRadius,
+	Geometry& geometry)
+{
 
 	auto mainSegmentAngleStep = glm::radians(360.0f / float(_mainSegments));
 	auto tubeSegmentAngleStep = glm::radians(360.0f / float(_tubeSegments));
@@ -1088,8 +1025,6 @@ void Meshes::UCreateTorusMesh(GLMesh& mesh)
 	std::vector<glm::vec2> texture_coords;
 	glm::vec3 center(0.0f, 0.0f, 0.0f);
 	glm::vec3 normal;
-	glm::vec3 vertex;
-	glm::vec2 text_coord;
 
 	// generate the torus vertices
 	auto currentMainSegmentAngle = 0.0f;
@@ -1269,54 +1204,12 @@ void Meshes::UCreateTorusMesh(GLMesh& mesh)
 		u += horizontalStep;
 	}
 
-	std::vector<GLfloat> combined_values;
+	geometry.Clear();
+	geometry.Reserve(vertex_list.size());
 
-	// combine interleaved vertices, normals, and texture coords
+	// combine vertices, normals, and texture coords
 	for (int i = 0; i < vertex_list.size(); i++)
-	{
-		vertex = vertex_list[i];
-		normal = normals_list[i];
-		text_coord = texture_coords[i];
-		combined_values.push_back(vertex.x);
-		combined_values.push_back(vertex.y);
-		combined_values.push_back(vertex.z);
-		combined_values.push_back(normal.x);
-		combined_values.push_back(normal.y);
-		combined_values.push_back(normal.z);
-		combined_values.push_back(text_coord.x);
-		combined_values.push_back(text_coord.y);
-	}
-
-	// total float values per each type
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	// store vertex and index count
-	mesh.nVertices = vertex_list.size();
-	mesh.nIndices = 0;
-
-	// Create VAO
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create VBOs
-	glGenBuffers(1, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * combined_values.size(), combined_values.data(), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+		geometry.PushVertex(vertex_list[i], normals_list[i], texture_coords[i]);
 }
 
 
@@ -1368,30 +1261,13 @@ void Meshes::UCreatePyramid4Mesh(GLMesh& mesh)
 		0.0f, 0.5f, 0.0f,		0.0f, 0.0f, 1.0f,	0.5f, 1.0f,		//top point
 	};
 
-	const GLuint floatsPerVertex = 3;	// Number of coordinates per vertex
-	const GLuint floatsPerColor = 3;	// Number of values per vertex color
-	const GLuint floatsPerUV = 2;		// Number of texture coordinate values
+	// split into streams and send to the GPU
+	const VertexFormat format = VertexFormat::PositionNormalUV();
+	Geometry geometry;
+	geometry.Deinterleave(format, verts, sizeof(verts) / (sizeof(verts[0]) * format.stride));
 
-	// Calculate total defined vertices
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerColor + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao);			// Creates 1 VAO
-	glGenBuffers(1, mesh.vbos);					// Creates 1 VBO
-	glBindVertexArray(mesh.vao);				// Activates the VAO
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);	// Activates the VBO
-	// Sends vertex or coordinate data to the GPU
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
-
-	// Strides between sets of attribute data
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor + floatsPerUV);
-
-	// Creates the Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, (void*)0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerColor)));
-	glEnableVertexAttribArray(2);
+	// a strip depends on vertex order, so it is uploaded as is
+	UUploadMesh(mesh, geometry, nullptr, 0, false);
 }
 
 
@@ -1409,11 +1285,13 @@ void Meshes::UCreatePyramid4Mesh(GLMesh& mesh)
 //
 //	Create a cylinder mesh and store it in a VAO/VBO
 //
-//  Correct triangle drawing commands:
+//	The caps are authored as two 36 vertex fans and the body as a 146 vertex
+//	strip; they are expanded into one triangle list so the cylinder can be
+//	drawn (and batched) like the other meshes.
 //
-//	glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-//	glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-//	glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
+//  Correct triangle drawing command:
+//
+//	glDrawElements(GL_TRIANGLES, meshes.gCylinderMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
 ///////////////////////////////////////////////////
 void Meshes::UCreateCylinderMesh(GLMesh& mesh)
 {
@@ -1643,32 +1521,98 @@ void Meshes::UCreateCylinderMesh(GLMesh& mesh)
 		1.0f, 0.0f, 0.0f,		0.92f, 0.0f, 0.08f,		1.0, 0.0
 	};
 
+	// first vertex and vertex count of the two cap fans and the body strip
+	const GLuint bottomFan = 0, topFan = 36, fanCount = 36;
+	const GLuint bodyStrip = 72, stripCount = 146;
+
+	std::vector<GLuint> indices;
+	for (GLuint fan : { bottomFan, topFan })
+	{
+		for (GLuint k = 1; k + 1 < fanCount; k++)
+			indices.insert(indices.end(), { fan, fan + k, fan + k + 1 });
+	}
+	for (GLuint k = 0; k + 2 < stripCount; k++)
+	{
+		// every other strip triangle is flipped to keep the winding consistent
+		GLuint a = bodyStrip + k;
+		if (k % 2 == 0)
+			indices.insert(indices.end(), { a, a + 1, a + 2 });
+		else
+			indices.insert(indices.end(), { a + 1, a, a + 2 });
+	}
+
+	// split into streams and send to the GPU
+	const VertexFormat format = VertexFormat::PositionNormalUV();
+	Geometry geometry;
+	geometry.Deinterleave(format, verts, sizeof(verts) / (sizeof(verts[0]) * format.stride));
+	UUploadMesh(mesh, geometry, indices.data(), GLuint(indices.size()));
+}
+
+
+///////////////////////////////////////////////////
+//	UUploadMesh(GLMesh&, const Geometry&, const GLuint*, GLuint, bool)
+//
+//	mesh: reference to mesh structure for storing data
+//	source: vertex streams to interleave and upload
+//	sourceIndices: index data, or nullptr for non-indexed triangle lists
+//	nSourceIndices: number of indices
+//	weld: merge duplicate vertices first; triangle lists only
+//
+//	Weld the vertices, interleave them as position/normal/uv and store them
+//	in a VAO/VBO. Welded meshes are always indexed.
+///////////////////////////////////////////////////
+void Meshes::UUploadMesh(GLMesh& mesh, const Geometry& source, const GLuint* sourceIndices, GLuint nSourceIndices, bool weld)
+{
+	Geometry geometry(source);
+	std::vector<GLuint> indexList(sourceIndices, sourceIndices + nSourceIndices);
+
+	if (weld)
+	{
+		WeldStats stats;
+		UWeldGeometry(geometry, indexList, WeldOptions(), &stats);
+		std::cout << "INFO: Welded " << stats.inputVertices << " vertices into " << stats.outputVertices
+			<< " (" << stats.Ratio() << ":1)" << std::endl;
+	}
+
+	const GLuint* indices = indexList.data();
+	const GLuint nIndices = GLuint(indexList.size());
+
+	const VertexFormat format = VertexFormat::PositionNormalUV();
+	std::vector<GLfloat> combined_values;
+	geometry.Interleave(format, combined_values);
+
 	// total float values per each type
 	const GLuint floatsPerVertex = 3;
 	const GLuint floatsPerNormal = 3;
 	const GLuint floatsPerUV = 2;
 
 	// store vertex and index count
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-	mesh.nIndices = 0;
+	mesh.nVertices = GLuint(geometry.Size());
+	mesh.nIndices = nIndices;
 
 	// Create VAO
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
+	glGenVertexArrays(1, &mesh.vao);
 	glBindVertexArray(mesh.vao);
 
-	// Create VBO
-	glGenBuffers(1, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+	// Create 2 buffers: first one for the vertex data; second one for the indices
+	glGenBuffers(2, mesh.vbos);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the vertex buffer
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * combined_values.size(), combined_values.data(), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+
+	if (nIndices > 0)
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]); // Activates the index buffer
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * nIndices, indices, GL_STATIC_DRAW);
+	}
 
 	// Strides between vertex coordinates
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
+	GLint stride = sizeof(float) * format.stride;
 
 	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, (void*)0);
+	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
 	glEnableVertexAttribArray(0);
 
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex)));
+	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
 	glEnableVertexAttribArray(1);
 
 	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
@@ -1676,7 +1620,6 @@ void Meshes::UCreateCylinderMesh(GLMesh& mesh)
 }
 
 
-
 void Meshes::UDestroyMesh(GLMesh& mesh)
 {
 	glDeleteVertexArrays(1, &mesh.vao);
@@ -5,8 +5,13 @@
 
 #include <glm/glm.hpp>
 
+#include <vector>
+
+class Geometry;
+
 class Meshes
 {
+public:
 	// Stores the GL data relative to a given mesh
 	struct GLMesh
 	{
@@ -29,6 +34,16 @@ public:
 	void CreateMeshes();
 	void DestroyMeshes();
 
+	// Parametric CPU torus, filling a Geometry with position/normal/uv
+	// vertices. It is the reference for the compute shader torus in meshgen.cpp.
+	static void UGenerateTorus(int mainSegments, int tubeSegments, float mainRadius, float tubeRadius,
+		Geometry& geometry);
+
+	// Welds, interleaves and creates the VAO/VBOs; nIndices == 0 for non-indexed input.
+	// Used by every mesh above and by StaticBatcher for merged meshes.
+	static void UUploadMesh(GLMesh& mesh, const Geometry& geometry, const GLuint* indices, GLuint nIndices,
+		bool weld = true);
+
 private:
 
 	void UCreateCylinderMesh(GLMesh& mesh);
@@ -41,5 +56,6 @@ private:
 	void UDestroyMesh(GLMesh& mesh);
 
 
+
 	void CalculateTriangleNormal(glm::vec3 px, glm::vec3 py, glm::vec3 pz);
-};
\ No newline at end of file
+};
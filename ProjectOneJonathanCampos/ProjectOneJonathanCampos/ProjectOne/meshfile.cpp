@@ -0,0 +1,152 @@
+#include "meshfile.h"
+#include "geometry.h"
+#include "weld.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+
+namespace
+{
+	const char MESH_FILE_MAGIC[4] = { 'M', 'S', 'H', '1' };
+
+	uint64_t UContentHash(const Geometry& geometry, const std::vector<GLuint>& indices)
+	{
+		return UHashBytes(indices.data(), sizeof(GLuint) * indices.size(), geometry.Hash());
+	}
+
+	bool UReadHeader(std::ifstream& file, const char* filename, MeshFileHeader& header)
+	{
+		if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.magic, MESH_FILE_MAGIC, sizeof(MESH_FILE_MAGIC)) != 0)
+		{
+			std::cout << "ERROR::MESHFILE::" << filename << " is not a mesh file" << std::endl;
+			return false;
+		}
+		if (header.version != MESH_FILE_VERSION)
+		{
+			std::cout << "ERROR::MESHFILE::" << filename << " has version " << header.version
+				<< ", expected " << MESH_FILE_VERSION << std::endl;
+			return false;
+		}
+		return true;
+	}
+}
+
+
+uint64_t UMeshFileGpuBytes(const MeshFileHeader& header)
+{
+	return uint64_t(header.vertexCount) * STREAM_COUNT * sizeof(GLfloat) + uint64_t(header.indexCount) * sizeof(GLuint);
+}
+
+
+///////////////////////////////////////////////////
+//	UWriteMeshFile(const char*, const Geometry&, const std::vector<GLuint>&)
+//
+//	filename: file to create
+//	source: vertices to store
+//	sourceIndices: triangle list indices, or empty for a non-indexed triangle list
+//
+//	Weld the vertices and write a mesh file that UReadMeshFile and
+//	MeshStreamer can load. Loads upload the stored vertices as they are.
+///////////////////////////////////////////////////
+bool UWriteMeshFile(const char* filename, const Geometry& source, const std::vector<GLuint>& sourceIndices)
+{
+	Geometry geometry(source);
+	std::vector<GLuint> indices(sourceIndices);
+	UWeldGeometry(geometry, indices);
+
+	MeshFileHeader header;
+	memcpy(header.magic, MESH_FILE_MAGIC, sizeof(header.magic));
+	header.version = MESH_FILE_VERSION;
+	header.vertexCount = uint32_t(geometry.Size());
+	header.indexCount = uint32_t(indices.size());
+
+	glm::vec3 minCorner(0.0f), maxCorner(0.0f);
+	if (!geometry.Empty())
+		geometry.ComputeBounds(minCorner, maxCorner);
+	for (int c = 0; c < 3; c++)
+	{
+		header.boundsMin[c] = minCorner[c];
+		header.boundsMax[c] = maxCorner[c];
+	}
+	header.contentHash = UContentHash(geometry, indices);
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		std::cout << "ERROR::MESHFILE::could not create " << filename << std::endl;
+		return false;
+	}
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	for (int s = 0; s < STREAM_COUNT; s++)
+		file.write(reinterpret_cast<const char*>(geometry.Stream(GeometryStream(s))), sizeof(float) * geometry.Size());
+	file.write(reinterpret_cast<const char*>(indices.data()), sizeof(GLuint) * indices.size());
+	file.close();
+
+	bool written = !file.fail();
+	if (!written)
+		std::cout << "ERROR::MESHFILE::failed writing " << filename << std::endl;
+	return written;
+}
+
+
+// Read only the header, for bounds and sizes without loading the mesh
+bool UReadMeshHeader(const char* filename, MeshFileHeader& header)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		std::cout << "ERROR::MESHFILE::could not open " << filename << std::endl;
+		return false;
+	}
+
+	return UReadHeader(file, filename, header);
+}
+
+
+///////////////////////////////////////////////////
+//	UReadMeshFile(const char*, Geometry&, std::vector<GLuint>&, MeshFileHeader*)
+//
+//	filename: file to read
+//	geometry: receives the vertices
+//	indices: receives the triangle list indices
+//	header: optionally receives the header
+//
+//	Load a mesh file and check its content hash. Safe to call from any
+//	thread; it makes no GL calls.
+///////////////////////////////////////////////////
+bool UReadMeshFile(const char* filename, Geometry& geometry, std::vector<GLuint>& indices, MeshFileHeader* header)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		std::cout << "ERROR::MESHFILE::could not open " << filename << std::endl;
+		return false;
+	}
+
+	MeshFileHeader fileHeader;
+	bool valid = UReadHeader(file, filename, fileHeader);
+	if (valid)
+	{
+		geometry.Resize(fileHeader.vertexCount);
+		indices.resize(fileHeader.indexCount);
+		for (int s = 0; s < STREAM_COUNT; s++)
+			file.read(reinterpret_cast<char*>(geometry.Stream(GeometryStream(s))), sizeof(float) * geometry.Size());
+		file.read(reinterpret_cast<char*>(indices.data()), sizeof(GLuint) * indices.size());
+		valid = !file.fail();
+
+		if (!valid)
+			std::cout << "ERROR::MESHFILE::" << filename << " is truncated" << std::endl;
+		else if (UContentHash(geometry, indices) != fileHeader.contentHash)
+		{
+			std::cout << "ERROR::MESHFILE::" << filename << " is corrupt (content hash mismatch)" << std::endl;
+			valid = false;
+		}
+	}
+
+	if (valid && header)
+		*header = fileHeader;
+	return valid;
+}
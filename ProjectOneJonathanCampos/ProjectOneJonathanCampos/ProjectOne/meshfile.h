@@ -0,0 +1,33 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <cstdint>
+#include <vector>
+
+class Geometry;
+
+// Binary mesh file: this header, then the eight Geometry streams one after
+// the other (vertexCount floats each), then indexCount GLuint indices.
+// Storing the streams unchanged lets a load read straight into a Geometry.
+struct MeshFileHeader
+{
+	char magic[4];			// "MSH1"
+	uint32_t version;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	float boundsMin[3];
+	float boundsMax[3];
+	uint64_t contentHash;	// UHashBytes of the indices seeded with Geometry::Hash()
+};
+
+const uint32_t MESH_FILE_VERSION = 1;
+
+// Size in bytes of the mesh once uploaded (interleaved vertices plus indices)
+uint64_t UMeshFileGpuBytes(const MeshFileHeader& header);
+
+// Welds the vertices before writing them; empty indices mean a triangle list
+bool UWriteMeshFile(const char* filename, const Geometry& source, const std::vector<GLuint>& sourceIndices);
+bool UReadMeshHeader(const char* filename, MeshFileHeader& header);
+bool UReadMeshFile(const char* filename, Geometry& geometry, std::vector<GLuint>& indices, MeshFileHeader* header = nullptr);
@@ -0,0 +1,594 @@
+#include "meshgen.h"
+#include "geometry.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+
+namespace
+{
+	// Shape selectors, matching the uShape values tested in the compute shader
+	const GLint SHAPE_TORUS = 0;
+	const GLint SHAPE_SPHERE = 1;
+	const GLint SHAPE_CYLINDER = 2;
+	const GLint SHAPE_BOX = 3;
+	const GLint SHAPE_PLANE = 4;
+
+	// total float values per vertex (position, normal, texture coords)
+	const GLuint floatsPerVertex = 3;
+	const GLuint floatsPerNormal = 3;
+	const GLuint floatsPerUV = 2;
+	const GLuint floatsPerElement = floatsPerVertex + floatsPerNormal + floatsPerUV;
+
+	// Must match local_size_x below
+	const GLuint workGroupSize = 64;
+
+	/* Mesh generation Compute Shader Source Code*/
+	const GLchar* meshGenShaderSource = GLSL(440,
+
+		layout(local_size_x = 64) in;
+
+	layout(std430, binding = 0) writeonly buffer VertexBuffer { float vertexData[]; };
+	layout(std430, binding = 1) writeonly buffer IndexBuffer { uint indexData[]; };
+
+	uniform int uShape;
+	uniform ivec2 uSegments;	// torus main/tube, sphere stacks/slices, cylinder slices, box subdivisions, plane x/z
+	uniform vec2 uRadii;		// torus main/tube radius
+	uniform uint uVertexCount;
+	uniform uint uCellCount;
+
+	const float PI = 3.14159265358979;
+
+	const vec3 boxNormals[6] = vec3[6](vec3(1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0),
+		vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0));
+	const vec3 boxUAxes[6] = vec3[6](vec3(0.0, 0.0, -1.0), vec3(0.0, 0.0, 1.0), vec3(1.0, 0.0, 0.0),
+		vec3(1.0, 0.0, 0.0), vec3(1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0));
+	const vec3 boxVAxes[6] = vec3[6](vec3(0.0, 1.0, 0.0), vec3(0.0, 1.0, 0.0), vec3(0.0, 0.0, -1.0),
+		vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 0.0), vec3(0.0, 1.0, 0.0));
+
+	void writeVertex(uint index, vec3 position, vec3 normal, vec2 uv)
+	{
+		uint base = index * 8u;
+		vertexData[base + 0u] = position.x;
+		vertexData[base + 1u] = position.y;
+		vertexData[base + 2u] = position.z;
+		vertexData[base + 3u] = normal.x;
+		vertexData[base + 4u] = normal.y;
+		vertexData[base + 5u] = normal.z;
+		vertexData[base + 6u] = uv.x;
+		vertexData[base + 7u] = uv.y;
+	}
+
+	void writeTriangle(uint index, uint a, uint b, uint c)
+	{
+		indexData[index + 0u] = a;
+		indexData[index + 1u] = b;
+		indexData[index + 2u] = c;
+	}
+
+	// Quad as two triangles (a, b, c) (d, e, f), written from index * 6
+	void writeQuad(uint cell, uint a, uint b, uint c, uint d, uint e, uint f)
+	{
+		writeTriangle(cell * 6u, a, b, c);
+		writeTriangle(cell * 6u + 3u, d, e, f);
+	}
+
+	vec3 torusPoint(int i, int j)
+	{
+		float mainAngle = radians(360.0 / float(uSegments.x)) * float(i);
+		float tubeAngle = radians(360.0 / float(uSegments.y)) * float(j);
+		float ring = uRadii.x + uRadii.y * cos(tubeAngle);
+		return vec3(ring * cos(mainAngle), ring * sin(mainAngle), uRadii.y * sin(tubeAngle));
+	}
+
+	// One invocation per quad, emitting the same 7 vertices per quad as Meshes::UGenerateTorus
+	void torusQuad(uint quad)
+	{
+		int i = int(quad) / uSegments.y;
+		int j = int(quad) % uSegments.y;
+		bool lastMain = (i + 1) == uSegments.x;
+		bool lastTube = (j + 1) == uSegments.y;
+		int i1 = lastMain ? 0 : i + 1;
+		int j1 = lastTube ? 0 : j + 1;
+
+		float horizontalStep = 1.0 / float(uSegments.x);
+		float verticalStep = 1.0 / float(uSegments.y);
+		vec2 uv = vec2(horizontalStep * float(i), verticalStep * float(j));
+		vec2 uvNext = vec2(lastMain ? 0.0 : uv.x + horizontalStep, lastTube ? 0.0 : uv.y + verticalStep);
+		// the reference steps v backwards on the sixth vertex of interior quads
+		vec2 uvSixth = (lastMain || lastTube) ? uvNext : vec2(uvNext.x, uv.y - verticalStep);
+
+		vec3 p00 = torusPoint(i, j);
+		vec3 p01 = torusPoint(i, j1);
+		vec3 p11 = torusPoint(i1, j1);
+		vec3 p10 = torusPoint(i1, j);
+
+		uint base = quad * 7u;
+		writeVertex(base + 0u, p00, normalize(p00), uv);
+		writeVertex(base + 1u, p01, normalize(p01), vec2(uv.x, uvNext.y));
+		writeVertex(base + 2u, p11, normalize(p11), uvNext);
+		writeVertex(base + 3u, p00, normalize(p00), uv);
+		writeVertex(base + 4u, p10, normalize(p10), vec2(uvNext.x, uv.y));
+		writeVertex(base + 5u, p11, normalize(p11), uvSixth);
+		writeVertex(base + 6u, p00, normalize(p00), uv);
+	}
+
+	void sphereVertex(uint id)
+	{
+		int stacks = uSegments.x;
+		int slices = uSegments.y;
+		int st = int(id) / (slices + 1);
+		int sl = int(id) % (slices + 1);
+		float phi = PI * float(st) / float(stacks);
+		float theta = 2.0 * PI * float(sl) / float(slices);
+		vec3 position = vec3(sin(phi) * sin(theta), cos(phi), sin(phi) * cos(theta));
+		writeVertex(id, position, position, vec2(float(sl) / float(slices), 1.0 - float(st) / float(stacks)));
+	}
+
+	void sphereCell(uint id)
+	{
+		uint slices = uint(uSegments.y);
+		uint a = (id / slices) * (slices + 1u) + id % slices;
+		uint b = a + slices + 1u;
+		writeQuad(id, a, b, a + 1u, a + 1u, b, b + 1u);
+	}
+
+	void cylinderVertex(uint id)
+	{
+		int slices = uSegments.x;
+		int sideVertices = 2 * (slices + 1);
+		if (int(id) < sideVertices)
+		{
+			int k = int(id) / 2;
+			float y = float(int(id) % 2);
+			float angle = 2.0 * PI * float(k) / float(slices);
+			vec3 normal = vec3(cos(angle), 0.0, -sin(angle));
+			writeVertex(id, vec3(normal.x, y, normal.z), normal, vec2(float(k) / float(slices), y));
+			return;
+		}
+
+		int capId = int(id) - sideVertices;
+		float y = float(capId / (slices + 2));
+		int ring = capId % (slices + 2);
+		vec3 normal = vec3(0.0, y * 2.0 - 1.0, 0.0);
+		if (ring == 0)
+		{
+			writeVertex(id, vec3(0.0, y, 0.0), normal, vec2(0.5, 0.5));
+			return;
+		}
+
+		float angle = 2.0 * PI * float(ring - 1) / float(slices);
+		vec3 position = vec3(cos(angle), y, -sin(angle));
+		writeVertex(id, position, normal, vec2(0.5 + 0.5 * position.x, 0.5 + 0.5 * position.z));
+	}
+
+	void cylinderCell(uint id)
+	{
+		uint slices = uint(uSegments.x);
+		uint bottomCenter = 2u * (slices + 1u);
+		uint topCenter = bottomCenter + slices + 2u;
+		if (id < slices)
+		{
+			uint a = 2u * id;
+			writeQuad(id, a, a + 2u, a + 1u, a + 1u, a + 2u, a + 3u);
+		}
+		else if (id < 2u * slices)
+		{
+			uint k = id - slices;
+			writeTriangle(6u * slices + 3u * k, bottomCenter, bottomCenter + 2u + k, bottomCenter + 1u + k);
+		}
+		else
+		{
+			uint k = id - 2u * slices;
+			writeTriangle(9u * slices + 3u * k, topCenter, topCenter + 1u + k, topCenter + 2u + k);
+		}
+	}
+
+	void boxVertex(uint id)
+	{
+		int n = uSegments.x;
+		int faceVertices = (n + 1) * (n + 1);
+		int f = int(id) / faceVertices;
+		int r = int(id) % faceVertices;
+		float u = float(r % (n + 1)) / float(n);
+		float v = float(r / (n + 1)) / float(n);
+		vec3 position = 0.5 * boxNormals[f] + (u - 0.5) * boxUAxes[f] + (v - 0.5) * boxVAxes[f];
+		writeVertex(id, position, boxNormals[f], vec2(u, v));
+	}
+
+	void boxCell(uint id)
+	{
+		uint n = uint(uSegments.x);
+		uint f = id / (n * n);
+		uint r = id % (n * n);
+		uint a = f * (n + 1u) * (n + 1u) + (r / n) * (n + 1u) + r % n;
+		uint b = a + n + 1u;
+		writeQuad(id, a, a + 1u, b + 1u, a, b + 1u, b);
+	}
+
+	void planeVertex(uint id)
+	{
+		int xSegments = uSegments.x;
+		float u = float(int(id) % (xSegments + 1)) / float(xSegments);
+		float v = float(int(id) / (xSegments + 1)) / float(uSegments.y);
+		writeVertex(id, vec3(-1.0 + 2.0 * u, 0.0, 1.0 - 2.0 * v), vec3(0.0, 1.0, 0.0), vec2(u, v));
+	}
+
+	void planeCell(uint id)
+	{
+		uint xSegments = uint(uSegments.x);
+		uint a = (id / xSegments) * (xSegments + 1u) + id % xSegments;
+		uint b = a + xSegments + 1u;
+		writeQuad(id, a, a + 1u, b + 1u, a, b + 1u, b);
+	}
+
+	void main()
+	{
+		uint id = gl_GlobalInvocationID.x;
+
+		if (uShape == 0)
+		{
+			if (id < uCellCount)
+				torusQuad(id);
+			return;
+		}
+
+		if (id < uVertexCount)
+		{
+			if (uShape == 1) sphereVertex(id);
+			else if (uShape == 2) cylinderVertex(id);
+			else if (uShape == 3) boxVertex(id);
+			else planeVertex(id);
+		}
+
+		if (id < uCellCount)
+		{
+			if (uShape == 1) sphereCell(id);
+			else if (uShape == 2) cylinderCell(id);
+			else if (uShape == 3) boxCell(id);
+			else planeCell(id);
+		}
+	}
+	);
+}
+
+
+///////////////////////////////////////////////////
+//	Create()
+//
+//	Compile the mesh generation compute shader
+///////////////////////////////////////////////////
+bool MeshGenerator::Create()
+{
+	return UCreateComputeProgram(meshGenShaderSource, mProgramId);
+}
+
+
+///////////////////////////////////////////////////
+//	Destroy()
+//
+//	Release the compute shader
+///////////////////////////////////////////////////
+void MeshGenerator::Destroy()
+{
+	glDeleteProgram(mProgramId);
+	mProgramId = 0;
+}
+
+
+///////////////////////////////////////////////////
+//	UPrepareMesh(GLMesh&, GLuint, GLuint)
+//
+//	mesh: mesh to (re)fill
+//	nVertices, nIndices: element counts the shader will write
+//
+//	Create the VAO and buffers on first use and grow them when needed.
+//	Buffer names never change, so the VAO stays valid across regenerations.
+///////////////////////////////////////////////////
+void MeshGenerator::UPrepareMesh(Meshes::GLMesh& mesh, GLuint nVertices, GLuint nIndices)
+{
+	const GLsizeiptr vertexBytes = GLsizeiptr(nVertices) * floatsPerElement * sizeof(GLfloat);
+	const GLsizeiptr indexBytes = GLsizeiptr(nIndices) * sizeof(GLuint);
+
+	if (mesh.vao == 0)
+	{
+		glGenVertexArrays(1, &mesh.vao);
+		glBindVertexArray(mesh.vao);
+
+		glGenBuffers(2, mesh.vbos);
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+		glBufferData(GL_ARRAY_BUFFER, vertexBytes, NULL, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, NULL, GL_DYNAMIC_COPY);
+
+		// Strides between vertex coordinates
+		GLint stride = sizeof(float) * floatsPerElement;
+
+		// Create Vertex Attribute Pointers
+		glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+		glEnableVertexAttribArray(0);
+
+		glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
+		glEnableVertexAttribArray(1);
+
+		glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
+		glEnableVertexAttribArray(2);
+
+		glBindVertexArray(0);
+	}
+	else
+	{
+		GLint size = 0;
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+		glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+		if (size < vertexBytes)
+			glBufferData(GL_ARRAY_BUFFER, vertexBytes, NULL, GL_DYNAMIC_COPY);
+
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[1]);
+		glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+		if (size < indexBytes)
+			glBufferData(GL_ARRAY_BUFFER, indexBytes, NULL, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	mesh.nVertices = nVertices;
+	mesh.nIndices = nIndices;
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mesh.vbos[0]);
+	if (nIndices > 0)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mesh.vbos[1]);
+}
+
+
+///////////////////////////////////////////////////
+//	UDispatch(GLint, GLuint, GLuint)
+//
+//	shape: SHAPE_* selector
+//	vertexCount, cellCount: work items for the vertex and index passes
+//
+//	Run the generator and make its writes visible to vertex fetch
+///////////////////////////////////////////////////
+void MeshGenerator::UDispatch(GLint shape, GLuint vertexCount, GLuint cellCount)
+{
+	glUseProgram(mProgramId);
+	glUniform1i(glGetUniformLocation(mProgramId, "uShape"), shape);
+	glUniform1ui(glGetUniformLocation(mProgramId, "uVertexCount"), vertexCount);
+	glUniform1ui(glGetUniformLocation(mProgramId, "uCellCount"), cellCount);
+
+	GLuint invocations = std::max(vertexCount, cellCount);
+	glDispatchCompute((invocations + workGroupSize - 1) / workGroupSize, 1, 1);
+
+	glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+
+///////////////////////////////////////////////////
+//	GenerateTorus(GLMesh&, int, int, float, float)
+//
+//	Correct triangle drawing command:
+//
+//	glDrawArrays(GL_TRIANGLES, 0, mesh.nVertices);
+///////////////////////////////////////////////////
+void MeshGenerator::GenerateTorus(Meshes::GLMesh& mesh, int mainSegments, int tubeSegments, float mainRadius, float tubeRadius)
+{
+	const GLuint quads = mainSegments * tubeSegments;
+
+	UPrepareMesh(mesh, quads * 7, 0);
+
+	glUseProgram(mProgramId);
+	glUniform2i(glGetUniformLocation(mProgramId, "uSegments"), mainSegments, tubeSegments);
+	glUniform2f(glGetUniformLocation(mProgramId, "uRadii"), mainRadius, tubeRadius);
+	UDispatch(SHAPE_TORUS, quads * 7, quads);
+}
+
+
+///////////////////////////////////////////////////
+//	GenerateSphere(GLMesh&, int, int)
+//
+//	glDrawElements(GL_TRIANGLES, mesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+///////////////////////////////////////////////////
+void MeshGenerator::GenerateSphere(Meshes::GLMesh& mesh, int stacks, int slices)
+{
+	const GLuint vertexCount = (stacks + 1) * (slices + 1);
+	const GLuint cellCount = stacks * slices;
+
+	UPrepareMesh(mesh, vertexCount, cellCount * 6);
+
+	glUseProgram(mProgramId);
+	glUniform2i(glGetUniformLocation(mProgramId, "uSegments"), stacks, slices);
+	UDispatch(SHAPE_SPHERE, vertexCount, cellCount);
+}
+
+
+///////////////////////////////////////////////////
+//	GenerateCylinder(GLMesh&, int)
+//
+//	glDrawElements(GL_TRIANGLES, mesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+///////////////////////////////////////////////////
+void MeshGenerator::GenerateCylinder(Meshes::GLMesh& mesh, int slices)
+{
+	const GLuint vertexCount = 4 * slices + 6;
+	const GLuint cellCount = 3 * slices;
+
+	UPrepareMesh(mesh, vertexCount, 12 * slices);
+
+	glUseProgram(mProgramId);
+	glUniform2i(glGetUniformLocation(mProgramId, "uSegments"), slices, 0);
+	UDispatch(SHAPE_CYLINDER, vertexCount, cellCount);
+}
+
+
+///////////////////////////////////////////////////
+//	GenerateBox(GLMesh&, int)
+//
+//	glDrawElements(GL_TRIANGLES, mesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+///////////////////////////////////////////////////
+void MeshGenerator::GenerateBox(Meshes::GLMesh& mesh, int subdivisions)
+{
+	const GLuint vertexCount = 6 * (subdivisions + 1) * (subdivisions + 1);
+	const GLuint cellCount = 6 * subdivisions * subdivisions;
+
+	UPrepareMesh(mesh, vertexCount, cellCount * 6);
+
+	glUseProgram(mProgramId);
+	glUniform2i(glGetUniformLocation(mProgramId, "uSegments"), subdivisions, subdivisions);
+	UDispatch(SHAPE_BOX, vertexCount, cellCount);
+}
+
+
+///////////////////////////////////////////////////
+//	GeneratePlane(GLMesh&, int, int)
+//
+//	glDrawElements(GL_TRIANGLES, mesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+///////////////////////////////////////////////////
+void MeshGenerator::GeneratePlane(Meshes::GLMesh& mesh, int xSegments, int zSegments)
+{
+	const GLuint vertexCount = (xSegments + 1) * (zSegments + 1);
+	const GLuint cellCount = xSegments * zSegments;
+
+	UPrepareMesh(mesh, vertexCount, cellCount * 6);
+
+	glUseProgram(mProgramId);
+	glUniform2i(glGetUniformLocation(mProgramId, "uSegments"), xSegments, zSegments);
+	UDispatch(SHAPE_PLANE, vertexCount, cellCount);
+}
+
+
+void MeshGenerator::DestroyMesh(Meshes::GLMesh& mesh)
+{
+	glDeleteVertexArrays(1, &mesh.vao);
+	glDeleteBuffers(2, mesh.vbos);
+	mesh = Meshes::GLMesh();
+}
+
+
+namespace
+{
+	// Compare a generated triangle list against CPU reference data
+	bool UCompareMesh(const char* name, const Meshes::GLMesh& mesh, const Geometry& geometry)
+	{
+		const float tolerance = 1e-4f;
+
+		std::vector<GLfloat> verts;
+		geometry.Interleave(VertexFormat::PositionNormalUV(), verts);
+
+		if (mesh.nVertices * floatsPerElement != verts.size() || mesh.nIndices != 0)
+		{
+			std::cout << "ERROR::MESHGEN::" << name << " size mismatch: " << mesh.nVertices << " vertices, "
+				<< mesh.nIndices << " indices (expected " << verts.size() / floatsPerElement << ", 0)" << std::endl;
+			return false;
+		}
+
+		std::vector<GLfloat> gpuVerts(verts.size());
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+		glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * gpuVerts.size(), gpuVerts.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		for (size_t i = 0; i < verts.size(); i++)
+		{
+			if (std::fabs(gpuVerts[i] - verts[i]) > tolerance)
+			{
+				std::cout << "ERROR::MESHGEN::" << name << " vertex " << i / floatsPerElement << " component "
+					<< i % floatsPerElement << ": " << gpuVerts[i] << " != " << verts[i] << std::endl;
+				return false;
+			}
+		}
+
+		std::cout << "INFO: GPU " << name << " matches CPU reference (" << mesh.nVertices << " vertices)" << std::endl;
+		return true;
+	}
+
+	// Check an indexed mesh that has no CPU generator: every index names a
+	// vertex, and every normal has unit length
+	bool UCheckIndexedMesh(const char* name, const Meshes::GLMesh& mesh)
+	{
+		const float tolerance = 1e-4f;
+
+		std::vector<GLfloat> gpuVerts(size_t(mesh.nVertices) * floatsPerElement);
+		std::vector<GLuint> gpuIndices(mesh.nIndices);
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+		glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * gpuVerts.size(), gpuVerts.data());
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[1]);
+		glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLuint) * gpuIndices.size(), gpuIndices.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		if (gpuIndices.empty() || gpuIndices.size() % 3 != 0)
+		{
+			std::cout << "ERROR::MESHGEN::" << name << " has " << gpuIndices.size() << " indices" << std::endl;
+			return false;
+		}
+
+		for (size_t i = 0; i < gpuIndices.size(); i++)
+		{
+			if (gpuIndices[i] >= mesh.nVertices)
+			{
+				std::cout << "ERROR::MESHGEN::" << name << " index " << i << " is " << gpuIndices[i]
+					<< ", past " << mesh.nVertices << " vertices" << std::endl;
+				return false;
+			}
+		}
+
+		for (GLuint v = 0; v < mesh.nVertices; v++)
+		{
+			const GLfloat* normal = &gpuVerts[size_t(v) * floatsPerElement + floatsPerVertex];
+			float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			if (!(std::fabs(length - 1.0f) <= tolerance))
+			{
+				std::cout << "ERROR::MESHGEN::" << name << " vertex " << v << " normal length " << length << std::endl;
+				return false;
+			}
+		}
+
+		std::cout << "INFO: GPU " << name << " is well formed (" << mesh.nVertices << " vertices, "
+			<< mesh.nIndices << " indices)" << std::endl;
+		return true;
+	}
+}
+
+
+///////////////////////////////////////////////////
+//	Verify()
+//
+//	Generate every shape at a couple of resolutions on the GPU. The torus
+//	is compared with UGenerateTorus in mesh.cpp, which builds the scene's
+//	torus; the other shapes have no CPU generator and are checked for
+//	valid indices and unit normals.
+///////////////////////////////////////////////////
+bool MeshGenerator::Verify()
+{
+	Geometry geometry;
+	Meshes::GLMesh mesh = {};
+	bool passed = true;
+
+	// the torus exactly as UCreateTorusMesh builds it for the scene
+	GenerateTorus(mesh, 30, 30, 1.0f, 0.1f);
+	Meshes::UGenerateTorus(30, 30, 1.0f, 0.1f, geometry);
+	passed = UCompareMesh("torus", mesh, geometry) && passed;
+
+	// regenerate into the same mesh on purpose to exercise buffer reuse
+	const int resolutions[] = { 30, 7, 64 };
+	for (int res : resolutions)
+	{
+		GenerateTorus(mesh, res, res / 2 + 3, 1.0f, 0.1f);
+		Meshes::UGenerateTorus(res, res / 2 + 3, 1.0f, 0.1f, geometry);
+		passed = UCompareMesh("torus", mesh, geometry) && passed;
+
+		GenerateSphere(mesh, res, res + 1);
+		passed = UCheckIndexedMesh("sphere", mesh) && passed;
+
+		GenerateCylinder(mesh, res);
+		passed = UCheckIndexedMesh("cylinder", mesh) && passed;
+
+		GenerateBox(mesh, res / 4 + 1);
+		passed = UCheckIndexedMesh("box", mesh) && passed;
+
+		GeneratePlane(mesh, res, res / 3 + 1);
+		passed = UCheckIndexedMesh("plane", mesh) && passed;
+	}
+
+	DestroyMesh(mesh);
+	return passed;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include "mesh.h"
+
+// Generates parametric meshes with compute shaders, writing straight into
+// the vertex and index buffers of a GLMesh. No vertex data goes through the
+// CPU; Meshes::UGenerateTorus, which builds the scene's torus, is the CPU
+// reference for the torus.
+class MeshGenerator
+{
+public:
+	bool Create();
+	void Destroy();
+
+	// Each call (re)fills the mesh, reusing its buffers when they are large enough.
+	// The torus is a plain triangle list drawn with glDrawArrays; the others are indexed.
+	void GenerateTorus(Meshes::GLMesh& mesh, int mainSegments, int tubeSegments, float mainRadius, float tubeRadius);
+	void GenerateSphere(Meshes::GLMesh& mesh, int stacks, int slices);
+	void GenerateCylinder(Meshes::GLMesh& mesh, int slices);
+	void GenerateBox(Meshes::GLMesh& mesh, int subdivisions);
+	void GeneratePlane(Meshes::GLMesh& mesh, int xSegments, int zSegments);
+
+	void DestroyMesh(Meshes::GLMesh& mesh);
+
+	// Reads back generated meshes; the torus is compared with the CPU reference
+	bool Verify();
+
+private:
+	void UPrepareMesh(Meshes::GLMesh& mesh, GLuint nVertices, GLuint nIndices);
+	void UDispatch(GLint shape, GLuint vertexCount, GLuint cellCount);
+
+	// One program generates every shape, selected by the uShape uniform
+	GLuint mProgramId = 0;
+};
@@ -0,0 +1,245 @@
+#include "permutation.h"
+
+#include <iostream>
+
+
+const int ShaderPermutations::MAX_LIGHTS;
+const GLint ShaderPermutations::OBJECT_COLOR_LOCATION;
+const GLint ShaderPermutations::FEEDBACK_SLOT_LOCATION;
+const GLint ShaderPermutations::TEXTURE_SIZE_LOCATION;
+
+
+uint32_t ShaderFeatures::Key() const
+{
+	return uint32_t(textured) | uint32_t(specular) << 1 | uint32_t(ortho) << 2 | uint32_t(deferred) << 3 | uint32_t(lightCount) << 4;
+}
+
+
+std::string ShaderFeatures::Defines() const
+{
+	std::string defines;
+	defines += "#define TEXTURED " + std::to_string(int(textured)) + "\n";
+	defines += "#define LIGHT_COUNT " + std::to_string(lightCount) + "\n";
+	defines += "#define SPECULAR " + std::to_string(int(specular)) + "\n";
+	defines += "#define ORTHO " + std::to_string(int(ortho)) + "\n";
+	defines += "#define DEFERRED " + std::to_string(int(deferred)) + "\n";
+	return defines;
+}
+
+
+///////////////////////////////////////////////////
+//	Create(const char*, const char*, const char*, bool)
+//
+//	vertexSource, fragmentSource: sources of the scene shader
+//	fragmentHeader: inserted after the fragment shader's #version line
+//	pipelines: build separable stages and combine them in pipelines
+//
+//	The fallback is the cheapest variant, so it is ready first: no
+//	texture, one light and no specular
+///////////////////////////////////////////////////
+void ShaderPermutations::Create(const char* vertexSource, const char* fragmentSource, const char* fragmentHeader, bool pipelines)
+{
+	Destroy();
+	mVertexSource = vertexSource;
+	mFragmentSource = fragmentSource;
+	mFragmentHeader = fragmentHeader ? fragmentHeader : "";
+
+	// let the driver use as many compiler threads as it likes
+	if (GLEW_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+
+	mPipelines = pipelines && (GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects);
+	if (pipelines && !mPipelines)
+		std::cout << "INFO: No separate shader object support, shader variants are linked as whole programs" << std::endl;
+	if (mPipelines)
+		UBeginSeparableProgram(GL_VERTEX_SHADER, mVertexSource, nullptr, mVertexStage);
+
+	ShaderFeatures fallback;
+	fallback.textured = false;
+	fallback.lightCount = 1;
+	fallback.specular = false;
+	mFallback = Program(fallback);
+}
+
+
+void ShaderPermutations::Destroy()
+{
+	for (std::pair<const GLuint, Variant>& variant : mVariants)
+	{
+		glDeleteShader(variant.second.build.vertexShaderId);
+		glDeleteShader(variant.second.build.fragmentShaderId);
+		glDeleteProgramPipelines(1, &variant.second.pipeline);
+		glDeleteProgram(variant.first);
+	}
+	glDeleteShader(mVertexStage.vertexShaderId);
+	glDeleteProgram(mVertexStage.programId);
+	mVertexStage = ShaderBuild();
+	mPipelines = false;
+	mPrograms.clear();
+	mVariants.clear();
+	mPending.clear();
+	mProgramList.clear();
+	mFallback = 0;
+	mDeferredFallback = 0;
+}
+
+
+///////////////////////////////////////////////////
+//	Program(const ShaderFeatures&)
+//
+//	features: what the variant is specialized for
+//
+//	The defines are inserted ahead of the fragment header, so the program
+//	cache tells the variants apart by their source
+///////////////////////////////////////////////////
+GLuint ShaderPermutations::Program(const ShaderFeatures& features)
+{
+	std::map<uint32_t, GLuint>::const_iterator built = mPrograms.find(features.Key());
+	if (built != mPrograms.end())
+		return built->second;
+
+	if (features.lightCount < 1 || features.lightCount > MAX_LIGHTS)
+	{
+		std::cout << "ERROR::PERMUTATION::" << features.lightCount << " lights is not supported" << std::endl;
+		return 0;
+	}
+
+	std::string header = features.Defines() + mFragmentHeader;
+
+	Variant variant;
+	variant.features = features;
+	variant.submitted = Clock::now();
+	if (mPipelines)
+		UBeginSeparableProgram(GL_FRAGMENT_SHADER, mFragmentSource, header.c_str(), variant.build);
+	else
+		UBeginShaderProgram(mVertexSource, mFragmentSource, header.c_str(), variant.build);
+
+	const GLuint programId = variant.build.programId;
+	mPrograms[features.Key()] = programId;
+	mVariants[programId] = variant;
+	mPending.push_back(programId);
+	return programId;
+}
+
+
+void ShaderPermutations::Poll(bool wait)
+{
+	// in pipeline mode a variant draws once the shared vertex stage is built too
+	if (mPipelines && !UEndShaderProgram(mVertexStage, wait))
+		return;
+
+	for (size_t i = 0; i < mPending.size();)
+	{
+		Variant& variant = mVariants[mPending[i]];
+		if (!UEndShaderProgram(variant.build, wait))
+		{
+			i++;
+			continue;
+		}
+
+		const ShaderFeatures& features = variant.features;
+		if (variant.build.linked && (!mPipelines || mVertexStage.linked))
+		{
+			if (mPipelines)
+			{
+				glGenProgramPipelines(1, &variant.pipeline);
+				glUseProgramStages(variant.pipeline, GL_VERTEX_SHADER_BIT, mVertexStage.programId);
+				glUseProgramStages(variant.pipeline, GL_FRAGMENT_SHADER_BIT, mPending[i]);
+			}
+			variant.ready = true;
+			mProgramList.push_back(mPending[i]);
+			std::cout << "INFO: Built shader variant: textured " << features.textured << ", " << features.lightCount
+				<< " lights, specular " << features.specular << ", ortho " << features.ortho << ", deferred " << features.deferred << ", ready "
+				<< std::chrono::duration<double, std::milli>(Clock::now() - variant.submitted).count() << " ms after submitting" << std::endl;
+		}
+		else
+		{
+			std::cout << "ERROR::PERMUTATION::variant textured " << features.textured << ", " << features.lightCount
+				<< " lights, specular " << features.specular << ", ortho " << features.ortho << ", deferred " << features.deferred
+				<< " failed; its objects keep the fallback" << std::endl;
+		}
+		mPending.erase(mPending.begin() + i);
+	}
+}
+
+
+bool ShaderPermutations::IsReady(GLuint programId) const
+{
+	std::map<GLuint, Variant>::const_iterator found = mVariants.find(programId);
+	return found != mVariants.end() && found->second.ready;
+}
+
+
+bool ShaderPermutations::Features(GLuint programId, ShaderFeatures& features) const
+{
+	std::map<GLuint, Variant>::const_iterator found = mVariants.find(programId);
+	if (found == mVariants.end())
+		return false;
+	features = found->second.features;
+	return true;
+}
+
+
+GLuint ShaderPermutations::ForProjection(GLuint programId, bool ortho)
+{
+	ShaderFeatures features;
+	if (!Features(programId, features))
+		return programId;
+	if (features.ortho == ortho)
+		return programId;
+
+	features.ortho = ortho;
+	GLuint variant = Program(features);
+	return variant != 0 ? variant : programId;
+}
+
+
+GLuint ShaderPermutations::ForDeferred(GLuint programId)
+{
+	ShaderFeatures features;
+	if (!Features(programId, features))
+		return programId;
+	if (features.deferred)
+		return programId;
+
+	if (mDeferredFallback == 0)
+	{
+		ShaderFeatures fallback;
+		fallback.textured = false;
+		fallback.lightCount = 1;
+		fallback.specular = false;
+		fallback.deferred = true;
+		mDeferredFallback = Program(fallback);
+	}
+
+	features.lightCount = 1;
+	features.ortho = false;
+	features.deferred = true;
+	GLuint variant = Program(features);
+	return variant != 0 ? variant : programId;
+}
+
+
+GLuint ShaderPermutations::DrawProgram(GLuint programId, bool ortho, bool deferred)
+{
+	programId = deferred ? ForDeferred(programId) : ForProjection(programId, ortho);
+	if (IsReady(programId))
+		return programId;
+	GLuint fallback = deferred ? mDeferredFallback : mFallback;
+	return IsReady(fallback) ? fallback : 0;
+}
+
+
+void ShaderPermutations::Use(GLuint programId) const
+{
+	if (!mPipelines)
+	{
+		glUseProgram(programId);
+		return;
+	}
+
+	// a current program would take precedence over the pipeline
+	std::map<GLuint, Variant>::const_iterator found = mVariants.find(programId);
+	glUseProgram(0);
+	glBindProgramPipeline(found != mVariants.end() ? found->second.pipeline : 0);
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "shader.h"
+
+// What a variant of the scene shader is specialized for. Each feature
+// becomes a #define in front of the fragment shader (TEXTURED, LIGHT_COUNT,
+// SPECULAR, ORTHO, DEFERRED), and the shader only branches on those
+// constants, so the compiler drops whatever a variant does not use.
+struct ShaderFeatures
+{
+	bool textured = true;	// sample the object's texture; else use its color
+	int lightCount = 2;
+	bool specular = true;
+	bool ortho = false;		// orthographic view: one view direction for every pixel
+	bool deferred = false;	// write the G-buffer instead of lighting (see DeferredRenderer)
+
+	uint32_t Key() const;
+
+	// One #define line per feature
+	std::string Defines() const;
+};
+
+// Builds the variants of the scene shader the objects ask for, once each,
+// and keeps them for the objects' programId. Variants are compiled on the
+// driver's threads while the caller goes on loading; until one is ready
+// its objects are drawn with a small fallback variant in their own color.
+// Uniforms set per draw have the same explicit location in every variant;
+// the others have to be looked up per program.
+//
+// In pipeline mode the vertex stage is built once as a separable program
+// and each variant only builds its fragment stage, bound together with it
+// in a program pipeline: the builds grow with the vertex plus fragment
+// variants instead of their product. A variant is then named by its
+// fragment program, which holds every uniform, so the rest of this
+// interface works the same in both modes.
+class ShaderPermutations
+{
+public:
+	static const int MAX_LIGHTS = 8;
+
+	// Explicit uniform locations shared by every variant
+	static const GLint OBJECT_COLOR_LOCATION = 1;		// untextured variants only
+	static const GLint FEEDBACK_SLOT_LOCATION = 2;		// textured variants only
+	static const GLint TEXTURE_SIZE_LOCATION = 3;		// textured variants only
+
+	// Sources every variant is built from. fragmentHeader goes right after
+	// the feature defines, which follow the fragment shader's #version line,
+	// so it can use them. Submits the fallback variant. pipelines asks for
+	// pipeline mode, used when separate shader objects are supported.
+	void Create(const char* vertexSource, const char* fragmentSource, const char* fragmentHeader, bool pipelines = false);
+	void Destroy();
+
+	// Program of a variant, submitted the first time it is asked for; 0
+	// when the features are not supported. The program may not be ready yet.
+	GLuint Program(const ShaderFeatures& features);
+
+	// Collect the variants the driver finished since the last call; never
+	// waits unless wait is set, then every submitted variant is collected
+	void Poll(bool wait = false);
+
+	// True once a program linked and can be drawn with
+	bool IsReady(GLuint programId) const;
+
+	// Features a program of this set was built with
+	bool Features(GLuint programId, ShaderFeatures& features) const;
+
+	// The same variant for the other kind of projection
+	GLuint ForProjection(GLuint programId, bool ortho);
+
+	// The variant writing the G-buffer for the same material. Lights and
+	// projection do not matter there, so it is shared by all of them.
+	GLuint ForDeferred(GLuint programId);
+
+	// Program to draw an object of programId with: its variant for the
+	// projection (or the G-buffer) when ready, else the matching fallback,
+	// else 0 to skip the object
+	GLuint DrawProgram(GLuint programId, bool ortho, bool deferred = false);
+
+	// Draw with a ready program: glUseProgram, or its pipeline in pipeline mode
+	void Use(GLuint programId) const;
+
+	bool UsesPipelines() const { return mPipelines; }
+
+	// Every variant ready so far
+	const std::vector<GLuint>& Programs() const { return mProgramList; }
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Variant
+	{
+		ShaderFeatures features;
+		ShaderBuild build;
+		Clock::time_point submitted;
+		GLuint pipeline = 0;	// pipeline mode: the shared vertex stage and this fragment stage
+		bool ready = false;
+	};
+
+	const char* mVertexSource = nullptr;
+	const char* mFragmentSource = nullptr;
+	std::string mFragmentHeader;
+	bool mPipelines = false;
+	ShaderBuild mVertexStage;		// pipeline mode: the separable vertex program
+	GLuint mFallback = 0;
+	GLuint mDeferredFallback = 0;	// submitted with the first deferred variant
+
+	std::map<uint32_t, GLuint> mPrograms;		// by ShaderFeatures::Key()
+	std::map<GLuint, Variant> mVariants;
+	std::vector<GLuint> mPending;				// submitted, not collected by Poll()
+	std::vector<GLuint> mProgramList;
+};
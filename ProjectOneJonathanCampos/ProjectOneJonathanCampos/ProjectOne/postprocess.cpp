@@ -0,0 +1,212 @@
+#include "postprocess.h"
+#include "shader.h"
+
+
+const GLint PostProcessor::HDR_UNIT;
+const GLuint PostProcessor::OUTPUT_IMAGE_UNIT;
+
+
+namespace
+{
+	// Must match local_size_x and local_size_y below
+	const int workGroupSize = 8;
+
+	/* Tonemap, FXAA and dither Compute Shader Source Code*/
+	const GLchar* postProcessShaderSource = GLSL(440,
+
+		layout(local_size_x = 8, local_size_y = 8) in;
+
+	layout(binding = 5) uniform sampler2D hdrImage;	// PostProcessor::HDR_UNIT, filtered linearly
+	layout(rgba8, binding = 0) writeonly uniform image2D ldrImage;	// OUTPUT_IMAGE_UNIT
+
+	uniform float exposure;
+
+	// FXAA: smallest contrast treated as an edge, relative to the brightest
+	// neighbor and absolute for dark areas, and how far along an edge it blends
+	const float EDGE_THRESHOLD = 0.125f;
+	const float EDGE_THRESHOLD_MIN = 0.0312f;
+	const float REDUCE_MUL = 0.125f;
+	const float REDUCE_MIN = 0.0078125f;
+	const float SPAN_MAX = 8.0f;
+
+	// Linear to sRGB, so FXAA, the dither and the 8 bit store all work in
+	// the steps the display shows
+	vec3 encodeSrgb(vec3 color)
+	{
+		return mix(12.92f * color, 1.055f * pow(color, vec3(1.0f / 2.4f)) - 0.055f, step(vec3(0.0031308f), color));
+	}
+
+	// ACES filmic curve (Narkowicz fit) of the exposed color, sRGB encoded
+	vec3 tonemap(vec3 color)
+	{
+		color *= exposure;
+		return encodeSrgb(clamp(color * (2.51f * color + 0.03f) / (color * (2.43f * color + 0.59f) + 0.14f), 0.0f, 1.0f));
+	}
+
+	float luma(vec3 color)
+	{
+		return dot(color, vec3(0.299f, 0.587f, 0.114f));
+	}
+
+	vec3 fetchTonemapped(ivec2 pixel, ivec2 size)
+	{
+		return tonemap(texelFetch(hdrImage, clamp(pixel, ivec2(0), size - 1), 0).rgb);
+	}
+
+	vec3 sampleTonemapped(vec2 uv)
+	{
+		return tonemap(texture(hdrImage, uv).rgb);
+	}
+
+	void main()
+	{
+		ivec2 size = textureSize(hdrImage, 0);
+		ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+		if (pixel.x >= size.x || pixel.y >= size.y)
+			return;
+
+		// tonemapped pixel and its diagonal neighbors
+		vec3 color = fetchTonemapped(pixel, size);
+		float lumaCenter = luma(color);
+		float lumaDownLeft = luma(fetchTonemapped(pixel + ivec2(-1, -1), size));
+		float lumaDownRight = luma(fetchTonemapped(pixel + ivec2(1, -1), size));
+		float lumaUpLeft = luma(fetchTonemapped(pixel + ivec2(-1, 1), size));
+		float lumaUpRight = luma(fetchTonemapped(pixel + ivec2(1, 1), size));
+
+		float lumaMin = min(lumaCenter, min(min(lumaDownLeft, lumaDownRight), min(lumaUpLeft, lumaUpRight)));
+		float lumaMax = max(lumaCenter, max(max(lumaDownLeft, lumaDownRight), max(lumaUpLeft, lumaUpRight)));
+
+		// only pixels on an edge are blended along it
+		if (lumaMax - lumaMin >= max(EDGE_THRESHOLD_MIN, lumaMax * EDGE_THRESHOLD))
+		{
+			// the edge runs across the luma gradient
+			vec2 direction = vec2((lumaUpLeft + lumaUpRight) - (lumaDownLeft + lumaDownRight),
+				(lumaDownLeft + lumaUpLeft) - (lumaDownRight + lumaUpRight));
+			float reduce = max((lumaDownLeft + lumaDownRight + lumaUpLeft + lumaUpRight) * 0.25f * REDUCE_MUL, REDUCE_MIN);
+			float scale = 1.0f / (min(abs(direction.x), abs(direction.y)) + reduce);
+			direction = clamp(direction * scale, vec2(-SPAN_MAX), vec2(SPAN_MAX)) / vec2(size);
+
+			// filtered taps along the edge, near ones and then far ones too
+			vec2 uv = (vec2(pixel) + 0.5f) / vec2(size);
+			vec3 nearColor = 0.5f * (sampleTonemapped(uv - direction / 6.0f) + sampleTonemapped(uv + direction / 6.0f));
+			vec3 farColor = 0.5f * nearColor + 0.25f * (sampleTonemapped(uv - direction * 0.5f) + sampleTonemapped(uv + direction * 0.5f));
+
+			// the far taps went past the edge if they leave the neighborhood's range
+			float lumaFar = luma(farColor);
+			color = lumaFar < lumaMin || lumaFar > lumaMax ? nearColor : farColor;
+		}
+
+		// interleaved gradient noise of half a step either way before the 8 bit store
+		float noise = fract(52.9829189f * fract(dot(vec2(pixel), vec2(0.06711056f, 0.00583715f))));
+		color += (noise - 0.5f) / 255.0f;
+
+		imageStore(ldrImage, pixel, vec4(color, 1.0f));
+	}
+	);
+}
+
+
+bool PostProcessor::Create()
+{
+	Destroy();
+	if (!UCreateComputeProgram(postProcessShaderSource, mProgramId))
+		return false;
+
+	mExposureLocation = glGetUniformLocation(mProgramId, "exposure");
+	return true;
+}
+
+
+void PostProcessor::Destroy()
+{
+	DestroyTargets();
+	glDeleteProgram(mProgramId);
+	mProgramId = 0;
+	mExposureLocation = -1;
+}
+
+
+void PostProcessor::Begin(int width, int height)
+{
+	if (mFramebuffer == 0 || width != mWidth || height != mHeight)
+		CreateTargets(width, height);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+
+///////////////////////////////////////////////////
+//	Resolve(float)
+//
+//	exposure: scale of the HDR color before tonemapping
+//
+//	One thread per pixel; the default framebuffer is bound afterwards. The
+//	output already holds sRGB values, so the blit must not encode again.
+///////////////////////////////////////////////////
+void PostProcessor::Resolve(float exposure)
+{
+	glUseProgram(mProgramId);
+	glUniform1f(mExposureLocation, exposure);
+	glActiveTexture(GL_TEXTURE0 + HDR_UNIT);
+	glBindTexture(GL_TEXTURE_2D, mColor);
+	glBindImageTexture(OUTPUT_IMAGE_UNIT, mOutput, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+	glDispatchCompute(GLuint((mWidth + workGroupSize - 1) / workGroupSize), GLuint((mHeight + workGroupSize - 1) / workGroupSize), 1);
+	glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, mOutputFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glDisable(GL_FRAMEBUFFER_SRGB);
+	glBlitFramebuffer(0, 0, mWidth, mHeight, 0, 0, mWidth, mHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glEnable(GL_FRAMEBUFFER_SRGB);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+void PostProcessor::CreateTargets(int width, int height)
+{
+	DestroyTargets();
+	mWidth = width;
+	mHeight = height;
+
+	// created on a unit of their own, so the scene's bound textures stay put
+	glActiveTexture(GL_TEXTURE0 + HDR_UNIT);
+	glGenTextures(1, &mColor);
+	glBindTexture(GL_TEXTURE_2D, mColor);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_R11F_G11F_B10F, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glGenTextures(1, &mOutput);
+	glBindTexture(GL_TEXTURE_2D, mOutput);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+
+	glGenRenderbuffers(1, &mDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, mDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &mFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mColor, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, mDepth);
+
+	glGenFramebuffers(1, &mOutputFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, mOutputFramebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mOutput, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+void PostProcessor::DestroyTargets()
+{
+	glDeleteFramebuffers(1, &mFramebuffer);
+	glDeleteFramebuffers(1, &mOutputFramebuffer);
+	glDeleteTextures(1, &mColor);
+	glDeleteTextures(1, &mOutput);
+	glDeleteRenderbuffers(1, &mDepth);
+	mFramebuffer = mOutputFramebuffer = mColor = mOutput = mDepth = 0;
+	mWidth = mHeight = 0;
+}
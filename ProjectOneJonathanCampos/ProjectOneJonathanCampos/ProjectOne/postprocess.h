@@ -0,0 +1,49 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+// Post-processing in one compute pass. The scene is drawn into an HDR
+// target (R11F_G11F_B10F color, 24 bit depth); a single dispatch then reads
+// each pixel's neighborhood once and writes the final 8 bit color once:
+//
+//	exposure, an ACES filmic tonemap and the sRGB encoding
+//	FXAA on the encoded luma, instead of multisampling the targets
+//	dithering before the 8 bit store, against banding
+//
+// Compute shaders cannot write the default framebuffer, so the result is
+// copied there with a blit, with GL_FRAMEBUFFER_SRGB off for it since the
+// values are encoded already.
+class PostProcessor
+{
+public:
+	// Texture unit the HDR color is read from, and image unit the result is written to
+	static const GLint HDR_UNIT = 5;
+	static const GLuint OUTPUT_IMAGE_UNIT = 0;
+
+	bool Create();
+	void Destroy();
+
+	// Binds the HDR target, sized to the viewport, and clears it
+	void Begin(int width, int height);
+
+	// The HDR target, for passes that bind their own framebuffer on the way
+	GLuint Framebuffer() const { return mFramebuffer; }
+
+	// Tonemaps, anti-aliases and dithers the HDR target into the default framebuffer
+	void Resolve(float exposure);
+
+private:
+	void CreateTargets(int width, int height);
+	void DestroyTargets();
+
+	GLuint mProgramId = 0;
+	GLint mExposureLocation = -1;
+	GLuint mFramebuffer = 0;		// HDR color and depth
+	GLuint mColor = 0;
+	GLuint mDepth = 0;				// renderbuffer, never sampled
+	GLuint mOutputFramebuffer = 0;	// mOutput, to blit from
+	GLuint mOutput = 0;				// RGBA8, written by the compute shader
+	int mWidth = 0;
+	int mHeight = 0;
+};
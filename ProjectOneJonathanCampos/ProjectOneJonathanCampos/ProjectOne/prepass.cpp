@@ -0,0 +1,257 @@
+#include "prepass.h"
+#include "geometry.h"
+#include "shader.h"
+
+#include <iostream>
+
+
+namespace
+{
+	// Auto mode turns the pre-pass on above ENABLE_OVERDRAW and off below
+	// DISABLE_OVERDRAW; in between it keeps its choice
+	const float ENABLE_OVERDRAW = 1.5f;
+	const float DISABLE_OVERDRAW = 1.2f;
+
+	// Frames between probes while auto mode has the pre-pass off
+	const uint64_t PROBE_INTERVAL = 30;
+
+	/* Depth-only Vertex Shader Source Code*/
+	const GLchar* depthVertexSource = GLSL(440,
+
+		layout(location = 0) in vec3 position;
+	layout(location = 3) in uint objectIndex; // scene index of the object, for its transform
+
+	struct ObjectTransform
+	{
+		mat4 mvp;
+		mat4 model;
+		mat3x4 normal;
+	};
+	layout(std430, binding = 5) readonly buffer Transforms
+	{
+		ObjectTransform transforms[];
+	};
+
+	// the scene shader computes gl_Position the same way, so GL_EQUAL holds
+	invariant gl_Position;
+
+	void main()
+	{
+		gl_Position = transforms[objectIndex].mvp * vec4(position, 1.0f);
+	}
+	);
+}
+
+
+bool DepthPrepass::Create(Mode mode)
+{
+	mMode = mode;
+	if (!UCreateVertexProgram(depthVertexSource, mProgramId))
+		return false;
+
+	for (FrameQueries& queries : mQueries)
+	{
+		glGenQueries(1, &queries.depthQuery);
+		glGenQueries(1, &queries.shadeQuery);
+	}
+	return true;
+}
+
+
+void DepthPrepass::Destroy()
+{
+	DestroyStreams();
+	for (FrameQueries& queries : mQueries)
+	{
+		glDeleteQueries(1, &queries.depthQuery);
+		glDeleteQueries(1, &queries.shadeQuery);
+		queries = FrameQueries();
+	}
+	glDeleteProgram(mProgramId);
+	mProgramId = 0;
+}
+
+
+///////////////////////////////////////////////////
+//	Build(const StaticBatcher&, const GpuCuller&)
+//
+//	batcher: batches to copy the positions of
+//	culler: draws the batches; gives the depth VAOs its scene indices
+//
+//	The positions are read back once per rebuild and packed 12 bytes a
+//	vertex, instead of fetched from the 32 byte interleaved vertices
+///////////////////////////////////////////////////
+void DepthPrepass::Build(const StaticBatcher& batcher, const GpuCuller& culler)
+{
+	DestroyStreams();
+
+	const GLuint stride = VertexFormat::PositionNormalUV().stride;
+	std::vector<GLfloat> interleaved;
+	std::vector<GLfloat> positions;
+	for (const StaticBatch& batch : batcher.Batches())
+	{
+		const Meshes::GLMesh& mesh = batch.mesh;
+		interleaved.resize(size_t(mesh.nVertices) * stride);
+		glBindBuffer(GL_COPY_READ_BUFFER, mesh.vbos[0]);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(GLfloat) * interleaved.size(), interleaved.data());
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+		positions.resize(size_t(mesh.nVertices) * 3);
+		for (size_t v = 0; v < mesh.nVertices; v++)
+		{
+			positions[3 * v] = interleaved[stride * v];
+			positions[3 * v + 1] = interleaved[stride * v + 1];
+			positions[3 * v + 2] = interleaved[stride * v + 2];
+		}
+
+		DepthStream stream;
+		glGenVertexArrays(1, &stream.vao);
+		glGenBuffers(1, &stream.positions);
+		glBindVertexArray(stream.vao);
+		glBindBuffer(GL_ARRAY_BUFFER, stream.positions);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * positions.size(), positions.data(), GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 3, 0);
+		glEnableVertexAttribArray(0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		culler.BindSceneIndices(stream.vao);
+		mStreams.push_back(stream);
+	}
+}
+
+
+bool DepthPrepass::Begin()
+{
+	mFrame++;
+	mFrames++;
+	FrameQueries& queries = mQueries[mFrame % 3];
+	if (queries.pending)
+		Collect(queries);
+
+	if (mMode == MODE_AUTO)
+		mActive = mEnabled || mFrame % PROBE_INTERVAL == 0;
+	else
+		mActive = mMode == MODE_ON;
+	queries.prepass = mActive;
+	queries.pending = true;
+	if (!mActive)
+		return false;
+
+	mPrepassFrames++;
+	glBeginQuery(GL_SAMPLES_PASSED, queries.depthQuery);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glUseProgram(mProgramId);
+	return true;
+}
+
+
+void DepthPrepass::DrawBatch(size_t batch, const GpuCuller& culler) const
+{
+	glBindVertexArray(mStreams[batch].vao);
+	culler.Draw(batch);
+}
+
+
+// Objects drawn on their own keep their interleaved VAO; the vertex stage
+// only reads the position
+void DepthPrepass::DrawMesh(const Meshes::GLMesh& mesh, GLuint sceneIndex) const
+{
+	glBindVertexArray(mesh.vao);
+	glVertexAttribI1ui(3, sceneIndex);
+	if (mesh.nIndices > 0)
+		glDrawElements(GL_TRIANGLES, mesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+	else
+		glDrawArrays(GL_TRIANGLES, 0, mesh.nVertices);
+}
+
+
+void DepthPrepass::BeginShading()
+{
+	if (mActive)
+	{
+		glEndQuery(GL_SAMPLES_PASSED);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+	}
+	glBeginQuery(GL_SAMPLES_PASSED, mQueries[mFrame % 3].shadeQuery);
+}
+
+
+void DepthPrepass::EndShading()
+{
+	glEndQuery(GL_SAMPLES_PASSED);
+	if (mActive)
+	{
+		glDepthFunc(GL_LESS);
+		glDepthMask(GL_TRUE);
+	}
+}
+
+
+void DepthPrepass::LogStats() const
+{
+	std::cout << "INFO: Depth pre-pass: on in " << mPrepassFrames << " of " << mFrames << " frames, overdraw "
+		<< mOverdraw << ", " << mSavedSamples << " of " << mShadedSamples + mSavedSamples
+		<< " shaded samples saved" << std::endl;
+}
+
+
+///////////////////////////////////////////////////
+//	Collect(FrameQueries&)
+//
+//	queries: a frame's queries, two frames old
+//
+//	A result that is still not available is dropped rather than waited for
+///////////////////////////////////////////////////
+void DepthPrepass::Collect(FrameQueries& queries)
+{
+	queries.pending = false;
+	GLuint available = GL_FALSE;
+	glGetQueryObjectuiv(queries.shadeQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return;
+
+	GLuint64 shaded = 0;
+	glGetQueryObjectui64v(queries.shadeQuery, GL_QUERY_RESULT, &shaded);
+	mShadedSamples += shaded;
+	if (queries.prepass)
+	{
+		// the depth pass let through what the shading pass would have run
+		GLuint64 depth = 0;
+		glGetQueryObjectui64v(queries.depthQuery, GL_QUERY_RESULT, &depth);
+		mVisibleSamples = shaded;
+		mSavedSamples += depth > shaded ? depth - shaded : 0;
+		mOverdraw = shaded > 0 ? float(depth) / shaded : 1.0f;
+	}
+	else if (mVisibleSamples > 0)
+		mOverdraw = float(shaded) / mVisibleSamples;
+	else
+		return;
+
+	if (mMode != MODE_AUTO)
+		return;
+	if (!mEnabled && mOverdraw > ENABLE_OVERDRAW)
+	{
+		mEnabled = true;
+		std::cout << "INFO: Depth pre-pass on, overdraw " << mOverdraw << std::endl;
+	}
+	else if (mEnabled && mOverdraw < DISABLE_OVERDRAW)
+	{
+		mEnabled = false;
+		std::cout << "INFO: Depth pre-pass off, overdraw " << mOverdraw << std::endl;
+	}
+}
+
+
+void DepthPrepass::DestroyStreams()
+{
+	for (DepthStream& stream : mStreams)
+	{
+		glDeleteVertexArrays(1, &stream.vao);
+		glDeleteBuffers(1, &stream.positions);
+	}
+	mStreams.clear();
+}
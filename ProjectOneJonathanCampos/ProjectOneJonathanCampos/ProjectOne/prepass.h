@@ -0,0 +1,90 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "batch.h"
+#include "culling.h"
+#include "mesh.h"
+
+// Depth-only pre-pass. The visible surfaces lay down their depth first,
+// with a position-only vertex stream and no fragment stage; the shading
+// pass then tests GL_EQUAL with depth writes off, so the Phong shader runs
+// once per covered pixel however much the objects overlap.
+//
+// Occlusion queries count the samples each pass lets through: with the
+// pre-pass, the depth pass count is what the shading pass would have run
+// without it and the shading pass count is the covered pixels. In auto
+// mode their ratio, the overdraw, switches the pre-pass on and off; while
+// it is off a frame is probed with it now and then to keep the estimate
+// fresh.
+class DepthPrepass
+{
+public:
+	enum Mode
+	{
+		MODE_OFF,
+		MODE_ON,
+		MODE_AUTO
+	};
+
+	bool Create(Mode mode);
+	void Destroy();
+
+	// Position-only copies of the batch meshes. Call after the batches are
+	// rebuilt and culler.Build().
+	void Build(const StaticBatcher& batcher, const GpuCuller& culler);
+
+	// Starts the frame: collects older queries, decides whether this frame
+	// gets the pre-pass and, if so, binds its program. Returns true when it does.
+	bool Begin();
+
+	// Depth-only draws, between Begin() and BeginShading()
+	void DrawBatch(size_t batch, const GpuCuller& culler) const;
+	void DrawMesh(const Meshes::GLMesh& mesh, GLuint sceneIndex) const;
+
+	// Brackets the shading pass: equal depth test and no depth writes after a pre-pass
+	void BeginShading();
+	void EndShading();
+
+	void LogStats() const;
+
+private:
+	struct FrameQueries
+	{
+		GLuint depthQuery = 0;
+		GLuint shadeQuery = 0;
+		bool prepass = false;
+		bool pending = false;
+	};
+
+	// One position stream per batch, sharing the batch's index buffer
+	struct DepthStream
+	{
+		GLuint vao = 0;
+		GLuint positions = 0;
+	};
+
+	void Collect(FrameQueries& queries);
+	void DestroyStreams();
+
+	Mode mMode = MODE_AUTO;
+	GLuint mProgramId = 0;
+	std::vector<DepthStream> mStreams;
+
+	FrameQueries mQueries[3];	// read back two frames later so the CPU never waits
+	uint64_t mFrame = 0;
+	bool mActive = false;		// pre-pass in the current frame
+	bool mEnabled = true;		// auto mode's choice
+
+	// Measurements
+	uint64_t mVisibleSamples = 0;	// covered pixels at the last pre-pass frame
+	float mOverdraw = 0.0f;
+	uint64_t mFrames = 0;
+	uint64_t mPrepassFrames = 0;
+	uint64_t mShadedSamples = 0;	// samples the shading passes let through
+	uint64_t mSavedSamples = 0;		// samples the pre-pass kept from being shaded
+};
@@ -0,0 +1,275 @@
+#include "programcache.h"
+#include "geometry.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace
+{
+	const char PROGRAM_CACHE_IDENTIFIER[8] = { 'P', '1', 'P', 'R', 'O', 'G', 'S', '\n' };
+	const uint32_t PROGRAM_CACHE_VERSION = 2;
+
+	struct CacheHeader
+	{
+		char identifier[8];
+		uint32_t version;
+		uint32_t programCount;
+		uint64_t driverHash;
+	};
+
+	// Followed by binaryBytes of binary
+	struct CacheEntryHeader
+	{
+		uint64_t key;
+		uint32_t binaryFormat;
+		uint32_t binaryBytes;
+		double buildMs;			// time the compile and link took, negative when not measured
+	};
+
+	struct CacheEntry
+	{
+		GLenum binaryFormat = 0;
+		double buildMs = 0.0;
+		std::vector<char> binary;
+	};
+
+	typedef std::chrono::steady_clock Clock;
+
+	std::string gFilename;
+	bool gEnabled = false;
+	bool gChanged = false;
+	uint64_t gDriverHash = 0;
+	std::map<uint64_t, CacheEntry> gEntries;
+
+	int gHits = 0;
+	int gMisses = 0;
+	int gUntimedHits = 0;		// hits of programs built in the background
+	double gSavedMs = 0.0;
+
+	// Vendor, renderer and version strings: a binary only loads on the driver that wrote it
+	uint64_t UDriverHash()
+	{
+		uint64_t hash = 0;
+		const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for (GLenum name : names)
+		{
+			const char* value = reinterpret_cast<const char*>(glGetString(name));
+			if (value)
+				hash = UHashBytes(value, strlen(value) + 1, hash);
+		}
+		return hash;
+	}
+
+	double UMillisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+}
+
+
+///////////////////////////////////////////////////
+//	UOpenProgramCache(const char*)
+//
+//	filename: cache file, created by UCloseProgramCache if missing
+//
+//	Loads every entry written by the same driver. A file from another
+//	driver is dropped and rewritten on close.
+///////////////////////////////////////////////////
+bool UOpenProgramCache(const char* filename)
+{
+	gFilename = filename;
+	gEntries.clear();
+	gChanged = false;
+
+	GLint formats = 0;
+	if (GLEW_ARB_get_program_binary)
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	gEnabled = formats > 0;
+	if (!gEnabled)
+	{
+		std::cout << "INFO: Program binaries not supported; shaders are built from source" << std::endl;
+		return false;
+	}
+	gDriverHash = UDriverHash();
+
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	if (!file)
+		return false;
+	const std::streamoff fileBytes = file.tellg();
+	file.seekg(0);
+
+	CacheHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| memcmp(header.identifier, PROGRAM_CACHE_IDENTIFIER, sizeof(PROGRAM_CACHE_IDENTIFIER)) != 0
+		|| header.version != PROGRAM_CACHE_VERSION)
+	{
+		std::cout << "ERROR::PROGRAMCACHE::" << filename << " is not a program cache file" << std::endl;
+		return false;
+	}
+	if (header.driverHash != gDriverHash)
+	{
+		std::cout << "INFO: Program cache " << filename << " is from another driver; rebuilding" << std::endl;
+		gChanged = true;
+		return false;
+	}
+
+	for (uint32_t i = 0; i < header.programCount; i++)
+	{
+		CacheEntryHeader entryHeader;
+		if (!file.read(reinterpret_cast<char*>(&entryHeader), sizeof(entryHeader)))
+			break;
+
+		// a corrupt size is not allocated; it reads past the end like a truncated file
+		bool complete = std::streamoff(entryHeader.binaryBytes) <= fileBytes - file.tellg();
+		if (complete)
+		{
+			CacheEntry& entry = gEntries[entryHeader.key];
+			entry.binaryFormat = entryHeader.binaryFormat;
+			entry.buildMs = entryHeader.buildMs;
+			entry.binary.resize(entryHeader.binaryBytes);
+			complete = bool(file.read(entry.binary.data(), entry.binary.size()));
+		}
+		if (!complete)
+		{
+			std::cout << "ERROR::PROGRAMCACHE::" << filename << " is truncated" << std::endl;
+			gEntries.erase(entryHeader.key);
+			gChanged = true;
+			break;
+		}
+	}
+	return true;
+}
+
+
+void UCloseProgramCache()
+{
+	if (gEnabled && gChanged)
+	{
+		CacheHeader header = {};
+		memcpy(header.identifier, PROGRAM_CACHE_IDENTIFIER, sizeof(PROGRAM_CACHE_IDENTIFIER));
+		header.version = PROGRAM_CACHE_VERSION;
+		header.programCount = uint32_t(gEntries.size());
+		header.driverHash = gDriverHash;
+
+		std::ofstream file(gFilename, std::ios::binary);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		for (const std::pair<const uint64_t, CacheEntry>& cached : gEntries)
+		{
+			CacheEntryHeader entryHeader = {};
+			entryHeader.key = cached.first;
+			entryHeader.binaryFormat = cached.second.binaryFormat;
+			entryHeader.binaryBytes = uint32_t(cached.second.binary.size());
+			entryHeader.buildMs = cached.second.buildMs;
+			file.write(reinterpret_cast<const char*>(&entryHeader), sizeof(entryHeader));
+			file.write(cached.second.binary.data(), cached.second.binary.size());
+		}
+		file.close();
+
+		if (file.fail())
+			std::cout << "ERROR::PROGRAMCACHE::failed writing " << gFilename << std::endl;
+	}
+
+	std::cout << "INFO: Program cache: " << gHits << " hits, " << gMisses << " misses, "
+		<< gSavedMs << " ms of shader builds saved";
+	if (gUntimedHits > 0)
+		std::cout << " (" << gUntimedHits << " hits of programs with no measured build time)";
+	std::cout << std::endl;
+
+	gEntries.clear();
+	gChanged = false;
+}
+
+
+uint64_t UHashShaderSource(const char* const* parts, const GLint* lengths, int count, uint64_t seed)
+{
+	uint64_t hash = seed;
+	for (int i = 0; i < count; i++)
+	{
+		size_t length = lengths && lengths[i] >= 0 ? size_t(lengths[i]) : strlen(parts[i]);
+		hash = UHashBytes(parts[i], length, hash);
+		hash = UHashBytes(&length, sizeof(length), hash);	// part boundaries count too
+	}
+	return hash;
+}
+
+
+///////////////////////////////////////////////////
+//	ULoadCachedProgram(uint64_t, GLuint&, bool)
+//
+//	key: UHashShaderSource of every part the program is built from
+//	programId: receives the new program
+//	separable: set GL_PROGRAM_SEPARABLE before loading or linking
+//
+//	A hit is a program the driver linked from the stored binary; what it
+//	saved is the stored build time less the time the load took, when the
+//	build time was measured
+///////////////////////////////////////////////////
+bool ULoadCachedProgram(uint64_t key, GLuint& programId, bool separable)
+{
+	Clock::time_point start = Clock::now();
+	programId = glCreateProgram();
+	if (separable)
+		glProgramParameteri(programId, GL_PROGRAM_SEPARABLE, GL_TRUE);
+	if (!gEnabled)
+		return false;
+
+	std::map<uint64_t, CacheEntry>::iterator cached = gEntries.find(key);
+	if (cached != gEntries.end())
+	{
+		const CacheEntry& entry = cached->second;
+		glProgramBinary(programId, entry.binaryFormat, entry.binary.data(), GLsizei(entry.binary.size()));
+
+		GLint linked = 0;
+		glGetProgramiv(programId, GL_LINK_STATUS, &linked);
+		if (linked)
+		{
+			gHits++;
+			if (entry.buildMs >= 0.0)
+				gSavedMs += entry.buildMs - UMillisecondsSince(start);
+			else
+				gUntimedHits++;
+			return true;
+		}
+
+		// the driver changed in a way its version string does not show
+		glDeleteProgram(programId);
+		programId = glCreateProgram();
+		if (separable)
+			glProgramParameteri(programId, GL_PROGRAM_SEPARABLE, GL_TRUE);
+		gEntries.erase(cached);
+		gChanged = true;
+	}
+
+	gMisses++;
+	glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	return false;
+}
+
+
+void UStoreCachedProgram(uint64_t key, GLuint programId, double buildMs)
+{
+	if (!gEnabled)
+		return;
+
+	CacheEntry entry;
+	entry.buildMs = buildMs;
+
+	GLint binaryBytes = 0;
+	glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &binaryBytes);
+	if (binaryBytes <= 0)
+		return;
+
+	entry.binary.resize(binaryBytes);
+	glGetProgramBinary(programId, binaryBytes, &binaryBytes, &entry.binaryFormat, entry.binary.data());
+	entry.binary.resize(binaryBytes);
+
+	gEntries[key] = std::move(entry);
+	gChanged = true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <cstdint>
+
+// Linked shader programs kept on disk as the driver's own binaries
+// (glGetProgramBinary), so later runs skip compiling and linking. Each
+// program is keyed by the hash of its source; the file records which
+// driver wrote it, and a file from another vendor, renderer or driver
+// version is ignored as a whole. A binary the driver rejects falls back to
+// a normal build and is replaced.
+//
+// Usage: hash every source string the program is built from, including
+// inserted headers and defines, then call ULoadCachedProgram. On a miss
+// compile and link the program it created as usual and hand it to
+// UStoreCachedProgram with the time that took.
+
+// Read the cache file; call once the GL context exists. Without program
+// binary support, or when the file is missing, every lookup misses.
+bool UOpenProgramCache(const char* filename);
+
+// Write the cache file if programs were added and log the hits, misses and
+// the build time the hits saved
+void UCloseProgramCache();
+
+// Hash of shader source parts, with the same meaning of lengths as
+// glShaderSource (nullptr or a negative length for a null terminated part)
+uint64_t UHashShaderSource(const char* const* parts, const GLint* lengths, int count, uint64_t seed = 0);
+
+// Creates programId, separable for program pipelines if asked. Returns
+// true when it was linked from the cache; otherwise it is an empty
+// program, set up so its binary can be read back after linking.
+bool ULoadCachedProgram(uint64_t key, GLuint& programId, bool separable = false);
+
+// Save the binary of a program that missed the cache, once it has linked.
+// buildMs is the time the compile and link took, or negative when it could
+// not be measured; a hit on such a program adds nothing to the time saved.
+void UStoreCachedProgram(uint64_t key, GLuint programId, double buildMs);
@@ -0,0 +1,295 @@
+#include "resample.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+namespace
+{
+	// Lobes of the Lanczos window on each side of the center
+	const int LANCZOS_LOBES = 3;
+
+	// Passes touching fewer floats than this are not worth starting threads for
+	const size_t PARALLEL_THRESHOLD = 1 << 16;
+
+	// Entries of the linear to sRGB table, over [0, 1]
+	const int SRGB_TABLE_SIZE = 1 << 14;
+
+	float gSrgbToLinear[256];
+	unsigned char gLinearToSrgb[SRGB_TABLE_SIZE + 1];
+
+	void UInitSrgbTables()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			float c = i / 255.0f;
+			gSrgbToLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i <= SRGB_TABLE_SIZE; i++)
+		{
+			float c = float(i) / SRGB_TABLE_SIZE;
+			c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+			gLinearToSrgb[i] = (unsigned char)std::lround(std::min(std::max(c, 0.0f), 1.0f) * 255.0f);
+		}
+	}
+
+	inline unsigned char UEncodeSrgb(float c)
+	{
+		c = std::min(std::max(c, 0.0f), 1.0f);
+		return gLinearToSrgb[int(c * SRGB_TABLE_SIZE + 0.5f)];
+	}
+
+	inline unsigned char UEncodeUnorm(float c)
+	{
+		c = std::min(std::max(c, 0.0f), 1.0f);
+		return (unsigned char)(c * 255.0f + 0.5f);
+	}
+
+	float ULanczos(float x)
+	{
+		x = std::fabs(x);
+		if (x < 1e-6f)
+			return 1.0f;
+		if (x >= LANCZOS_LOBES)
+			return 0.0f;
+
+		const float pi = 3.14159265358979f;
+		float px = pi * x;
+		return LANCZOS_LOBES * std::sin(px) * std::sin(px / LANCZOS_LOBES) / (px * px);
+	}
+
+	// Weights of every output sample along one axis: output i sums taps
+	// source samples from starts[i], weighted by weights[i * taps ...]
+	struct Kernel
+	{
+		int taps = 0;
+		std::vector<int> starts;
+		std::vector<float> weights;
+	};
+
+	///////////////////////////////////////////////////
+	//	UBuildKernel(int, int, Kernel&)
+	//
+	//	sourceSize: samples along the axis before resizing
+	//	size: samples after
+	//	kernel: receives the weights
+	//
+	//	Samples outside the image repeat the edge, so their weights are
+	//	folded onto the edge sample and every window lies inside the image
+	///////////////////////////////////////////////////
+	void UBuildKernel(int sourceSize, int size, Kernel& kernel)
+	{
+		const float scale = float(sourceSize) / float(size);
+		const float filterScale = std::max(1.0f, scale);
+		const float support = LANCZOS_LOBES * filterScale;
+
+		kernel.taps = std::min(sourceSize, int(std::ceil(2.0f * support)) + 1);
+		kernel.starts.resize(size);
+		kernel.weights.assign(size_t(size) * kernel.taps, 0.0f);
+
+		std::vector<float> folded(sourceSize);
+		for (int i = 0; i < size; i++)
+		{
+			const float center = (i + 0.5f) * scale;
+			const int first = int(std::floor(center - support));
+			const int last = int(std::ceil(center + support));
+
+			std::fill(folded.begin(), folded.end(), 0.0f);
+			float sum = 0.0f;
+			for (int j = first; j <= last; j++)
+			{
+				float weight = ULanczos((j + 0.5f - center) / filterScale);
+				folded[std::min(std::max(j, 0), sourceSize - 1)] += weight;
+				sum += weight;
+			}
+
+			int start = std::min(std::max(first, 0), sourceSize - kernel.taps);
+			kernel.starts[i] = start;
+			float* weights = &kernel.weights[size_t(i) * kernel.taps];
+			for (int t = 0; t < kernel.taps; t++)
+				weights[t] = folded[start + t] / sum;
+		}
+	}
+
+	// Run fn(begin, end) over [0, count), split across hardware threads for large inputs
+	template <typename Fn>
+	void UParallelFor(size_t count, size_t itemsPerUnit, Fn fn)
+	{
+		unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+		if (count * itemsPerUnit < PARALLEL_THRESHOLD || threads == 1)
+		{
+			fn(size_t(0), count);
+			return;
+		}
+
+		std::vector<std::thread> workers;
+		size_t chunk = (count + threads - 1) / threads;
+		for (size_t begin = 0; begin < count; begin += chunk)
+			workers.emplace_back(fn, begin, std::min(count, begin + chunk));
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	///////////////////////////////////////////////////
+	//	UFilterRows(const std::vector<float>&, size_t, const Kernel&, std::vector<float>&)
+	//
+	//	source: rows of rowFloats floats
+	//	rowFloats: floats per row
+	//	kernel: weights from source rows to output rows
+	//	filtered: receives kernel.starts.size() rows
+	//
+	//	Every output row is a weighted sum of whole source rows, so the
+	//	inner loop runs along the row eight floats at a time
+	///////////////////////////////////////////////////
+	void UFilterRows(const std::vector<float>& source, size_t rowFloats, const Kernel& kernel,
+		std::vector<float>& filtered)
+	{
+		const size_t rows = kernel.starts.size();
+		filtered.resize(rows * rowFloats);
+
+		UParallelFor(rows, rowFloats * kernel.taps, [&](size_t begin, size_t end) {
+			for (size_t row = begin; row < end; row++)
+			{
+				const float* in = &source[size_t(kernel.starts[row]) * rowFloats];
+				const float* weights = &kernel.weights[row * kernel.taps];
+				float* out = &filtered[row * rowFloats];
+
+				size_t x = 0;
+#if defined(__AVX2__)
+				for (; x + 8 <= rowFloats; x += 8)
+				{
+					__m256 sum = _mm256_setzero_ps();
+					for (int t = 0; t < kernel.taps; t++)
+					{
+						__m256 texels = _mm256_loadu_ps(in + t * rowFloats + x);
+						sum = _mm256_add_ps(sum, _mm256_mul_ps(texels, _mm256_set1_ps(weights[t])));
+					}
+					_mm256_storeu_ps(out + x, sum);
+				}
+#endif
+				for (; x < rowFloats; x++)
+				{
+					float sum = 0.0f;
+					for (int t = 0; t < kernel.taps; t++)
+						sum += in[t * rowFloats + x] * weights[t];
+					out[x] = sum;
+				}
+			}
+		});
+	}
+
+	// Swap rows and columns of a rows x columns image of channels floats per pixel
+	void UTranspose(const std::vector<float>& source, int rows, int columns, int channels,
+		std::vector<float>& transposed)
+	{
+		transposed.resize(source.size());
+		UParallelFor(size_t(columns), size_t(rows) * channels, [&](size_t begin, size_t end) {
+			for (size_t column = begin; column < end; column++)
+			{
+				float* out = &transposed[column * rows * channels];
+				for (int row = 0; row < rows; row++)
+				{
+					const float* in = &source[(size_t(row) * columns + column) * channels];
+					for (int c = 0; c < channels; c++)
+						out[row * channels + c] = in[c];
+				}
+			}
+		});
+	}
+}
+
+
+///////////////////////////////////////////////////
+//	UResampleImage(const Image&, int, int, Image&)
+//
+//	image: decoded image
+//	width, height: size of the result
+//	resized: receives the new image, same channels and row order
+//
+//	The columns are filtered first, then the image is transposed so the
+//	rows can be filtered the same way, and transposed back while the
+//	result is encoded to bytes
+///////////////////////////////////////////////////
+bool UResampleImage(const Image& image, int width, int height, Image& resized)
+{
+	static bool tablesReady = (UInitSrgbTables(), true);
+	(void)tablesReady;
+
+	if (!image.pixels || image.channels < 1 || image.channels > 4 || width < 1 || height < 1)
+		return false;
+
+	const int channels = image.channels;
+	const int colorChannels = channels >= 3 ? 3 : 0;	// masks are not sRGB encoded
+	const size_t sourceRow = size_t(image.width) * channels;
+
+	std::vector<float> linear(sourceRow * image.height);
+	UParallelFor(size_t(image.height), sourceRow, [&](size_t begin, size_t end) {
+		for (size_t i = begin * sourceRow; i < end * sourceRow; i += channels)
+		{
+			for (int c = 0; c < channels; c++)
+			{
+				unsigned char value = image.pixels[i + c];
+				linear[i + c] = c < colorChannels ? gSrgbToLinear[value] : value / 255.0f;
+			}
+		}
+	});
+
+	Kernel columnKernel, rowKernel;
+	UBuildKernel(image.height, height, columnKernel);
+	UBuildKernel(image.width, width, rowKernel);
+
+	std::vector<float> columns, transposed, rows;
+	UFilterRows(linear, sourceRow, columnKernel, columns);
+	linear = std::vector<float>();
+	UTranspose(columns, height, image.width, channels, transposed);
+	UFilterRows(transposed, size_t(height) * channels, rowKernel, rows);
+
+	// rows is width x height; transpose back while encoding
+	unsigned char* pixels = (unsigned char*)std::malloc(size_t(width) * height * channels);
+	if (!pixels)
+		return false;
+
+	UParallelFor(size_t(height), size_t(width) * channels, [&](size_t begin, size_t end) {
+		for (size_t y = begin; y < end; y++)
+		{
+			unsigned char* out = pixels + y * width * channels;
+			for (int x = 0; x < width; x++)
+			{
+				const float* in = &rows[(size_t(x) * height + y) * channels];
+				for (int c = 0; c < channels; c++)
+					out[x * channels + c] = c < colorChannels ? UEncodeSrgb(in[c]) : UEncodeUnorm(in[c]);
+			}
+		}
+	});
+
+	resized.width = width;
+	resized.height = height;
+	resized.channels = channels;
+	resized.pixels = pixels;
+	return true;
+}
+
+
+bool ULimitImageSize(Image& image, int maxSize)
+{
+	const int size = std::max(image.width, image.height);
+	if (maxSize <= 0 || size <= maxSize)
+		return false;
+
+	const float scale = float(maxSize) / float(size);
+	Image resized;
+	if (!UResampleImage(image, std::max(1, int(std::lround(image.width * scale))),
+		std::max(1, int(std::lround(image.height * scale))), resized))
+		return false;
+
+	UFreeImage(image);
+	image = resized;
+	return true;
+}
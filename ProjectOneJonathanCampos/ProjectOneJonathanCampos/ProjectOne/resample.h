@@ -0,0 +1,17 @@
+#pragma once
+
+
+#include "texture.h"
+
+// Resize an image with a Lanczos-3 filter, widened by the reduction when
+// downsizing so no detail aliases. Three and four channel images are
+// filtered in linear light (alpha as is); masks are filtered as stored.
+// Rows are shared out between hardware threads. The pixels of the result
+// are released with UFreeImage like decoded ones. Safe to call from any
+// thread.
+bool UResampleImage(const Image& image, int width, int height, Image& resized);
+
+// Shrink image in place so its longest side is at most maxSize, keeping
+// the aspect ratio. Smaller images and a maxSize of 0 leave it alone.
+// Returns true when the image was resized.
+bool ULimitImageSize(Image& image, int maxSize);
@@ -0,0 +1,29 @@
+#include "scene.h"
+
+
+///////////////////////////////////////////////////
+//	Add(const SceneObject&)
+//
+//	object: object to append
+//
+//	Returns the index of the new object
+///////////////////////////////////////////////////
+size_t Scene::Add(const SceneObject& object)
+{
+	mObjects.push_back(object);
+	mRevisions.push_back(mNextRevision++);
+	return mObjects.size() - 1;
+}
+
+void Scene::Clear()
+{
+	mObjects.clear();
+	mRevisions.clear();
+}
+
+// Revisions are unique across the scene, so a removed and re-added object never looks unchanged
+SceneObject& Scene::Edit(size_t i)
+{
+	mRevisions[i] = mNextRevision++;
+	return mObjects[i];
+}
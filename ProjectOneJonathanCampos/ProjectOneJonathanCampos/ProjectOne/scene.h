@@ -0,0 +1,49 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mesh.h"
+
+// One drawable object of the scene. Meshes are drawn as triangle lists:
+// indexed when nIndices > 0, with glDrawArrays otherwise.
+struct SceneObject
+{
+	const char* name;
+	const Meshes::GLMesh* mesh;	// nullptr for meshes streamed from a file
+	size_t meshFile;		// MeshStreamer handle, used when mesh is nullptr
+	GLuint programId;		// shader program
+	size_t texture;			// MaterialPacker handle, MaterialPacker::INVALID_HANDLE for none
+	glm::vec4 objectColor;
+	glm::mat4 model;
+	bool isStatic;			// static objects never move and may be merged by StaticBatcher
+};
+
+// Flat list of scene objects. Every edit goes through Edit() so that
+// anything derived from an object (such as a static batch) can tell it
+// is out of date by comparing revisions.
+class Scene
+{
+public:
+	size_t Add(const SceneObject& object);
+	void Clear();
+
+	size_t Size() const { return mObjects.size(); }
+	const SceneObject& Object(size_t i) const { return mObjects[i]; }
+
+	// Returns the object for modification and bumps its revision
+	SceneObject& Edit(size_t i);
+
+	uint64_t Revision(size_t i) const { return mRevisions[i]; }
+
+private:
+	std::vector<SceneObject> mObjects;
+	std::vector<uint64_t> mRevisions;
+	uint64_t mNextRevision = 1;
+};
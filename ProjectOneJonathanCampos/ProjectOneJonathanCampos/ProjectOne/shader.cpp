@@ -0,0 +1,258 @@
+#include "shader.h"
+#include "programcache.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	double UMillisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	// One stage linked into its own program, through the program cache
+	bool UCreateSingleStageProgram(GLenum type, const char* label, const char* shaderSource, GLuint& programId)
+	{
+		// Compilation and linkage error reporting
+		int success = 0;
+		char infoLog[512];
+
+		const uint64_t key = UHashShaderSource(&shaderSource, nullptr, 1);
+		if (ULoadCachedProgram(key, programId))
+			return true;
+
+		// reading the statuses waits for the build, so it is all timed here
+		Clock::time_point start = Clock::now();
+		GLuint shaderId = glCreateShader(type);
+		glShaderSource(shaderId, 1, &shaderSource, NULL);
+
+		glCompileShader(shaderId);
+		glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(shaderId, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::SHADER::" << label << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+
+			glDeleteShader(shaderId);
+			glDeleteProgram(programId);
+			programId = 0;
+			return false;
+		}
+
+		glAttachShader(programId, shaderId);
+		glLinkProgram(programId);
+
+		// the shader object is no longer needed once the program is linked
+		glDetachShader(programId, shaderId);
+		glDeleteShader(shaderId);
+
+		glGetProgramiv(programId, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+
+			glDeleteProgram(programId);
+			programId = 0;
+			return false;
+		}
+
+		UStoreCachedProgram(key, programId, UMillisecondsSince(start));
+		return true;
+	}
+}
+
+
+///////////////////////////////////////////////////
+//	UCreateComputeProgram(const char*, GLuint&)
+//
+//	computeShaderSource: GLSL source of the compute stage
+//	programId: receives the linked program
+//
+//	Compile and link a compute-only shader program, or load it from the
+//	program cache
+///////////////////////////////////////////////////
+bool UCreateComputeProgram(const char* computeShaderSource, GLuint& programId)
+{
+	return UCreateSingleStageProgram(GL_COMPUTE_SHADER, "COMPUTE", computeShaderSource, programId);
+}
+
+
+bool UCreateVertexProgram(const char* vtxShaderSource, GLuint& programId)
+{
+	return UCreateSingleStageProgram(GL_VERTEX_SHADER, "VERTEX", vtxShaderSource, programId);
+}
+
+
+///////////////////////////////////////////////////
+//	UBeginShaderProgram(const char*, const char*, const char*, ShaderBuild&)
+//
+//	vtxShaderSource: GLSL source of the vertex stage
+//	fragShaderSource: GLSL source of the fragment stage
+//	fragHeader: extensions, defines or functions for the fragment stage
+//	build: receives the program and its shaders
+//
+//	Linking right after compiling is allowed without checking the compile
+//	status; a failed compile shows up as a failed link
+///////////////////////////////////////////////////
+void UBeginShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, const char* fragHeader, ShaderBuild& build)
+{
+	build = ShaderBuild();
+
+	// The header goes right after the fragment shader's #version line
+	const char* versionEnd = strchr(fragShaderSource, '\n');
+	const GLchar* fragmentParts[] = { fragShaderSource, fragHeader, versionEnd ? versionEnd + 1 : "" };
+	const GLint fragmentLengths[] = { versionEnd ? GLint(versionEnd + 1 - fragShaderSource) : -1, -1, -1 };
+
+	build.cacheKey = UHashShaderSource(fragmentParts, fragmentLengths, 3, UHashShaderSource(&vtxShaderSource, nullptr, 1));
+	if (ULoadCachedProgram(build.cacheKey, build.programId))
+	{
+		build.linked = true;
+		return;
+	}
+
+	Clock::time_point start = Clock::now();
+	build.vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
+	build.fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(build.vertexShaderId, 1, &vtxShaderSource, NULL);
+	glShaderSource(build.fragmentShaderId, 3, fragmentParts, fragmentLengths);
+	glCompileShader(build.vertexShaderId);
+	glCompileShader(build.fragmentShaderId);
+
+	glAttachShader(build.programId, build.vertexShaderId);
+	glAttachShader(build.programId, build.fragmentShaderId);
+	glLinkProgram(build.programId);
+	build.pending = true;
+	build.buildMs = UMillisecondsSince(start);
+}
+
+
+///////////////////////////////////////////////////
+//	UBeginSeparableProgram(GLenum, const char*, const char*, ShaderBuild&)
+//
+//	type: GL_VERTEX_SHADER or GL_FRAGMENT_SHADER
+//	shaderSource: GLSL source of the stage
+//	header: extensions, defines or functions for the stage, or nullptr
+//	build: receives the program and its shader
+//
+//	The type seeds the cache key, so a separable stage never loads the
+//	binary of a whole program built from the same source
+///////////////////////////////////////////////////
+void UBeginSeparableProgram(GLenum type, const char* shaderSource, const char* header, ShaderBuild& build)
+{
+	build = ShaderBuild();
+
+	// The header goes right after the #version line
+	const char* versionEnd = strchr(shaderSource, '\n');
+	const GLchar* parts[] = { shaderSource, header ? header : "", versionEnd ? versionEnd + 1 : "" };
+	const GLint lengths[] = { versionEnd ? GLint(versionEnd + 1 - shaderSource) : -1, -1, -1 };
+
+	build.cacheKey = UHashShaderSource(parts, lengths, 3, type);
+	if (ULoadCachedProgram(build.cacheKey, build.programId, true))
+	{
+		build.linked = true;
+		return;
+	}
+
+	Clock::time_point start = Clock::now();
+	GLuint shaderId = glCreateShader(type);
+	if (type == GL_VERTEX_SHADER)
+		build.vertexShaderId = shaderId;
+	else
+		build.fragmentShaderId = shaderId;
+	glShaderSource(shaderId, 3, parts, lengths);
+	glCompileShader(shaderId);
+
+	glAttachShader(build.programId, shaderId);
+	glLinkProgram(build.programId);
+	build.pending = true;
+	build.buildMs = UMillisecondsSince(start);
+}
+
+
+///////////////////////////////////////////////////
+//	UEndShaderProgram(ShaderBuild&, bool)
+//
+//	build: a build from UBeginShaderProgram or UBeginSeparableProgram
+//	wait: block until the driver is done
+//
+//	Without KHR_parallel_shader_compile the driver builds inside the
+//	compile, link and status calls, so their time is the build time. With
+//	it the build runs on the driver's threads alongside other work and is
+//	not measured.
+///////////////////////////////////////////////////
+bool UEndShaderProgram(ShaderBuild& build, bool wait)
+{
+	if (!build.pending)
+		return true;
+
+	if (!wait && GLEW_KHR_parallel_shader_compile)
+	{
+		GLint complete = GL_FALSE;
+		glGetProgramiv(build.programId, GL_COMPLETION_STATUS_KHR, &complete);
+		if (!complete)
+			return false;
+	}
+
+	// Compilation and linkage error reporting
+	int success = 0;
+	char infoLog[512];
+
+	Clock::time_point start = Clock::now();
+	glGetProgramiv(build.programId, GL_LINK_STATUS, &success);
+	build.linked = success != 0;
+	if (GLEW_KHR_parallel_shader_compile)
+		build.buildMs = -1.0;
+	else
+		build.buildMs += UMillisecondsSince(start);
+	if (!build.linked)
+	{
+		// a separable program has only one of the stages
+		success = 1;
+		if (build.vertexShaderId != 0)
+			glGetShaderiv(build.vertexShaderId, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(build.vertexShaderId, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+		}
+		success = 1;
+		if (build.fragmentShaderId != 0)
+			glGetShaderiv(build.fragmentShaderId, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(build.fragmentShaderId, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+		}
+		glGetProgramInfoLog(build.programId, sizeof(infoLog), NULL, infoLog);
+		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+	}
+
+	// the shader objects are no longer needed once the program is linked
+	if (build.vertexShaderId != 0)
+		glDetachShader(build.programId, build.vertexShaderId);
+	if (build.fragmentShaderId != 0)
+		glDetachShader(build.programId, build.fragmentShaderId);
+	glDeleteShader(build.vertexShaderId);
+	glDeleteShader(build.fragmentShaderId);
+	build.vertexShaderId = build.fragmentShaderId = 0;
+	build.pending = false;
+
+	if (build.linked)
+		UStoreCachedProgram(build.cacheKey, build.programId, build.buildMs);
+	return true;
+}
+
+
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, const char* fragHeader, GLuint& programId)
+{
+	ShaderBuild build;
+	UBeginShaderProgram(vtxShaderSource, fragShaderSource, fragHeader, build);
+	UEndShaderProgram(build, true);
+	programId = build.programId;
+	return build.linked;
+}
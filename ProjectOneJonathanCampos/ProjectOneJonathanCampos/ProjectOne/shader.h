@@ -0,0 +1,50 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <cstdint>
+
+/*Shader program Macro*/
+#ifndef GLSL
+#define GLSL(Version, Source) "#version " #Version " core \n" #Source
+#endif
+
+// A vertex and fragment program the driver may still be compiling
+struct ShaderBuild
+{
+	GLuint programId = 0;
+	GLuint vertexShaderId = 0;
+	GLuint fragmentShaderId = 0;
+	uint64_t cacheKey = 0;
+	double buildMs = 0.0;		// compile and link time, negative when the driver built in the background
+	bool pending = false;		// submitted, status not read yet
+	bool linked = false;
+};
+
+// Submit the compile and link of a program without reading their status,
+// so with KHR_parallel_shader_compile they run on the driver's threads.
+// fragHeader is inserted right after the fragment shader's #version line.
+// A program found in the program cache is linked straight away.
+void UBeginShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, const char* fragHeader, ShaderBuild& build);
+
+// Submit the compile and link of one stage (GL_VERTEX_SHADER or
+// GL_FRAGMENT_SHADER) as a separable program, to be combined with the
+// other stage in a program pipeline. header is inserted right after the
+// #version line. Read the result with UEndShaderProgram.
+void UBeginSeparableProgram(GLenum type, const char* shaderSource, const char* header, ShaderBuild& build);
+
+// Read the result of a build: logs errors, frees the shaders and stores a
+// linked program in the program cache. Unless wait is set it returns false
+// while the driver is still busy; without KHR_parallel_shader_compile the
+// status can only be read by waiting.
+bool UEndShaderProgram(ShaderBuild& build, bool wait);
+
+// Compile and link a vertex and fragment shader, waiting for the result
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, const char* fragHeader, GLuint& programId);
+
+// Compile and link a compute shader into its own program
+bool UCreateComputeProgram(const char* computeShaderSource, GLuint& programId);
+
+// Compile and link a vertex shader without a fragment stage, for depth-only passes
+bool UCreateVertexProgram(const char* vtxShaderSource, GLuint& programId);
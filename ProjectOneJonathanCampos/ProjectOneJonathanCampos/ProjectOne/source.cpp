@@ -1,4 +1,6 @@
 #include <iostream>
+#include <cstring>
+#include <random>
 #include <GLEW/include/GL/glew.h>
 #include <GLFW/glfw3.h>     // GLFW library
 
@@ -6,11 +8,29 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/color_space.hpp>
 
 #include "camera.h" //camera class
 #include "mesh.h"
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h" //image loading util 
+#include "meshfile.h"
+#include "meshgen.h"
+#include "scene.h"
+#include "batch.h"
+#include "culling.h"
+#include "deferred.h"
+#include "geometry.h"
+#include "imagedecoder.h"
+#include "jpegdecoder.h"
+#include "lighting.h"
+#include "material.h"
+#include "permutation.h"
+#include "postprocess.h"
+#include "prepass.h"
+#include "programcache.h"
+#include "streamer.h"
+#include "texstream.h"
+#include "texture.h"
+#include "transform.h"
 
 
 using namespace std; // Standard namespace
@@ -20,6 +40,11 @@ using namespace std; // Standard namespace
 #define GLSL(Version, Source) "#version " #Version " core \n" #Source
 #endif
 
+/*Shader library Macro: GLSL without a #version line, inserted into other shaders*/
+#ifndef GLSL_LIBRARY
+#define GLSL_LIBRARY(Source) #Source
+#endif
+
 // Unnamed namespace
 namespace
 {
@@ -33,11 +58,99 @@ namespace
     // Main GLFW window
     GLFWwindow* gWindow = nullptr;
 
-    // Shader program
-    GLuint gProgramId;
+    // Variants of the scene shader, built for the features the objects need
+    ShaderPermutations gShaderPermutations;
+
+    // Lights the scene from a G-buffer instead of while drawing it, toggled with G
+    DeferredRenderer gDeferredRenderer;
+    bool gDeferred = false;
+    bool gDeferredKeyDown = false;
+
+    // Point light counts and layers of full-screen overdraw in --benchmark-shading
+    const int BENCHMARK_LIGHT_COUNTS[] = { 0, 64, 256, 1024 };
+    const int BENCHMARK_OVERDRAWS[] = { 1, 4, 16 };
+    const int BENCHMARK_FRAMES = 10;
+
+    // Light counts of the variants built in --benchmark-pipelines, and its draws switching between them
+    const int BENCHMARK_VARIANT_LIGHT_COUNTS[] = { 1, 2, 4, 8 };
+    const int BENCHMARK_SWITCH_DRAWS = 4096;
+
+    // Lights of the scene, in the order of the shader's light arrays
+    const int LIGHT_COUNT = 2;
+    const glm::vec3 LIGHT_POSITIONS[LIGHT_COUNT] = { glm::vec3(-15.0f, 2.5f, -10.0f), glm::vec3(15.0f, 20.0f, -15.0f) };
+    // Colors are picked in sRGB, like the textures, and converted to the linear
+    // values the shaders light with (the framebuffer encodes back to sRGB)
+    const glm::vec3 LIGHT_COLORS[LIGHT_COUNT] = { glm::convertSRGBToLinear(glm::vec3(1.0f, 0.95f, 0.85f)),
+        glm::convertSRGBToLinear(glm::vec3(1.0f, 0.95f, 0.85f)) }; // slightly warm white color
+    const float SPECULAR_INTENSITIES[LIGHT_COUNT] = { 1.0f, 1.0f };
+    const float HIGHLIGHT_SIZES[LIGHT_COUNT] = { 25.0f, 50.0f };
+
+    // Small lights that only reach part of the desk, shaded per cluster of the view
+    std::vector<PointLight> gPointLights;
+    LightClusterer gLightClusterer;
+    const int LED_STRIP_LIGHTS = 128;
 
     Meshes meshes;
 
+    // Compute-shader mesh generator
+    MeshGenerator gMeshGenerator;
+
+    // Objects on the desk, and the merged meshes of the static ones
+    Scene gScene;
+    StaticBatcher gStaticBatcher;
+
+    // Frustum culling of the batched objects on the GPU
+    GpuCuller gGpuCuller;
+
+    // Lays down the depth of the visible surfaces before shading them, when they overlap enough
+    DepthPrepass gDepthPrepass;
+
+    // Draws the frame into an HDR target, then tonemaps, anti-aliases and dithers it
+    // in one compute pass; --no-post-process draws straight to the window instead
+    PostProcessor gPostProcessor;
+    bool gPostProcess = true;
+    const float EXPOSURE = 1.0f;
+
+    // Per-object matrices for the vertex shader, and the model and mesh each
+    // object is drawn with this frame (nullptr: batched or not drawn)
+    TransformStage gTransformStage;
+    std::vector<glm::mat4> gDrawModels;
+    std::vector<const Meshes::GLMesh*> gDrawMeshes;
+
+    // Meshes loaded from files given on the command line, kept under a GPU budget
+    MeshStreamer gMeshStreamer;
+    const uint64_t MESH_BUDGET_BYTES = 64ull * 1024 * 1024;
+    const float NEAR_PLANE = 0.1f;
+    const float FAR_PLANE = 100.0f;
+    const float PREFETCH_DISTANCE = 1.25f * FAR_PLANE;
+
+    // Decodes the textures in the background at startup
+    TextureLoader gTextureLoader;
+
+    // Streams the mips of textures that have a cache file as the view needs them,
+    // freeing the mips of the least recently seen ones to stay under a budget
+    TextureStreamer gTextureStreamer;
+    const uint64_t TEXTURE_BUDGET_BYTES = 128ull * 1024 * 1024;
+
+    // Longest side each class of texture is resampled down to when loaded:
+    // the desk can fill the window, the objects on it only cover part of it
+    const int SURFACE_TEXTURE_SIZE = 2048;
+    const int OBJECT_TEXTURE_SIZE = 1024;
+
+    // Decodes of each image per decoder and scale in --benchmark-decoders
+    const int DECODER_BENCHMARK_REPEATS = 5;
+
+    // Torus resolutions (segments around the ring) written by --bake-meshes,
+    // from a light mesh to one that needs most of MESH_BUDGET_BYTES
+    const int BAKED_TORUS_SEGMENTS[] = { 64, 256, 1024 };
+
+    // Linked shader programs from earlier runs (see programcache.h)
+    const char* const PROGRAM_CACHE_FILE = "shaders.programcache";
+
+    // Texture array pages shared by the objects, so batches are not split by texture
+    MaterialPacker gMaterialPacker;
+    GLuint gBoundTextures[2];   // texture on unit 0 and page on unit 1, to skip repeated binds
+
     //Texture ID
     GLuint gWoodTexture;
     GLuint gCashewTexture;
@@ -59,6 +172,7 @@ namespace
     // timing
     float gDeltaTime = 0.0f; // time between current frame and last frame
     float gLastFrame = 0.0f;
+    bool gFirstFrame = true;
 
 }
 
@@ -69,12 +183,138 @@ void UProcessInput(GLFWwindow* window);
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
-bool UCreateTexture(const char* filename, GLuint& textureId);
-void UDestroyTexture(GLuint textureId);
+void URequestTexture(const char* filename, GLuint& textureId, const TextureOptions& options);
+void UCreateScene();
+void UCreateLights();
+bool UBakeMeshFiles();
+void UAddMeshFiles(int argc, char* argv[]);
+ShaderFeatures UObjectFeatures(const SceneObject& object);
+bool UAssignPrograms();
+float UStreamDistance(const SceneObject& object);
+void USetTextureFeedback(GLuint programId, GLuint textureId, GLint slotLoc, GLint sizeLoc);
+void USetFrameUniforms(GLuint programId, const glm::mat4& view);
+void USetDrawUniforms(GLuint programId, GLuint textureId, const glm::vec4& objectColor);
+void UBindTexture(GLuint textureId);
 void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
-void UDestroyShaderProgram(GLuint programId);
+void UBenchmarkShading();
+void UBenchmarkPipelines(const char* fragmentHeader);
+
+
+/* Fragment shader headers: how sampleBindless() reaches a texture through its handle.
+   Inserted after the feature defines of the fragment shader (see MaterialPacker). */
+const GLchar* bindlessShaderHeader =
+    "#extension GL_ARB_bindless_texture : require\n"
+    "vec4 sampleBindless(uvec2 handle, vec2 uv) { return texture(sampler2D(handle), uv); }\n";
+const GLchar* boundShaderHeader =
+    "vec4 sampleBindless(uvec2 handle, vec2 uv) { return vec4(1.0f); }\n";
+
+/* Lighting Library Source Code*/
+// Shared by the scene shader and the deferred lighting pass, after the feature
+// defines so it sees LIGHT_COUNT and SPECULAR; both paths light a pixel the same way
+const GLchar* lightingShaderSource = GLSL_LIBRARY(
+
+//Uniform or global variables for the lights and camera/view position
+uniform vec3 lightColors[LIGHT_COUNT];
+uniform vec3 lightPositions[LIGHT_COUNT];
+uniform float specularIntensities[LIGHT_COUNT];
+uniform float highlightSizes[LIGHT_COUNT];
+
+uniform vec3 viewPosition;
+uniform vec3 viewDirection; // towards the viewer, for orthographic views
+uniform float ambientStrength = 0.2f;
+
+// Point lights, listed per cluster of the view frustum (see LightClusterer)
+struct PointLight
+{
+    vec4 positionRange;  // world space position, and the distance the light reaches
+    vec4 colorIntensity;
+};
+layout(std430, binding = 6) readonly buffer PointLights
+{
+    PointLight pointLights[];
+};
+layout(std430, binding = 7) readonly buffer LightClusters
+{
+    uvec4 clusterSize;       // tiles across, tiles down, depth slices, tile size in pixels
+    vec4 clusterDepthPlane;  // view depth of a world space position
+    vec4 clusterSlicing;     // depth slice: log(depth) * x + y
+    uvec2 clusterLights[];   // first index and count of each cluster's lights
+};
+layout(std430, binding = 8) readonly buffer LightIndices
+{
+    uint lightIndices[];
+};
+
+// Octahedral normal in [0, 1], for a two channel G-buffer target
+vec2 encodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 folded = n.z >= 0.0f ? n.xy : (1.0f - abs(n.yx)) * mix(vec2(-1.0f), vec2(1.0f), step(0.0f, n.xy));
+    return folded * 0.5f + 0.5f;
+}
+
+vec3 decodeNormal(vec2 encoded)
+{
+    encoded = encoded * 2.0f - 1.0f;
+    vec3 n = vec3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+    float fold = max(-n.z, 0.0f);
+    n.xy += mix(vec2(fold), vec2(-fold), step(0.0f, n.xy));
+    return normalize(n);
+}
+
+// Phong result of every light at a world position, to multiply with the
+// base color. specular scales the highlights.
+vec3 shadePhong(vec3 position, vec3 norm, vec3 viewDir, float specular)
+{
+    /*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
+
+    //Calculate Ambient lighting*/
+    vec3 ambient = ambientStrength * lightColors[0]; // Generate ambient light color.
 
+    // Each light adds its own Phong result, ambient included
+    vec3 phong = vec3(0.0f);
+    for (int i = 0; i < LIGHT_COUNT; i++)
+    {
+        //Calculate Diffuse lighting*/
+        vec3 lightDirection = normalize(lightPositions[i] - position); // Calculate distance (light direction) between light source and fragments/pixels.
+        float impact = max(dot(norm, lightDirection), 0.0); // Calculate diffuse impact by generating dot product of normal and light.
+        phong += ambient + impact * lightColors[i];
+
+        //Calculate Specular lighting*/
+        if (SPECULAR == 1)
+        {
+            vec3 reflectDir = reflect(-lightDirection, norm); // Calculate reflection vector.
+            float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSizes[i]);
+            phong += specular * specularIntensities[i] * specularComponent * lightColors[i];
+        }
+    }
+
+    // Point lights: only the ones that reach this pixel's cluster
+    float depth = dot(clusterDepthPlane, vec4(position, 1.0f));
+    uvec2 tile = min(uvec2(gl_FragCoord.xy) / clusterSize.w, clusterSize.xy - 1u);
+    uint slice = uint(clamp(log(depth) * clusterSlicing.x + clusterSlicing.y, 0.0f, float(clusterSize.z - 1u)));
+    uvec2 lightRange = clusterLights[(slice * clusterSize.y + tile.y) * clusterSize.x + tile.x];
+    for (uint k = 0u; k < lightRange.y; k++)
+    {
+        PointLight light = pointLights[lightIndices[lightRange.x + k]];
+        vec3 toLight = light.positionRange.xyz - position;
+        float distance = length(toLight);
+
+        // Inverse square falloff, windowed to reach zero at the light's range
+        float window = clamp(1.0f - pow(distance / light.positionRange.w, 4.0f), 0.0f, 1.0f);
+        vec3 radiance = light.colorIntensity.rgb * light.colorIntensity.w * window * window / (distance * distance + 1.0f);
+
+        vec3 lightDirection = toLight / max(distance, 0.0001f);
+        phong += max(dot(norm, lightDirection), 0.0) * radiance;
+        if (SPECULAR == 1)
+        {
+            vec3 reflectDir = reflect(-lightDirection, norm);
+            phong += specular * pow(max(dot(viewDir, reflectDir), 0.0), highlightSizes[0]) * radiance;
+        }
+    }
+    return phong;
+}
+);
 
 /* Vertex Shader Source Code*/
 const GLchar* vertexShaderSource = GLSL(440,
@@ -82,201 +322,318 @@ const GLchar* vertexShaderSource = GLSL(440,
     layout(location = 0) in vec3 position; // Vertex data from Vertex Attrib Pointer 0
 layout(location = 1) in vec3 normal; //VAP position 1 for normal
 layout(location = 2) in vec2 textureCoordinate;
+layout(location = 3) in uint objectIndex; // scene index of the object, for its material
 
-out vec3 vertexNormal; // For outgoing normals to fragment shader
-out vec2 vertexTextureCoordinate;
-out vec3 vertexFragmentPos; // For outgoing color or pixels to fragment shader
-out vec3 vertexColor;
+// Explicit locations, so the stages match when linked apart (program pipelines)
+layout(location = 0) out vec3 vertexNormal; // For outgoing normals to fragment shader
+layout(location = 1) out vec2 vertexTextureCoordinate;
+layout(location = 2) out vec3 vertexFragmentPos; // For outgoing color or pixels to fragment shader
+layout(location = 3) out vec3 vertexColor;
+layout(location = 4) flat out uint vertexObject;
 
 
-//Global variables for the  transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+//Transform matrices of each object for this frame, by scene index (see TransformStage)
+struct ObjectTransform
+{
+    mat4 mvp;       // object to clip space
+    mat4 model;     // object to world space
+    mat3x4 normal;  // inverse transpose of the model's upper 3x3
+};
+layout(std430, binding = 5) readonly buffer Transforms
+{
+    ObjectTransform transforms[];
+};
+
+// Redeclared for the separable vertex stage of program pipelines (see ShaderPermutations)
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+// The depth pre-pass computes gl_Position the same way, so its depth compares equal
+invariant gl_Position;
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f); // transforms vertices to clip coordinates
+    ObjectTransform transform = transforms[objectIndex];
+    gl_Position = transform.mvp * vec4(position, 1.0f); // transforms vertices to clip coordinates
 
     vertexTextureCoordinate = textureCoordinate.xy;
+    vertexObject = objectIndex;
 
-    vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment or pixel position in world space only (excludes view and projection)
+    vertexFragmentPos = vec3(transform.model * vec4(position, 1.0f)); // Gets fragment or pixel position in world space only (excludes view and projection)
 
-    vertexNormal = mat3(transpose(inverse(model))) * normal; // Gets normal vectors in world space only and excludes normal translation properties
+    vertexNormal = mat3(transform.normal) * normal; // Gets normal vectors in world space only and excludes normal translation properties
 
 
 }
 );
 
 /* Fragment Shader Source Code*/
+// Built in variants (see ShaderPermutations): TEXTURED, LIGHT_COUNT, SPECULAR, ORTHO
+// and DEFERRED are #defined ahead of it, and every branch on them is resolved at compile time
 const GLchar* fragmentShaderSource = GLSL(440,
 
-    in vec3 vertexNormal; // For incoming normals
-in vec3 vertexFragmentPos; // For incoming fragment position
-in vec2 vertexTextureCoordinate;
+    layout(location = 0) in vec3 vertexNormal; // For incoming normals
+layout(location = 2) in vec3 vertexFragmentPos; // For incoming fragment position
+layout(location = 1) in vec2 vertexTextureCoordinate;
+layout(location = 4) flat in uint vertexObject;
 
+// The mip feedback store would otherwise move the depth test after the shader
+layout(early_fragment_tests) in;
 
-out vec4 fragmentColor; // For ongoing color to gpu
 
-//Uniform or global variables for object color, light color, light position, and camera/view position
+layout(location = 0) out vec4 fragmentColor; // For ongoing color to gpu, or albedo and specular into the G-buffer
+layout(location = 1) out vec2 fragmentNormal; // G-buffer normal, DEFERRED variants only
 
-uniform vec3 objectColor;
-uniform vec3 ambientColor;
-uniform vec3 lightColor1;
-uniform vec3 lightColor2;
+//Uniform or global variables for object color and textures; the lights are in the lighting library
 
-uniform vec3 lightPos1;
-uniform vec3 lightPos2;
-
-uniform vec3 viewPosition;
-uniform sampler2D uTexture;
-uniform vec2 uvScale;
-uniform float ambientStrength = 0.2f;
-uniform float specularIntensity1 = 0.8f;
-uniform float highlightSize1 = 20.0f;
-uniform float specularIntensity2 = 0.8f;
-uniform float highlightSize2 = 20.0f;
-uniform bool ubHasTexture;
+layout(location = 1) uniform vec4 objectColor; // untextured variants
 
+layout(binding = 0) uniform sampler2D uTexture;
 
-void main()
+// Where each object's texture is: resident, or in the packed texture arrays (see MaterialPacker)
+struct DrawMaterial
 {
+    vec4 uvTransform; // xy scale, zw offset
+    vec4 uvClamp;     // xy min, zw max
+    int layer;        // -1: not packed, sample uTexture
+    int padding;
+    uvec2 handle;     // bindless texture handle, 0 when not resident
+};
+layout(std430, binding = 4) readonly buffer Materials
+{
+    DrawMaterial materials[];
+};
+layout(binding = 1) uniform sampler2DArray uTextureArray;
 
-    /*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
-
-//Calculate Ambient lighting*/
-    vec3 ambient = ambientStrength * lightColor1; // Generate ambient light color.
-
-    //Calculate Diffuse lighting*/
-    vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit.
-    vec3 lightDirection1 = normalize(lightPos1 - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube.
-    float impact1 = max(dot(norm, lightDirection1), 0.0);// Calculate diffuse impact by generating dot product of normal and light.
-    vec3 diffuse1 = impact1 * lightColor1; // Generate diffuse light color.
-
+// Finest mip level each streamed texture was sampled at (see TextureStreamer)
+layout(std430, binding = 3) buffer MipFeedback
+{
+    uint mipFeedback[];
+};
+layout(location = 2) uniform int uFeedbackSlot = -1;
+layout(location = 3) uniform vec2 uTextureSize; // size of mip level 0
 
-    vec3 lightDirection2 = normalize(lightPos2 - vertexFragmentPos); // Calculate distance between light source and fragments pixels
-    float impact2 = max(dot(norm, lightDirection2), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-    vec3 diffuse2 = impact2 * lightColor2; // Generate diffuse light color
 
-    //Calculate Specular lighting*/
-    vec3 viewDir1 = normalize(viewPosition - vertexFragmentPos); // Calculate view direction.
-    vec3 reflectDir = reflect(-lightDirection1, norm);// Calculate reflection vector.
+void main()
+{
+    vec4 baseColor = objectColor;
+    if (TEXTURED == 1)
+    {
+        // Report the mip level this pixel needs; one pixel in each 4x4 tile is plenty
+        vec2 texelDx = dFdx(vertexTextureCoordinate * uTextureSize);
+        vec2 texelDy = dFdy(vertexTextureCoordinate * uTextureSize);
+        if (uFeedbackSlot >= 0 && ((int(gl_FragCoord.x) | int(gl_FragCoord.y)) & 3) == 0)
+        {
+            float lod = 0.5f * log2(max(dot(texelDx, texelDx), dot(texelDy, texelDy)));
+            atomicMin(mipFeedback[uFeedbackSlot], uint(clamp(lod, 0.0f, 31.0f)));
+        }
 
+        DrawMaterial material = materials[vertexObject];
+        if (material.handle != uvec2(0))
+            baseColor = sampleBindless(material.handle, vertexTextureCoordinate);
+        else if (material.layer >= 0)
+        {
+            vec2 pageCoordinate = vertexTextureCoordinate * material.uvTransform.xy + material.uvTransform.zw;
+            pageCoordinate = clamp(pageCoordinate, material.uvClamp.xy, material.uvClamp.zw);
+            baseColor = texture(uTextureArray, vec3(pageCoordinate, material.layer));
+        }
+        else
+            baseColor = texture(uTexture, vertexTextureCoordinate);
+    }
 
+    vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit.
 
-    //Calculate specular component.
-    float specularComponent1 = pow(max(dot(viewDir1, reflectDir), 0.0), highlightSize1);
-    vec3 specular1 = specularIntensity1 * specularComponent1 * lightColor1;
-    vec3 reflectDir2 = reflect(-lightDirection2, norm);// Calculate reflection vector
+    if (DEFERRED == 1)
+    {
+        // Write the G-buffer; the lighting pass shades it (see DeferredRenderer)
+        fragmentColor = vec4(baseColor.rgb, float(SPECULAR));
+        fragmentNormal = encodeNormal(norm);
+        return;
+    }
 
+    vec3 viewDir = ORTHO == 1 ? viewDirection : normalize(viewPosition - vertexFragmentPos); // Calculate view direction.
+    vec3 phong = shadePhong(vertexFragmentPos, norm, viewDir, 1.0f);
 
-    //Calculate specular component
-    float specularComponent2 = pow(max(dot(viewDir1, reflectDir2), 0.0), highlightSize2);
-    vec3 specular2 = specularIntensity2 * specularComponent2 * lightColor2;
+    fragmentColor = vec4(phong * baseColor.xyz, 1.0f); // Multiplies the Phong result with the texture color to obtain the final fragment color.
+}
+);
 
 
-    // Calculate Phong result.
-    // Combine Phong result with texture color.
-    vec4 textureColor = texture(uTexture, vertexTextureCoordinate);
-    vec3 phong1;
-    vec3 phong2;
 
-    if (ubHasTexture == true)
+int main(int argc, char* argv[])
+{
+    // The SIMD kernels are compiled for AVX2; stop before the first one runs
+    if (!UCpuSupportsBuild())
     {
-        phong1 = (ambient + diffuse1 + specular1) * textureColor.xyz;
-        phong2 = (ambient + diffuse2 + specular2) * textureColor.xyz;
+        cout << "This build needs a CPU with AVX2" << endl;
+        return EXIT_FAILURE;
     }
-    else
+
+    // --bake-meshes writes torusN.mesh files to pass back as *.mesh arguments, and exits
+    // --benchmark-decoders times each image decoder on the textures and exits
+    for (int i = 1; i < argc; i++)
     {
-        phong1 = (ambient + diffuse1 + specular1) * objectColor.xyz;
-        phong2 = (ambient + diffuse2 + specular2) * objectColor.xyz;
+        if (strcmp(argv[i], "--bake-meshes") == 0)
+            return UBakeMeshFiles() ? EXIT_SUCCESS : EXIT_FAILURE;
+        if (strcmp(argv[i], "--benchmark-decoders") == 0)
+        {
+            UBenchmarkImageDecoders({ "wood.jpg", "cashew.jpg", "JarLid.jpg", "rubberBand.jpg",
+                "computerColor.jpg", "computerTop.jpg" }, DECODER_BENCHMARK_REPEATS);
+            return EXIT_SUCCESS;
+        }
     }
 
-    fragmentColor = vec4(phong1 + phong2, 1.0f); // Multiplies the Phong result with the texture color to obtain the final fragment color.
-}
-);
-
+    if (!UInitialize(argc, argv, &gWindow))
+        return EXIT_FAILURE;
 
+    // The scene shader samples through handles when the textures can be made resident
+    std::string fragmentShaderHeader = MaterialPacker::BindlessSupported() ? bindlessShaderHeader : boundShaderHeader;
+    fragmentShaderHeader += lightingShaderSource;
+    fragmentShaderHeader += "\n";
 
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
-void flipImageVertically(unsigned char* image, int width, int height, int channels)
-{
-    for (int j = 0; j < height / 2; ++j)
+    // --benchmark-pipelines times building and switching the variants as whole programs
+    // and as program pipelines, and exits; the program cache is not open yet, so nothing is skipped
+    bool pipelines = false;
+    for (int i = 1; i < argc; i++)
     {
-        int index1 = j * width * channels;
-        int index2 = (height - 1 - j) * width * channels;
-
-        for (int i = 0; i < width * channels; ++i)
+        if (strcmp(argv[i], "--benchmark-pipelines") == 0)
         {
-            unsigned char tmp = image[index1 + i];
-            image[index1 + i] = image[index2 + i];
-            image[index2 + i] = tmp;
+            UBenchmarkPipelines(fragmentShaderHeader.c_str());
+            return EXIT_SUCCESS;
         }
+        else if (strcmp(argv[i], "--program-pipelines") == 0)
+            pipelines = true;
     }
-}
 
+    // Programs built on an earlier run load from their driver binaries
+    UOpenProgramCache(PROGRAM_CACHE_FILE);
 
-int main(int argc, char* argv[])
-{
-    if (!UInitialize(argc, argv, &gWindow))
+    // Submit the scene shader with the variants every desk object uses, as program pipelines
+    // with --program-pipelines; the driver compiles them while everything else loads
+    gShaderPermutations.Create(vertexShaderSource, fragmentShaderSource, fragmentShaderHeader.c_str(), pipelines);
+    ShaderFeatures deskFeatures;
+    deskFeatures.lightCount = LIGHT_COUNT;
+    gShaderPermutations.ForProjection(gShaderPermutations.Program(deskFeatures), true);
+
+    // The deferred path's lighting passes; --deferred starts on it
+    if (!gDeferredRenderer.Create(lightingShaderSource, LIGHT_COUNT))
         return EXIT_FAILURE;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--deferred") == 0)
+            gDeferred = true;
+    }
+
+    // --bake-textures writes block compressed KTX2 cache files next to the
+    // images (BC7 with --bake-textures-bc7); later runs load those instead
+    TextureOptions textureOptions;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--bake-textures") == 0)
+            textureOptions.bake = true;
+        else if (strcmp(argv[i], "--bake-textures-bc7") == 0)
+            textureOptions.bake = textureOptions.useBC7 = true;
+    }
+    gTextureStreamer.Create();
+    gTextureStreamer.SetBudget(TEXTURE_BUDGET_BYTES);
+
+    TextureOptions surfaceOptions = textureOptions;
+    surfaceOptions.maxSize = SURFACE_TEXTURE_SIZE;
+    TextureOptions objectOptions = textureOptions;
+    objectOptions.maxSize = OBJECT_TEXTURE_SIZE;
+
+    // Textures (relative to project's directory) with a cache file start out
+    // at their smallest mips; the rest are decoded on worker threads and
+    // uploaded once the meshes and shaders are built
+    URequestTexture("wood.jpg", gWoodTexture, surfaceOptions);
+    URequestTexture("cashew.jpg", gCashewTexture, objectOptions);
+    URequestTexture("JarLid.jpg", gJarLidTexture, objectOptions);
+    URequestTexture("rubberBand.jpg", gRubberbandTexture, objectOptions);
+    URequestTexture("computerColor.jpg", gComputerColorTexture, objectOptions);
+    URequestTexture("computerTop.jpg", gComputerTopTexture, objectOptions);
 
     // Create the mesh
     meshes.CreateMeshes();
 
-    // Create the shader program
-    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId))
+    // Create the compute-shader mesh generator
+    if (!gMeshGenerator.Create())
         return EXIT_FAILURE;
 
-    // Load texture (relative to project's directory)
-    const char* texFilename = "wood.jpg";
-    if (!UCreateTexture(texFilename, gWoodTexture))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
+#ifdef _DEBUG
+    // Check the GPU generators, and the torus against its CPU reference
+    if (!gMeshGenerator.Verify())
+        cout << "GPU mesh generation does not match the CPU reference" << endl;
+
+    // Check that the JPEG decoder rejects malformed Huffman tables
+    if (!JpegDecoder::Verify())
+        cout << "JPEG decoder self-check failed" << endl;
+#endif
+
+    // Create the culling compute shader
+    if (!gGpuCuller.Create())
         return EXIT_FAILURE;
-    }
 
-    texFilename = "cashew.jpg";
-    if (!UCreateTexture(texFilename, gCashewTexture))
+    // The depth pre-pass follows the measured overdraw unless --depth-prepass
+    // or --no-depth-prepass forces it on or off
+    DepthPrepass::Mode prepassMode = DepthPrepass::MODE_AUTO;
+    for (int i = 1; i < argc; i++)
     {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
+        if (strcmp(argv[i], "--depth-prepass") == 0)
+            prepassMode = DepthPrepass::MODE_ON;
+        else if (strcmp(argv[i], "--no-depth-prepass") == 0)
+            prepassMode = DepthPrepass::MODE_OFF;
     }
+    if (!gDepthPrepass.Create(prepassMode))
+        return EXIT_FAILURE;
 
-    texFilename = "JarLid.jpg";
-    if (!UCreateTexture(texFilename, gJarLidTexture))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
+    // Create the post-processing compute shader
+    if (!gPostProcessor.Create())
         return EXIT_FAILURE;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--no-post-process") == 0)
+            gPostProcess = false;
     }
 
-    texFilename = "rubberBand.jpg";
-    if (!UCreateTexture(texFilename, gRubberbandTexture))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
+    // Upload the textures as their decodes finish
+    gShaderPermutations.Poll();
+    if (!gTextureLoader.Finish())
         return EXIT_FAILURE;
-    }
+    gShaderPermutations.Poll();
 
-    texFilename = "computerColor.jpg";
-    if (!UCreateTexture(texFilename, gComputerColorTexture))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
+    // Textures without a cache file are resident whole; they share the
+    // streaming budget
+    for (const pair<string, size_t>& uploaded : gTextureLoader.Uploaded())
+        gTextureStreamer.AddWhole(uploaded.first.c_str(), uploaded.second);
+
+    // Lay out the desk objects and their lights
+    UCreateScene();
+    UCreateLights();
+
+    // Stream any mesh files given on the command line
+    gMeshStreamer.Create(MESH_BUDGET_BYTES);
+    UAddMeshFiles(argc, argv);
+
+    // Make the objects' textures resident, or copy them into shared texture arrays
+    // in place of the originals (streamed ones stay apart)
+    gMaterialPacker.Pack();
+
+    // Pick each object's shader variant; objects are drawn with the fallback until theirs is built
+    if (!UAssignPrograms())
         return EXIT_FAILURE;
-    }
 
-    texFilename = "computerTop.jpg";
-    if (!UCreateTexture(texFilename, gComputerTopTexture))
+    // --benchmark-shading times the forward and deferred paths and exits
+    for (int i = 1; i < argc; i++)
     {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
+        if (strcmp(argv[i], "--benchmark-shading") == 0)
+        {
+            UBenchmarkShading();
+            return EXIT_SUCCESS;
+        }
     }
 
-
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
     // Sets the background color of the window to black (it will be implicitely used by glClear)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
@@ -297,29 +654,41 @@ int main(int argc, char* argv[])
         // Render this frame
         URender();
 
+        if (gFirstFrame)
+        {
+            cout << "INFO: Time to first frame: " << glfwGetTime() * 1000.0 << " ms" << endl;
+            gFirstFrame = false;
+        }
+
         glfwPollEvents();
     }
 
     // Release mesh data
+    gDepthPrepass.LogStats();
+    gDepthPrepass.Destroy();
+    gPostProcessor.Destroy();
+    gGpuCuller.Destroy();
+    gTransformStage.Destroy();
+    gLightClusterer.Destroy();
+    gDeferredRenderer.Destroy();
+    gStaticBatcher.Destroy();
+    gMaterialPacker.Destroy(); // and the scene's textures, which it took over
+    gMeshStreamer.Destroy();
     meshes.DestroyMeshes();
+    gMeshGenerator.Destroy();
+    gTextureStreamer.LogStats();
+    gTextureStreamer.Destroy();
 
 
-    // Release texture
-    UDestroyTexture(gWoodTexture);
-    // Release texture
-    UDestroyTexture(gCashewTexture);
-    // Release texture
-    UDestroyTexture(gRubberbandTexture);
+    // Release the texture upload buffers
+    UDestroyUploadBuffers();
 
-    // Release texture
-    UDestroyTexture(gJarLidTexture);
 
-    // Release texture
-    UDestroyTexture(gComputerColorTexture);
+    // Release shader programs
+    gShaderPermutations.Destroy();
 
-
-    // Release shader program
-    UDestroyShaderProgram(gProgramId);
+    // Save the programs built this run
+    UCloseProgramCache();
 
     exit(EXIT_SUCCESS); // Terminates the program 
 }
@@ -333,6 +702,7 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_SRGB_CAPABLE, GLFW_TRUE);
 
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
@@ -368,6 +738,10 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
         return false;
     }
 
+    // Color textures are sRGB, so lighting works on linear values and the
+    // result is encoded back to sRGB when it is written
+    glEnable(GL_FRAMEBUFFER_SRGB);
+
     // Displays GPU OpenGL version
     cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
     return true;
@@ -403,6 +777,14 @@ void UProcessInput(GLFWwindow* window)
         isOrtho = !isOrtho;
     }
 
+    // Switch between forward and deferred shading, once per press
+    bool deferredKeyDown = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+    if (deferredKeyDown && !gDeferredKeyDown) {
+        gDeferred = !gDeferred;
+        cout << "INFO: " << (gDeferred ? "Deferred" : "Forward") << " shading" << endl;
+    }
+    gDeferredKeyDown = deferredKeyDown;
+
 
 }
 
@@ -486,391 +868,520 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 }
 
 
-// Functioned called to render a frame
-void URender()
+// Stream the texture from its cache file when there is an up to date one,
+// otherwise queue it on the loader (which may bake the cache file)
+void URequestTexture(const char* filename, GLuint& textureId, const TextureOptions& options)
 {
+    if (options.useCache && gTextureStreamer.Register(filename, textureId, options.maxSize))
+        return;
 
-    //Init matrices so they are not null
-    glm::mat4 model;
+    gTextureLoader.SetOptions(options);
+    gTextureLoader.Request(filename, textureId);
+}
+
+
+// Place the objects on the desk. Nothing on the desk moves, so every
+// object is static and gets merged into a batch per texture. Object
+// colors are picked in sRGB, like LIGHT_COLORS.
+void UCreateScene()
+{
     glm::mat4 scale;
-    glm::mat4 projection;
     glm::mat4 rotation;
     glm::mat4 translation;
-    GLint objectColorLoc;
-    GLint modelLoc;
-    GLint viewLoc;
-    GLint projLoc;
-
-    GLint viewPosLoc;
-    GLint ambStrLoc;
-    GLint ambColLoc;
-    GLint light1ColLoc;
-    GLint light1PosLoc;
-    GLint light2ColLoc;
-    GLint light2PosLoc;
-    GLint specInt1Loc;
-    GLint highlghtSz1Loc;
-    GLint specInt2Loc;
-    GLint highlghtSz2Loc;
-    GLint uHasTextureLoc;
-    bool ubHasTextureVal;
-
-
-
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
-    // Clear the frame and z buffers
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    // Set the shader to be used
-    glUseProgram(gProgramId);
-
-    glm::mat4 view = gCamera.GetViewMatrix();
-
-    if (isOrtho) {
-        // Orthographic projection
-        float orthoSize = 10.0f;
-        projection = glm::ortho(-orthoSize, orthoSize, -orthoSize, orthoSize, 0.1f, 100.0f);
-        view = glm::lookAt(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-
-    }
-    else {
-        // Perspective projection
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-        // camera/view transformation
-        glm::mat4 view = gCamera.GetViewMatrix();
-    }
-
-    // Outputs the matrices into the Vertex Shader
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
-    objectColorLoc = glGetUniformLocation(gProgramId, "uObjectColor");
-    viewPosLoc = glGetUniformLocation(gProgramId, "viewPosition");
-    ambStrLoc = glGetUniformLocation(gProgramId, "ambientStrength");
-    ambColLoc = glGetUniformLocation(gProgramId, "ambientColor");
-    light1ColLoc = glGetUniformLocation(gProgramId, "lightColor1");
-    light1PosLoc = glGetUniformLocation(gProgramId, "lightPos1");
-    light2ColLoc = glGetUniformLocation(gProgramId, "lightColor2");
-    light2PosLoc = glGetUniformLocation(gProgramId, "lightPos2");
-    specInt1Loc = glGetUniformLocation(gProgramId, "specularIntensity1");
-    highlghtSz1Loc = glGetUniformLocation(gProgramId, "highlightSize1");
-    specInt2Loc = glGetUniformLocation(gProgramId, "specularIntensity2");
-    highlghtSz2Loc = glGetUniformLocation(gProgramId, "highlightSize2");
-    uHasTextureLoc = glGetUniformLocation(gProgramId, "ubHasTexture");
-
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    GLuint UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-
-
-    //set the camera view location
-    glUniform3f(viewPosLoc, gCamera.Position.x, gCamera.Position.y, gCamera.Position.z);
-
-    //set ambient lighting strength
-    glUniform1f(ambStrLoc, 0.1f);
-    //set ambient color
-    glUniform3f(ambColLoc, 0.5f, 0.5f, 0.5f);
-
-    //set light 1 properties
-   // glUniform3f(light1ColLoc, 1.0f, 1.0f, 1.0f);
-    glUniform3f(light1ColLoc, 1.0f, 0.95f, 0.85f); // slightly warm white color
-
-    glUniform3f(light1PosLoc, -15.0f, 2.5f, -10.0f);
-
-    //set light 2 properties
-    //glUniform3f(light2ColLoc, 1.0f, 1.0f, 1.0f);
-    glUniform3f(light2ColLoc, 1.0f, 0.95f, 0.85f); // slightly warm white color
-
-    glUniform3f(light2PosLoc, 15.0f, 20.0f, -15.0f);
-
-    //set specular intensity
-    glUniform1f(specInt1Loc, 1.0f);
-    glUniform1f(specInt2Loc, 1.0f);
-
-    //set specular highlight size
-    glUniform1f(highlghtSz1Loc, 25.0f);
-    glUniform1f(highlghtSz2Loc, 50.0f);
-
-    ubHasTextureVal = true;
-    glUniform1i(uHasTextureLoc, ubHasTextureVal);
+    SceneObject object;
 
+    gScene.Clear();
+    object.programId = 0; // see UAssignPrograms
+    object.objectColor = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+    object.meshFile = MeshStreamer::INVALID_HANDLE;
+    object.isStatic = true;
 
     //Plane Wood//
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gPlaneMesh.vao);
-
-    // Bind the texture to a texture unit
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gWoodTexture);
-
-
-    // 1. Scales the object
     scale = glm::scale(glm::vec3(15.0f, 1.0f, 15.0f));
-    // 2. Rotate the object
     rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
     translation = glm::translate(glm::vec3(0.0f, 0.0f, 0.0f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glProgramUniform4f(gProgramId, objectColorLoc, 0.1f, 0.1f, 0.1f, 0.1f);
+    object.name = "plane";
+    object.mesh = &meshes.gPlaneMesh;
+    object.texture = gMaterialPacker.Add(gWoodTexture);
+    object.objectColor = glm::convertSRGBToLinear(glm::vec4(0.1f, 0.1f, 0.1f, 0.1f));
+    object.model = translation * rotation * scale;
+    gScene.Add(object);
 
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-
-    //Unbind texture
-    glBindTexture(GL_TEXTURE_2D, 0);
+    //Computer Side
+    scale = glm::scale(glm::vec3(7.0f, 7.0f, 2.5f));
+    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
+    translation = glm::translate(glm::vec3(10.0f, 3.5f, -3.0f));
+    object.name = "computer side";
+    object.mesh = &meshes.gBoxMesh;
+    object.texture = gMaterialPacker.Add(gComputerColorTexture);
+    object.objectColor = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+    object.model = translation * rotation * scale;
+    gScene.Add(object);
+
+    //Computer BACK
+    scale = glm::scale(glm::vec3(0.2f, 7.0f, 2.5f));
+    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
+    translation = glm::translate(glm::vec3(13.6f, 3.5f, -3.0f));
+    object.name = "computer back";
+    object.texture = gMaterialPacker.Add(gJarLidTexture);
+    object.model = translation * rotation * scale;
+    gScene.Add(object);
 
+    //Computer Top
+    scale = glm::scale(glm::vec3(2.9f, 0.1f, 7.3f));
+    rotation = glm::rotate(80.095f, glm::vec3(0.0, 2.0f, 0.0f));
+    translation = glm::translate(glm::vec3(9.7f, 7.0f, -2.7f));
+    object.name = "computer top";
+    object.texture = gMaterialPacker.Add(gComputerTopTexture);
+    object.model = translation * rotation * scale;
+    gScene.Add(object);
 
+    //Computer Front
+    scale = glm::scale(glm::vec3(0.5f, 7.0f, 2.5f));
+    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
+    translation = glm::translate(glm::vec3(6.3f, 3.5f, -3.0f));
+    object.name = "computer front";
+    object.texture = gMaterialPacker.Add(gJarLidTexture);
+    object.model = translation * rotation * scale;
+    gScene.Add(object);
 
     //Computer Side
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gBoxMesh.vao);
+    scale = glm::scale(glm::vec3(7.3f, 7.0f, 0.5f));
+    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
+    translation = glm::translate(glm::vec3(9.7f, 3.5f, -1.5f));
+    object.name = "computer side 2";
+    object.model = translation * rotation * scale;
+    gScene.Add(object);
 
-    // Bind the texture to a texture unit
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gComputerColorTexture);
+    //Jar lid//
+    scale = glm::scale(glm::vec3(1.1f, 1.0f, 1.0f));
+    rotation = glm::rotate(-90.05f, glm::vec3(1.0, 1.0f, 1.0f));
+    translation = glm::translate(glm::vec3(0.0f, 0.1f, 0.0f));
+    object.name = "jar lid";
+    object.mesh = &meshes.gTorusMesh;
+    object.model = translation * rotation * scale;
+    gScene.Add(object);
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(7.0f, 7.0f, 2.5f));
-    // 2. Rotate the object
+    //Rubber Band Ball//
+    scale = glm::scale(glm::vec3(0.7f, 0.7f, 0.7f));
     rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(10.0f, 3.5f, -3.0f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    glProgramUniform4f(gProgramId, objectColorLoc, 1.0f, 1.0f, 1.0f, 1.0f);
+    translation = glm::translate(glm::vec3(3.0f, 0.68f, -5.0f));
+    object.name = "rubber band ball";
+    object.mesh = &meshes.gSphereMesh;
+    object.texture = gMaterialPacker.Add(gRubberbandTexture);
+    object.objectColor = glm::convertSRGBToLinear(glm::vec4(1.0f, 0.0f, 1.0f, 0.0f));
+    object.model = translation * rotation * scale;
+    gScene.Add(object);
 
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+    //Jar Object//
+    scale = glm::scale(glm::vec3(1.0f, 3.2f, 1.0f));
+    rotation = glm::rotate(0.0f, glm::vec3(0.0, 0.0f, 1.0f));
+    translation = glm::translate(glm::vec3(0.0f, 0.1f, 0.0f));
+    object.name = "jar";
+    object.mesh = &meshes.gCylinderMesh;
+    object.texture = gMaterialPacker.Add(gCashewTexture);
+    object.objectColor = glm::convertSRGBToLinear(glm::vec4(0.25f, 0.68f, 0.75f, 1.0f));
+    object.model = translation * rotation * scale;
+    gScene.Add(object);
+}
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
 
-    //Unbind texture
-    glBindTexture(GL_TEXTURE_2D, 0);
+// Point lights around the desk: a lamp, the glow of the computer's front,
+// its indicator LEDs and an LED strip along the back edge of the desk
+void UCreateLights()
+{
+    PointLight light;
+    gPointLights.clear();
+
+    //Desk lamp
+    light.position = glm::vec3(-4.0f, 6.0f, -3.0f);
+    light.range = 12.0f;
+    light.color = glm::convertSRGBToLinear(glm::vec3(1.0f, 0.85f, 0.6f));
+    light.intensity = 30.0f;
+    gPointLights.push_back(light);
+
+    //Computer front glow
+    light.position = glm::vec3(5.0f, 4.5f, -3.0f);
+    light.range = 5.0f;
+    light.color = glm::convertSRGBToLinear(glm::vec3(0.45f, 0.6f, 1.0f));
+    light.intensity = 6.0f;
+    gPointLights.push_back(light);
+
+    //Power and disk LEDs
+    light.position = glm::vec3(5.95f, 6.2f, -2.4f);
+    light.range = 1.0f;
+    light.color = glm::convertSRGBToLinear(glm::vec3(0.2f, 1.0f, 0.3f));
+    light.intensity = 0.8f;
+    gPointLights.push_back(light);
+    light.position = glm::vec3(5.95f, 5.9f, -2.4f);
+    light.color = glm::convertSRGBToLinear(glm::vec3(1.0f, 0.6f, 0.1f));
+    gPointLights.push_back(light);
+
+    //LED strip, cycling through the hues
+    light.range = 1.5f;
+    light.intensity = 0.6f;
+    for (int i = 0; i < LED_STRIP_LIGHTS; i++)
+    {
+        float t = float(i) / LED_STRIP_LIGHTS;
+        light.position = glm::vec3(-12.0f + 24.0f * t, 0.1f, -8.0f);
+        light.color = glm::convertSRGBToLinear(0.5f + 0.5f * glm::cos(6.2831853f * (t + glm::vec3(0.0f, 1.0f / 3.0f, 2.0f / 3.0f))));
+        gPointLights.push_back(light);
+    }
+}
 
 
-    //Computer BACK 
- // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gBoxMesh.vao);
+// Write a torus mesh file at each of BAKED_TORUS_SEGMENTS. Runs before
+// there is a GL context; UWriteMeshFile welds the vertices on the CPU.
+bool UBakeMeshFiles()
+{
+    Geometry geometry;
+    for (int segments : BAKED_TORUS_SEGMENTS)
+    {
+        string filename = "torus" + to_string(segments) + ".mesh";
+        Meshes::UGenerateTorus(segments, segments / 2, 1.0f, 0.1f, geometry);
+        if (!UWriteMeshFile(filename.c_str(), geometry, vector<GLuint>()))
+            return false;
+        cout << "INFO: Baked " << filename << endl;
+    }
+    return true;
+}
 
-    // Bind the texture to a texture unit
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gJarLidTexture);
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(0.2f, 7.0f, 2.5f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(13.6f, 3.5f, -3.0f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+// Register each *.mesh argument with the streamer and place it in a row
+// in front of the desk objects. Nothing is loaded until it is drawn.
+void UAddMeshFiles(int argc, char* argv[])
+{
+    SceneObject object;
+    object.mesh = nullptr;
+    object.programId = 0; // see UAssignPrograms
+    object.texture = gMaterialPacker.Add(gWoodTexture);
+    object.objectColor = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+    object.isStatic = false;
+
+    int placed = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        size_t length = strlen(argv[i]);
+        if (length < 5 || strcmp(argv[i] + length - 5, ".mesh") != 0)
+            continue;
+
+        object.meshFile = gMeshStreamer.Register(argv[i]);
+        if (object.meshFile == MeshStreamer::INVALID_HANDLE)
+            continue;
+
+        object.name = argv[i];
+        object.model = glm::translate(glm::vec3(-6.0f + 3.0f * placed, 1.0f, 5.0f));
+        gScene.Add(object);
+        placed++;
+    }
+}
 
-    glProgramUniform4f(gProgramId, objectColorLoc, 1.0f, 1.0f, 1.0f, 1.0f);
 
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+// Shader features an object's material needs. Objects get perspective
+// variants; URender swaps in the orthographic twin when needed.
+ShaderFeatures UObjectFeatures(const SceneObject& object)
+{
+    ShaderFeatures features;
+    features.textured = object.texture != MaterialPacker::INVALID_HANDLE;
+    features.lightCount = LIGHT_COUNT;
+    features.specular = true;
+    return features;
+}
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
 
-    //Unbind texture
-    glBindTexture(GL_TEXTURE_2D, 0);
+// Give every object the shader variant it needs, and submit the orthographic
+// and G-buffer twins of each so switching the projection or path does not fall back
+bool UAssignPrograms()
+{
+    for (size_t i = 0; i < gScene.Size(); i++)
+    {
+        GLuint programId = gShaderPermutations.Program(UObjectFeatures(gScene.Object(i)));
+        if (programId == 0)
+            return false;
+        if (gScene.Object(i).programId != programId)
+            gScene.Edit(i).programId = programId;
+        gShaderPermutations.ForProjection(programId, true);
+        gShaderPermutations.ForDeferred(programId);
+    }
+    return true;
+}
 
 
-    //Computer Top
-    // 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gBoxMesh.vao);
+// Distance from the camera to the world space bounding sphere of a streamed object
+float UStreamDistance(const SceneObject& object)
+{
+    glm::vec3 minCorner = gMeshStreamer.BoundsMin(object.meshFile);
+    glm::vec3 maxCorner = gMeshStreamer.BoundsMax(object.meshFile);
+    glm::vec3 center = glm::vec3(object.model * glm::vec4(0.5f * (minCorner + maxCorner), 1.0f));
 
-    // Bind the texture to a texture unit
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gComputerTopTexture);
+    float scale = glm::max(glm::length(glm::vec3(object.model[0])),
+        glm::max(glm::length(glm::vec3(object.model[1])), glm::length(glm::vec3(object.model[2]))));
+    float radius = 0.5f * glm::length(maxCorner - minCorner) * scale;
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(2.9f, 0.1f, 7.3f));
-    // 2. Rotate the object
-    rotation = glm::rotate(80.095f, glm::vec3(0.0, 2.0f, 0.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(9.7f,7.0f, -2.7f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    return glm::max(glm::length(center - gCamera.Position) - radius, 0.0f);
+}
 
-    glProgramUniform4f(gProgramId, objectColorLoc, 1.0f, 1.0f, 1.0f, 1.0f);
 
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+// Point the shader's mip feedback at the texture's slot; textures that are
+// not streamed get no slot and report nothing
+void USetTextureFeedback(GLuint programId, GLuint textureId, GLint slotLoc, GLint sizeLoc)
+{
+    int slot = gTextureStreamer.Slot(textureId);
+    glProgramUniform1i(programId, slotLoc, slot);
+    if (slot != TextureStreamer::INVALID_SLOT)
+        glProgramUniform2fv(programId, sizeLoc, 1, glm::value_ptr(gTextureStreamer.FullSize(slot)));
+}
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
 
-    //Unbind texture
-    glBindTexture(GL_TEXTURE_2D, 0);
+// Outputs the camera and lights into one shader variant. Uniforms
+// a variant compiled out have no location and are skipped.
+void USetFrameUniforms(GLuint programId, const glm::mat4& view)
+{
+    GLint viewPosLoc = glGetUniformLocation(programId, "viewPosition");
+    GLint viewDirLoc = glGetUniformLocation(programId, "viewDirection");
+    GLint ambStrLoc = glGetUniformLocation(programId, "ambientStrength");
+    GLint lightColLoc = glGetUniformLocation(programId, "lightColors");
+    GLint lightPosLoc = glGetUniformLocation(programId, "lightPositions");
+    GLint specIntLoc = glGetUniformLocation(programId, "specularIntensities");
+    GLint highlghtSzLoc = glGetUniformLocation(programId, "highlightSizes");
+
+    //set the camera view location, and the direction towards an orthographic camera
+    glProgramUniform3f(programId, viewPosLoc, gCamera.Position.x, gCamera.Position.y, gCamera.Position.z);
+    glProgramUniform3fv(programId, viewDirLoc, 1, glm::value_ptr(glm::vec3(glm::inverse(view)[2])));
 
+    //set ambient lighting strength
+    glProgramUniform1f(programId, ambStrLoc, 0.1f);
+
+    //set the properties of as many lights as the variant has
+    ShaderFeatures features;
+    int lights = gShaderPermutations.Features(programId, features) ? glm::min(features.lightCount, LIGHT_COUNT) : LIGHT_COUNT;
+    glProgramUniform3fv(programId, lightColLoc, lights, glm::value_ptr(LIGHT_COLORS[0]));
+    glProgramUniform3fv(programId, lightPosLoc, lights, glm::value_ptr(LIGHT_POSITIONS[0]));
+    glProgramUniform1fv(programId, specIntLoc, lights, SPECULAR_INTENSITIES);
+    glProgramUniform1fv(programId, highlghtSzLoc, lights, HIGHLIGHT_SIZES);
+}
 
-    //Computer Front
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gBoxMesh.vao);
+// Per-draw uniforms, at the locations every variant shares: the color of
+// an untextured object, or the mip feedback of a textured one
+void USetDrawUniforms(GLuint programId, GLuint textureId, const glm::vec4& objectColor)
+{
+    ShaderFeatures features;
+    if (gShaderPermutations.Features(programId, features) && !features.textured)
+        glProgramUniform4fv(programId, ShaderPermutations::OBJECT_COLOR_LOCATION, 1, glm::value_ptr(objectColor));
+    else
+        USetTextureFeedback(programId, textureId, ShaderPermutations::FEEDBACK_SLOT_LOCATION, ShaderPermutations::TEXTURE_SIZE_LOCATION);
+}
 
-    // Bind the texture to a texture unit
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gJarLidTexture);
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(0.5f, 7.0f, 2.5f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(6.3f, 3.5f, -3.0f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+// Bind a texture for the following draws unless it already is. Pages of
+// the material packer go to unit 1, other textures to unit 0.
+void UBindTexture(GLuint textureId)
+{
+    int unit = gMaterialPacker.IsPage(textureId) ? 1 : 0;
+    if (gBoundTextures[unit] == textureId)
+        return;
 
-    glProgramUniform4f(gProgramId, objectColorLoc, 1.0f, 1.0f, 1.0f, 1.0f);
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(unit == 1 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D, textureId);
+    gBoundTextures[unit] = textureId;
+}
 
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+// Functioned called to render a frame
+void URender()
+{
 
-    //Unbind texture
-    glBindTexture(GL_TEXTURE_2D, 0);
+    //Init matrices so they are not null
+    glm::mat4 model;
+    glm::mat4 projection;
 
 
-    //Computer Side
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gBoxMesh.vao);
+    // Enable z-depth
+    glEnable(GL_DEPTH_TEST);
+    // Clear the frame and z buffers
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // Bind the texture to a texture unit
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gJarLidTexture);
+    glm::mat4 view = gCamera.GetViewMatrix();
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(7.3f, 7.0f, 0.5f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(9.7f, 3.5f, -1.5f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    if (isOrtho) {
+        // Orthographic projection
+        float orthoSize = 10.0f;
+        projection = glm::ortho(-orthoSize, orthoSize, -orthoSize, orthoSize, NEAR_PLANE, FAR_PLANE);
+        view = glm::lookAt(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 
-    glProgramUniform4f(gProgramId, objectColorLoc, 1.0f, 1.0f, 1.0f, 1.0f);
+    }
+    else {
+        // Perspective projection
+        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, NEAR_PLANE, FAR_PLANE);
+        // camera/view transformation
+        glm::mat4 view = gCamera.GetViewMatrix();
+    }
 
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+    // Outputs the camera and lights into every shader variant built so far
+    gShaderPermutations.Poll();
+    for (GLuint programId : gShaderPermutations.Programs())
+        USetFrameUniforms(programId, view);
+    for (GLuint programId : gDeferredRenderer.Programs())
+        USetFrameUniforms(programId, view);
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
 
-    //Unbind texture
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // Rebuild the static batches if an object was edited
+    if (gStaticBatcher.Update(gScene, gMaterialPacker))
+    {
+        gGpuCuller.Build(gStaticBatcher);
+        gDepthPrepass.Build(gStaticBatcher, gGpuCuller);
+        gMaterialPacker.UpdateMaterials(gScene);
+    }
 
+    // List the point lights reaching each cluster of the view
+    int framebufferWidth, framebufferHeight;
+    glfwGetFramebufferSize(gWindow, &framebufferWidth, &framebufferHeight);
+    gLightClusterer.Update(gPointLights, view, projection, NEAR_PLANE, FAR_PLANE, framebufferWidth, framebufferHeight);
 
-    //Jar lid//
+    // Cull the batched objects; the draw commands stay on the GPU
+    gGpuCuller.Cull(projection * view);
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gTorusMesh.vao);
+    // Upload streamed meshes that finished loading, evict the ones over budget
+    gMeshStreamer.Update();
 
-    // Bind the texture to a texture unit
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gJarLidTexture);
+    // Refine or drop texture mips from older feedback, and bind this frame's feedback buffer
+    gTextureStreamer.Update();
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(1.1f, 1.0f, 1.0f));
-    // 2. Rotate the object
-    rotation = glm::rotate(-90.05f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(0.0f, 0.1f, 0.0f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glProgramUniform4f(gProgramId, objectColorLoc, 1.0f, 1.0f, 1.0f, 1.0f);
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, meshes.gTorusMesh.nVertices);
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    // Pick the mesh and model each object is drawn with; batched objects
+    // are already in world space
+    gDrawModels.assign(gScene.Size(), glm::mat4(1.0f));
+    gDrawMeshes.assign(gScene.Size(), nullptr);
+    for (size_t i = 0; i < gScene.Size(); i++)
+    {
+        if (gStaticBatcher.IsBatched(i))
+            continue;
 
-    //Unbind texture
-    glBindTexture(GL_TEXTURE_2D, 0);
+        const SceneObject& object = gScene.Object(i);
+        const Meshes::GLMesh* mesh = object.mesh;
+        model = object.model;
 
+        if (mesh == nullptr)
+        {
+            // Streamed mesh: nothing past the far plane is drawn, but meshes
+            // close to it are loaded ahead of time
+            float distance = UStreamDistance(object);
+            if (distance > FAR_PLANE)
+            {
+                if (distance < PREFETCH_DISTANCE)
+                    gMeshStreamer.Prefetch(object.meshFile);
+                continue;
+            }
+
+            // Draw a box the size of the mesh until it is resident
+            mesh = gMeshStreamer.Acquire(object.meshFile);
+            if (mesh == nullptr)
+            {
+                mesh = &meshes.gBoxMesh;
+                model = object.model * gMeshStreamer.PlaceholderModel(object.meshFile);
+            }
+        }
 
+        gDrawModels[i] = model;
+        gDrawMeshes[i] = mesh;
+    }
 
-    //Rubber Band Ball//
+    // MVP and normal matrices of every object, once per frame instead of once per vertex
+    gTransformStage.Update(projection * view, gDrawModels);
 
-    glBindVertexArray(meshes.gSphereMesh.vao);
-    // Bind the texture to a texture unit
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gRubberbandTexture);
+    // Draw into the HDR target
+    if (gPostProcess)
+        gPostProcessor.Begin(framebufferWidth, framebufferHeight);
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(0.7f, 0.7f, 0.7f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(3.0f, 0.68f, -5.0f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    // The deferred path draws into the G-buffer and lights it afterwards
+    if (gDeferred)
+        gDeferredRenderer.BeginGeometry(framebufferWidth, framebufferHeight);
 
-    glProgramUniform4f(gProgramId, objectColorLoc, 1.0f, 0.0f, 1.0f, 0.0f);
+    // Depth of everything the shading pass draws, with positions only and no fragment shader
+    if (gDepthPrepass.Begin())
+    {
+        for (size_t b = 0; b < gStaticBatcher.Batches().size(); b++)
+        {
+            if (gShaderPermutations.DrawProgram(gStaticBatcher.Batches()[b].programId, isOrtho, gDeferred) != 0)
+                gDepthPrepass.DrawBatch(b, gGpuCuller);
+        }
+        for (size_t i = 0; i < gScene.Size(); i++)
+        {
+            if (gDrawMeshes[i] != nullptr && gShaderPermutations.DrawProgram(gScene.Object(i).programId, isOrtho, gDeferred) != 0)
+                gDepthPrepass.DrawMesh(*gDrawMeshes[i], GLuint(i));
+        }
+    }
+    gDepthPrepass.BeginShading();
 
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gSphereMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+    // Static objects: one multi-draw per material
+    for (size_t b = 0; b < gStaticBatcher.Batches().size(); b++)
+    {
+        const StaticBatch& batch = gStaticBatcher.Batches()[b];
+        GLuint programId = gShaderPermutations.DrawProgram(batch.programId, isOrtho, gDeferred);
+        if (programId == 0)
+            continue;
+        gShaderPermutations.Use(programId);
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+        // Activate the VBOs contained within the batch's VAO
+        glBindVertexArray(batch.mesh.vao);
 
-    //Unbind texture
-    glBindTexture(GL_TEXTURE_2D, 0);
+        // Bind the texture (or the page holding the batch's textures)
+        UBindTexture(batch.textureId);
 
+        USetDrawUniforms(programId, batch.textureId, batch.objectColor);
 
+        // Draws the triangles of the objects that survived culling
+        gGpuCuller.Draw(b);
+    }
 
-    //Jar Object//
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gCylinderMesh.vao);
+    // Objects that are not batched are drawn one by one
+    for (size_t i = 0; i < gScene.Size(); i++)
+    {
+        const SceneObject& object = gScene.Object(i);
+        const Meshes::GLMesh* mesh = gDrawMeshes[i];
+        if (mesh == nullptr)
+            continue;
+
+        GLuint programId = gShaderPermutations.DrawProgram(object.programId, isOrtho, gDeferred);
+        if (programId == 0)
+            continue;
+        gShaderPermutations.Use(programId);
+        glBindVertexArray(mesh->vao);
+        UBindTexture(gMaterialPacker.DrawTexture(object.texture));
+
+        // Meshes drawn on their own have no per-instance scene index; the
+        // attribute's current value stands in for it, for both the material
+        // and the transform
+        glVertexAttribI1ui(MaterialPacker::MATERIAL_ATTRIBUTE, GLuint(i));
+
+        USetDrawUniforms(programId, gMaterialPacker.Texture(object.texture), object.objectColor);
+
+        if (mesh->nIndices > 0)
+            glDrawElements(GL_TRIANGLES, mesh->nIndices, GL_UNSIGNED_INT, (void*)0);
+        else
+            glDrawArrays(GL_TRIANGLES, 0, mesh->nVertices);
+    }
+    gDepthPrepass.EndShading();
 
-    // Bind the texture to a texture unit
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gCashewTexture);
+    // Light every pixel of the G-buffer once
+    if (gDeferred)
+        gDeferredRenderer.Light(isOrtho, projection * view, gPostProcess ? gPostProcessor.Framebuffer() : 0);
 
+    // Tonemap, FXAA and dither the frame into the window
+    if (gPostProcess)
+        gPostProcessor.Resolve(EXPOSURE);
 
-    // 1. Scales the object
-    scale = glm::scale(glm::vec3(1.0f, 3.2f, 1.0f));
-    // 2. Rotate the object
-    rotation = glm::rotate(0.0f, glm::vec3(0.0, 0.0f, 1.0f));
-    // 3. Position the object
-    translation = glm::translate(glm::vec3(0.0f, 0.1f, 0.0f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glProgramUniform4f(gProgramId, objectColorLoc, 0.25f, 0.68f, 0.75f, 1.0f);
-
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-    glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-    glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
     // Deactivate the Vertex Array Object
     glBindVertexArray(0);
 
     //Unbind texture
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, 0);
+    gBoundTextures[0] = gBoundTextures[1] = 0;
 
 
 
@@ -879,109 +1390,191 @@ void URender()
 
 }
 
-/*Generate and load the texture*/
-bool UCreateTexture(const char* filename, GLuint& textureId)
+
+///////////////////////////////////////////////////
+//	UBenchmarkShading()
+//
+//	Draws layers of full-screen planes, each in front of the last so every
+//	layer is shaded, lit by more and more random point lights, and times the
+//	GPU work of each path with timer queries. Logs one INFO line per light
+//	count and overdraw.
+///////////////////////////////////////////////////
+void UBenchmarkShading()
 {
-    int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
-    {
-        flipImageVertically(image, width, height, channels);
+    ShaderFeatures features;
+    features.textured = false;
+    features.lightCount = LIGHT_COUNT;
+    GLuint forwardId = gShaderPermutations.Program(features);
+    GLuint deferredId = gShaderPermutations.ForDeferred(forwardId);
+    gShaderPermutations.Poll(true);
+    if (!gShaderPermutations.IsReady(forwardId) || !gShaderPermutations.IsReady(deferredId))
+        return;
 
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
+    int width, height;
+    glfwGetFramebufferSize(gWindow, &width, &height);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 12.0f, 0.01f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (GLfloat)width / (GLfloat)height, NEAR_PLANE, FAR_PLANE);
 
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    GLuint query;
+    glGenQueries(1, &query);
 
-        if (channels == 3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else
+    for (int lightCount : BENCHMARK_LIGHT_COUNTS)
+    {
+        std::vector<PointLight> lights(lightCount);
+        for (PointLight& light : lights)
         {
-            cout << "Not implemented to handle image with " << channels << " channels" << endl;
-            return false;
+            light.position = glm::vec3(-6.0f + 12.0f * unit(random), 0.5f + unit(random), -5.0f + 10.0f * unit(random));
+            light.range = 1.0f + 2.0f * unit(random);
+            light.color = glm::vec3(unit(random), unit(random), unit(random));
+            light.intensity = 1.0f;
         }
-        glGenerateMipmap(GL_TEXTURE_2D);
+        gLightClusterer.Update(lights, view, projection, NEAR_PLANE, FAR_PLANE, width, height);
 
-        stbi_image_free(image);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
-
-        return true;
+        for (int overdraw : BENCHMARK_OVERDRAWS)
+        {
+            std::vector<glm::mat4> models;
+            for (int layer = 0; layer < overdraw; layer++)
+                models.push_back(glm::translate(glm::vec3(0.0f, 0.01f * layer, 0.0f)) * glm::scale(glm::vec3(15.0f, 1.0f, 15.0f)));
+            gTransformStage.Update(projection * view, models);
+
+            double ms[2];
+            for (int path = 0; path < 2; path++)
+            {
+                bool deferred = path == 1;
+                GLuint programId = deferred ? deferredId : forwardId;
+                USetFrameUniforms(programId, view);
+                for (GLuint lightingId : gDeferredRenderer.Programs())
+                    USetFrameUniforms(lightingId, view);
+
+                GLuint64 total = 0;
+                for (int frame = 0; frame < BENCHMARK_FRAMES + 1; frame++)
+                {
+                    glBeginQuery(GL_TIME_ELAPSED, query);
+                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                    if (deferred)
+                        gDeferredRenderer.BeginGeometry(width, height);
+
+                    gShaderPermutations.Use(programId);
+                    USetDrawUniforms(programId, 0, glm::vec4(1.0f));
+                    glBindVertexArray(meshes.gPlaneMesh.vao);
+                    for (int layer = 0; layer < overdraw; layer++)
+                    {
+                        glVertexAttribI1ui(MaterialPacker::MATERIAL_ATTRIBUTE, GLuint(layer));
+                        if (meshes.gPlaneMesh.nIndices > 0)
+                            glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+                        else
+                            glDrawArrays(GL_TRIANGLES, 0, meshes.gPlaneMesh.nVertices);
+                    }
+                    if (deferred)
+                        gDeferredRenderer.Light(false, projection * view);
+                    glEndQuery(GL_TIME_ELAPSED);
+
+                    // the first frame warms up
+                    GLuint64 elapsed = 0;
+                    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+                    if (frame > 0)
+                        total += elapsed;
+                }
+                ms[path] = total / 1.0e6 / BENCHMARK_FRAMES;
+            }
+            cout << "INFO: Shading " << width << "x" << height << ", " << lightCount << " lights, overdraw " << overdraw
+                << ": forward " << ms[0] << " ms, deferred " << ms[1] << " ms" << endl;
+        }
     }
-}
 
-void UDestroyTexture(GLuint textureId)
-{
-    glGenTextures(1, &textureId);
+    glBindVertexArray(0);
+    glDeleteQueries(1, &query);
 }
 
 
-// Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+///////////////////////////////////////////////////
+//	UBenchmarkPipelines(const char*)
+//
+//	fragmentHeader: inserted after the scene fragment shader's defines
+//
+//	Builds a grid of scene shader variants as whole programs, then as
+//	program pipelines, and times the builds. Then times draws of a small
+//	plane that switch to another untextured variant every draw, on the CPU
+//	and on the GPU. Logs one INFO line per mode.
+///////////////////////////////////////////////////
+void UBenchmarkPipelines(const char* fragmentHeader)
 {
-    // Compilation and linkage error reporting
-    int success = 0;
-    char infoLog[512];
-
-    // Create a Shader program object.
-    programId = glCreateProgram();
-
-    // Create the vertex and fragment shader objects
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
-
-    // Compile the vertex shader, and print compilation errors (if any)
-    glCompileShader(vertexShaderId); // compile the vertex shader
-    // check for shader compile errors
-    glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-
-        return false;
-    }
+    meshes.CreateMeshes();
 
-    glCompileShader(fragmentShaderId); // compile the fragment shader
-    // check for shader compile errors
-    glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+    int width, height;
+    glfwGetFramebufferSize(gWindow, &width, &height);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 12.0f, 0.01f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (GLfloat)width / (GLfloat)height, NEAR_PLANE, FAR_PLANE);
 
-        return false;
-    }
+    // the plane covers a few pixels, so the switches dominate; no point lights
+    gTransformStage.Update(projection * view, { glm::scale(glm::vec3(0.01f)) });
+    gLightClusterer.Update(std::vector<PointLight>(), view, projection, NEAR_PLANE, FAR_PLANE, width, height);
 
-    // Attached compiled shaders to the shader program
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
+    GLuint query;
+    glGenQueries(1, &query);
 
-    glLinkProgram(programId);   // links the shader program
-    // check for linking errors
-    glGetProgramiv(programId, GL_LINK_STATUS, &success);
-    if (!success)
+    for (int mode = 0; mode < 2; mode++)
     {
-        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        ShaderPermutations permutations;
+        double start = glfwGetTime();
+        permutations.Create(vertexShaderSource, fragmentShaderSource, fragmentHeader, mode == 1);
 
-        return false;
+        std::vector<GLuint> switchIds;
+        ShaderFeatures features;
+        for (int textured = 0; textured < 2; textured++)
+        {
+            for (int lightCount : BENCHMARK_VARIANT_LIGHT_COUNTS)
+            {
+                for (int specular = 0; specular < 2; specular++)
+                {
+                    for (int ortho = 0; ortho < 2; ortho++)
+                    {
+                        features.textured = textured != 0;
+                        features.lightCount = lightCount;
+                        features.specular = specular != 0;
+                        features.ortho = ortho != 0;
+                        GLuint programId = permutations.Program(features);
+                        if (!features.textured)
+                            switchIds.push_back(programId);
+                    }
+                }
+            }
+        }
+        permutations.Poll(true);
+        double buildMs = (glfwGetTime() - start) * 1000.0;
+
+        glBindVertexArray(meshes.gPlaneMesh.vao);
+        glVertexAttribI1ui(MaterialPacker::MATERIAL_ATTRIBUTE, 0);
+        glFinish();
+        start = glfwGetTime();
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        for (int draw = 0; draw < BENCHMARK_SWITCH_DRAWS; draw++)
+        {
+            permutations.Use(switchIds[draw % switchIds.size()]);
+            if (meshes.gPlaneMesh.nIndices > 0)
+                glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+            else
+                glDrawArrays(GL_TRIANGLES, 0, meshes.gPlaneMesh.nVertices);
+        }
+        glEndQuery(GL_TIME_ELAPSED);
+        glFinish();
+        double drawMs = (glfwGetTime() - start) * 1000.0;
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+
+        cout << "INFO: " << (permutations.UsesPipelines() ? "Program pipelines" : "Whole programs") << ": "
+            << permutations.Programs().size() << " variants built in " << buildMs << " ms, " << BENCHMARK_SWITCH_DRAWS
+            << " draws switching variants in " << drawMs << " ms CPU, " << elapsed / 1.0e6 << " ms GPU" << endl;
+        permutations.Destroy();
     }
 
-    glUseProgram(programId);    // Uses the shader program
-
-    return true;
-}
-
-void UDestroyShaderProgram(GLuint programId)
-{
-    glDeleteProgram(programId);
+    glUseProgram(0);
+    glBindProgramPipeline(0);
+    glBindVertexArray(0);
+    glDeleteQueries(1, &query);
+    gLightClusterer.Destroy();
+    gTransformStage.Destroy();
+    meshes.DestroyMeshes();
 }
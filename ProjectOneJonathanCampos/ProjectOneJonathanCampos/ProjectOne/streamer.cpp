@@ -0,0 +1,253 @@
+#include "streamer.h"
+
+#include <glm/gtx/transform.hpp>
+
+#include <iostream>
+
+
+const size_t MeshStreamer::INVALID_HANDLE;
+
+
+///////////////////////////////////////////////////
+//	Create(uint64_t)
+//
+//	budgetBytes: GPU memory the resident meshes may use
+//
+//	Start the worker thread that reads mesh files
+///////////////////////////////////////////////////
+bool MeshStreamer::Create(uint64_t budgetBytes)
+{
+	mBudgetBytes = budgetBytes;
+	mStopping = false;
+	mWorker = std::thread(&MeshStreamer::UWorker, this);
+	return true;
+}
+
+
+void MeshStreamer::Destroy()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+		mJobs.clear();
+	}
+	mWake.notify_all();
+	if (mWorker.joinable())
+		mWorker.join();
+
+	for (size_t i = 0; i < mEntries.size(); i++)
+	{
+		if (mEntries[i].state == STATE_RESIDENT)
+			UEvict(i);
+	}
+	mEntries.clear();
+	mLoaded.clear();
+	mResidentBytes = 0;
+}
+
+
+size_t MeshStreamer::Register(const char* filename)
+{
+	Entry entry = {};
+	if (!UReadMeshHeader(filename, entry.header))
+		return INVALID_HANDLE;
+
+	entry.filename = filename;
+	entry.bytes = UMeshFileGpuBytes(entry.header);
+	entry.state = STATE_UNLOADED;
+	mEntries.push_back(entry);
+	return mEntries.size() - 1;
+}
+
+
+///////////////////////////////////////////////////
+//	Update()
+//
+//	Upload up to mUploadsPerFrame finished loads, making room for each by
+//	evicting the least recently drawn meshes. A load that does not fit yet
+//	stays queued while the loads behind it are tried.
+///////////////////////////////////////////////////
+void MeshStreamer::Update()
+{
+	mFrame++;
+
+	for (int uploads = 0; uploads < mUploadsPerFrame; uploads++)
+	{
+		LoadResult result;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			// check the budget before taking a load off the queue
+			auto next = mLoaded.begin();
+			while (next != mLoaded.end() && next->valid && mEntries[next->handle].bytes <= mBudgetBytes
+				&& !UMakeRoom(mEntries[next->handle].bytes))
+				++next;
+			if (next == mLoaded.end())
+				break;
+			result = std::move(*next);
+			mLoaded.erase(next);
+		}
+
+		Entry& entry = mEntries[result.handle];
+		if (!result.valid || !UFitsBudget(result.handle))
+		{
+			entry.state = STATE_FAILED;
+			continue;
+		}
+
+		// UWriteMeshFile welded the vertices
+		Meshes::UUploadMesh(entry.mesh, result.geometry, result.indices.data(), GLuint(result.indices.size()), false);
+		glBindVertexArray(0);
+
+		entry.state = STATE_RESIDENT;
+		entry.lastUsedFrame = mFrame;
+		mResidentBytes += entry.bytes;
+	}
+}
+
+
+const Meshes::GLMesh* MeshStreamer::Acquire(size_t handle)
+{
+	Entry& entry = mEntries[handle];
+	entry.lastUsedFrame = mFrame;
+
+	if (entry.state == STATE_RESIDENT)
+		return &entry.mesh;
+
+	UQueueLoad(handle, true);
+	return nullptr;
+}
+
+
+void MeshStreamer::Prefetch(size_t handle)
+{
+	UQueueLoad(handle, false);
+}
+
+
+glm::vec3 MeshStreamer::BoundsMin(size_t handle) const
+{
+	const float* bounds = mEntries[handle].header.boundsMin;
+	return glm::vec3(bounds[0], bounds[1], bounds[2]);
+}
+
+
+glm::vec3 MeshStreamer::BoundsMax(size_t handle) const
+{
+	const float* bounds = mEntries[handle].header.boundsMax;
+	return glm::vec3(bounds[0], bounds[1], bounds[2]);
+}
+
+
+// The placeholder is Meshes::gBoxMesh, a unit cube centered on the origin
+glm::mat4 MeshStreamer::PlaceholderModel(size_t handle) const
+{
+	glm::vec3 minCorner = BoundsMin(handle);
+	glm::vec3 maxCorner = BoundsMax(handle);
+	return glm::translate(0.5f * (minCorner + maxCorner)) * glm::scale(glm::max(maxCorner - minCorner, glm::vec3(1e-4f)));
+}
+
+
+// Drawn meshes jump ahead of prefetches
+void MeshStreamer::UQueueLoad(size_t handle, bool urgent)
+{
+	Entry& entry = mEntries[handle];
+	if (entry.state != STATE_UNLOADED)
+		return;
+	if (!UFitsBudget(handle))
+	{
+		entry.state = STATE_FAILED;
+		return;
+	}
+
+	entry.state = STATE_QUEUED;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (urgent)
+			mJobs.emplace_front(handle, entry.filename);
+		else
+			mJobs.emplace_back(handle, entry.filename);
+	}
+	mWake.notify_one();
+}
+
+
+// Worker thread: read queued files until Destroy()
+void MeshStreamer::UWorker()
+{
+	for (;;)
+	{
+		std::pair<size_t, std::string> job;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [this] { return mStopping || !mJobs.empty(); });
+			if (mStopping)
+				return;
+			job = mJobs.front();
+			mJobs.pop_front();
+		}
+
+		LoadResult result;
+		result.handle = job.first;
+		result.valid = UReadMeshFile(job.second.c_str(), result.geometry, result.indices);
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mLoaded.push_back(std::move(result));
+	}
+}
+
+
+// A mesh larger than the whole budget would evict everything and still not
+// fit; it is reported once and never loaded
+bool MeshStreamer::UFitsBudget(size_t handle) const
+{
+	const Entry& entry = mEntries[handle];
+	if (entry.bytes <= mBudgetBytes)
+		return true;
+
+	std::cout << "ERROR::STREAMER::" << entry.filename << " needs " << entry.bytes << " bytes, more than the "
+		<< mBudgetBytes << " byte budget" << std::endl;
+	return false;
+}
+
+
+// Evict least recently drawn meshes until bytes more fit in the budget.
+// Meshes drawn in the last frame are kept; if evicting all the others is
+// not enough, nothing is evicted and false is returned.
+bool MeshStreamer::UMakeRoom(uint64_t bytes)
+{
+	uint64_t evictable = 0;
+	for (const Entry& entry : mEntries)
+	{
+		if (entry.state == STATE_RESIDENT && entry.lastUsedFrame + 1 < mFrame)
+			evictable += entry.bytes;
+	}
+	if (mResidentBytes - evictable + bytes > mBudgetBytes)
+		return false;
+
+	while (mResidentBytes + bytes > mBudgetBytes)
+	{
+		size_t oldest = INVALID_HANDLE;
+		for (size_t i = 0; i < mEntries.size(); i++)
+		{
+			const Entry& entry = mEntries[i];
+			if (entry.state == STATE_RESIDENT && entry.lastUsedFrame + 1 < mFrame
+				&& (oldest == INVALID_HANDLE || entry.lastUsedFrame < mEntries[oldest].lastUsedFrame))
+				oldest = i;
+		}
+
+		UEvict(oldest);
+		mEntries[oldest].state = STATE_UNLOADED;
+	}
+	return true;
+}
+
+
+void MeshStreamer::UEvict(size_t handle)
+{
+	Entry& entry = mEntries[handle];
+	glDeleteVertexArrays(1, &entry.mesh.vao);
+	glDeleteBuffers(2, entry.mesh.vbos);
+	entry.mesh = Meshes::GLMesh();
+	mResidentBytes -= entry.bytes;
+}
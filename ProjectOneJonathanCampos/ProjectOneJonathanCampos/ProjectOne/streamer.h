@@ -0,0 +1,112 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "geometry.h"
+#include "mesh.h"
+#include "meshfile.h"
+
+// Streams meshes stored in mesh files (see meshfile.h) in and out of GPU
+// memory. Files are read on a worker thread; the main thread uploads the
+// finished loads and keeps the uploaded meshes under a byte budget by
+// evicting the ones that were drawn least recently. Until a mesh is
+// resident the caller draws a placeholder box fitted to the file's bounds.
+// A mesh larger than the whole budget fails instead of being loaded.
+class MeshStreamer
+{
+public:
+	static const size_t INVALID_HANDLE = ~size_t(0);
+
+	bool Create(uint64_t budgetBytes);
+	void Destroy();
+
+	// Reads the header of a mesh file and returns its handle, or INVALID_HANDLE
+	size_t Register(const char* filename);
+
+	void SetBudget(uint64_t budgetBytes) { mBudgetBytes = budgetBytes; }
+	uint64_t Budget() const { return mBudgetBytes; }
+	uint64_t ResidentBytes() const { return mResidentBytes; }
+
+	// Start of a frame: uploads finished loads and evicts meshes over the budget
+	void Update();
+
+	// Marks the mesh as drawn this frame. Returns the resident mesh, or
+	// nullptr after queueing a load when it is not resident yet.
+	const Meshes::GLMesh* Acquire(size_t handle);
+
+	// Queues a load for a mesh that is not drawn yet but soon may be
+	void Prefetch(size_t handle);
+
+	bool IsResident(size_t handle) const { return mEntries[handle].state == STATE_RESIDENT; }
+
+	// Object space bounds of the mesh, known without loading it
+	glm::vec3 BoundsMin(size_t handle) const;
+	glm::vec3 BoundsMax(size_t handle) const;
+
+	// Model matrix that fits the unit placeholder box around the mesh's bounds
+	glm::mat4 PlaceholderModel(size_t handle) const;
+
+	// Uploads allowed per Update() so a burst of loads does not stall a frame
+	void SetUploadsPerFrame(int uploads) { mUploadsPerFrame = uploads; }
+
+private:
+	enum State
+	{
+		STATE_UNLOADED,
+		STATE_QUEUED,		// waiting for or being read by the worker
+		STATE_LOADED,		// read, waiting for an upload
+		STATE_RESIDENT,
+		STATE_FAILED
+	};
+
+	struct Entry
+	{
+		std::string filename;
+		MeshFileHeader header;
+		uint64_t bytes;			// GPU size once resident
+		State state;
+		uint64_t lastUsedFrame;
+		Meshes::GLMesh mesh;
+	};
+
+	// A file read by the worker
+	struct LoadResult
+	{
+		size_t handle;
+		bool valid;
+		Geometry geometry;
+		std::vector<GLuint> indices;
+	};
+
+	void UQueueLoad(size_t handle, bool urgent);
+	void UWorker();
+	bool UFitsBudget(size_t handle) const;
+	bool UMakeRoom(uint64_t bytes);
+	void UEvict(size_t handle);
+
+	std::vector<Entry> mEntries;
+	uint64_t mBudgetBytes = 0;
+	uint64_t mResidentBytes = 0;
+	uint64_t mFrame = 0;
+	int mUploadsPerFrame = 2;
+
+	// shared with the worker
+	std::thread mWorker;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::deque<std::pair<size_t, std::string>> mJobs;
+	std::deque<LoadResult> mLoaded;
+	bool mStopping = false;
+};
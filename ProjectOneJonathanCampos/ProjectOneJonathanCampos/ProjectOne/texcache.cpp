@@ -0,0 +1,516 @@
+#include "texcache.h"
+#include "geometry.h"
+#include "texture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+
+namespace
+{
+	const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+	// KTX2 header up to and including the index (section 3 of the KTX 2.0 spec)
+	struct Ktx2Header
+	{
+		unsigned char identifier[12];
+		uint32_t vkFormat;
+		uint32_t typeSize;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t layerCount;
+		uint32_t faceCount;
+		uint32_t levelCount;
+		uint32_t supercompressionScheme;
+		uint32_t dfdByteOffset;
+		uint32_t dfdByteLength;
+		uint32_t kvdByteOffset;
+		uint32_t kvdByteLength;
+		uint64_t sgdByteOffset;
+		uint64_t sgdByteLength;
+	};
+
+	struct Ktx2Level
+	{
+		uint64_t byteOffset;
+		uint64_t byteLength;
+		uint64_t uncompressedByteLength;
+	};
+
+	// Key under which the source image hash is stored
+	const char SOURCE_HASH_KEY[] = "ProjectOne.sourceHash";
+
+	struct FormatInfo
+	{
+		uint32_t vkFormat;
+		uint32_t unormVkFormat;	// same blocks tagged UNORM, as older cache files are
+		GLenum glFormat;
+		uint32_t colorModel;	// Khronos data format color model
+	};
+
+	// Indexed by BlockFormat. The baked colors are sRGB encoded, so the
+	// GL decodes them to linear when sampling.
+	const FormatInfo FORMATS[] = {
+		{ 132, 131, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT, 128 },			// VK_FORMAT_BC1_RGB_SRGB_BLOCK, KHR_DF_MODEL_BC1A
+		{ 138, 137, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 130 },	// VK_FORMAT_BC3_SRGB_BLOCK, KHR_DF_MODEL_BC3
+		{ 146, 145, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, 134 },		// VK_FORMAT_BC7_SRGB_BLOCK, KHR_DF_MODEL_BC7
+	};
+
+	float gSrgbToLinear[256];
+
+	void UInitSrgbTable()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			float c = i / 255.0f;
+			gSrgbToLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+	}
+
+	inline unsigned char ULinearToSrgb(float c)
+	{
+		c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+		return (unsigned char)std::lround(std::min(std::max(c, 0.0f), 1.0f) * 255.0f);
+	}
+
+	// Half size RGBA level, averaging colors in linear light and alpha as is
+	void UDownsample(const std::vector<unsigned char>& source, int width, int height, std::vector<unsigned char>& level)
+	{
+		const int levelWidth = std::max(1, width / 2);
+		const int levelHeight = std::max(1, height / 2);
+		level.resize(size_t(levelWidth) * levelHeight * 4);
+
+		for (int y = 0; y < levelHeight; y++)
+		{
+			for (int x = 0; x < levelWidth; x++)
+			{
+				float sum[4] = {};
+				for (int dy = 0; dy < 2; dy++)
+				{
+					for (int dx = 0; dx < 2; dx++)
+					{
+						int sx = std::min(2 * x + dx, width - 1);
+						int sy = std::min(2 * y + dy, height - 1);
+						const unsigned char* texel = &source[(size_t(sy) * width + sx) * 4];
+						for (int c = 0; c < 3; c++)
+							sum[c] += gSrgbToLinear[texel[c]];
+						sum[3] += texel[3];
+					}
+				}
+
+				unsigned char* out = &level[(size_t(y) * levelWidth + x) * 4];
+				for (int c = 0; c < 3; c++)
+					out[c] = ULinearToSrgb(sum[c] * 0.25f);
+				out[3] = (unsigned char)std::lround(sum[3] * 0.25f);
+			}
+		}
+	}
+
+	inline void UPutWord(std::vector<unsigned char>& out, uint32_t word)
+	{
+		for (int b = 0; b < 4; b++)
+			out.push_back((unsigned char)(word >> (8 * b)));
+	}
+
+	// Basic data format descriptor for a block compressed format
+	void UWriteDfd(BlockFormat format, std::vector<unsigned char>& dfd)
+	{
+		const uint32_t blockBytes = uint32_t(UBlockBytes(format));
+		const uint32_t samples = format == BLOCK_BC3 ? 2 : 1;
+		const uint32_t blockSize = 24 + 16 * samples;
+
+		UPutWord(dfd, 4 + blockSize);							// dfdTotalSize
+		UPutWord(dfd, 0);										// vendorId, descriptorType
+		UPutWord(dfd, 2 | (blockSize << 16));					// versionNumber, descriptorBlockSize
+		UPutWord(dfd, FORMATS[format].colorModel | (1 << 8) | (2 << 16));	// BT.709 primaries, sRGB transfer
+		UPutWord(dfd, 3 | (3 << 8));							// 4x4 texel blocks
+		UPutWord(dfd, blockBytes);								// bytesPlane0
+		UPutWord(dfd, 0);
+
+		// BC3 has the alpha block first; every other sample is the whole block
+		if (format == BLOCK_BC3)
+		{
+			const uint32_t CHANNEL_ALPHA = 15;
+			UPutWord(dfd, 0 | (63 << 16) | (CHANNEL_ALPHA << 24));
+			UPutWord(dfd, 0);
+			UPutWord(dfd, 0);
+			UPutWord(dfd, 0xFFFFFFFFu);
+			UPutWord(dfd, 64 | (63 << 16));
+		}
+		else
+			UPutWord(dfd, 0 | ((blockBytes * 8 - 1) << 16));
+		UPutWord(dfd, 0);
+		UPutWord(dfd, 0);
+		UPutWord(dfd, 0xFFFFFFFFu);
+	}
+
+	void UPutKeyValue(std::vector<unsigned char>& kvd, const char* key, const void* value, size_t valueBytes)
+	{
+		const size_t keyBytes = strlen(key) + 1;
+		UPutWord(kvd, uint32_t(keyBytes + valueBytes));
+		kvd.insert(kvd.end(), key, key + keyBytes);
+		kvd.insert(kvd.end(), static_cast<const unsigned char*>(value), static_cast<const unsigned char*>(value) + valueBytes);
+		while (kvd.size() % 4)
+			kvd.push_back(0);
+	}
+
+	// Value of a key in the key/value data, or nullptr
+	const unsigned char* UFindKeyValue(const unsigned char* kvd, size_t kvdBytes, const char* key, size_t& valueBytes)
+	{
+		const size_t keyBytes = strlen(key) + 1;
+		size_t position = 0;
+		while (position + 4 <= kvdBytes)
+		{
+			uint32_t length;
+			memcpy(&length, kvd + position, 4);
+			position += 4;
+			if (length > kvdBytes - position)
+				return nullptr;
+
+			if (length >= keyBytes && memcmp(kvd + position, key, keyBytes) == 0)
+			{
+				valueBytes = length - keyBytes;
+				return kvd + position + keyBytes;
+			}
+			position += (length + 3) & ~size_t(3);
+		}
+		return nullptr;
+	}
+}
+
+
+///////////////////////////////////////////////////
+//	UBakeTexture(const Image&, bool, CompressedTexture&)
+//
+//	image: decoded image, top row first
+//	useBC7: BC7 for every image instead of BC1/BC3
+//	texture: receives the compressed mip chain
+//
+//	Each level is filtered from the previous one in linear light, so dark
+//	and bright texels keep their weight in the smaller mips
+///////////////////////////////////////////////////
+void UBakeTexture(const Image& image, bool useBC7, CompressedTexture& texture)
+{
+	static bool tableReady = (UInitSrgbTable(), true);
+	(void)tableReady;
+
+	texture.format = useBC7 ? BLOCK_BC7 : image.channels == 4 ? BLOCK_BC3 : BLOCK_BC1;
+	texture.width = image.width;
+	texture.height = image.height;
+	texture.levels.clear();
+
+	// RGBA, bottom row first
+	int width = image.width, height = image.height;
+	std::vector<unsigned char> rgba(size_t(width) * height * 4);
+	for (int y = 0; y < height; y++)
+	{
+		const unsigned char* row = image.pixels + size_t(height - 1 - y) * width * image.channels;
+		for (int x = 0; x < width; x++)
+		{
+			const unsigned char* texel = row + size_t(x) * image.channels;
+			unsigned char* out = &rgba[(size_t(y) * width + x) * 4];
+			out[0] = texel[0];
+			out[1] = texel[std::min(1, image.channels - 1)];
+			out[2] = texel[std::min(2, image.channels - 1)];
+			out[3] = image.channels == 4 ? texel[3] : 255;
+		}
+	}
+
+	for (;;)
+	{
+		texture.levels.emplace_back();
+		UCompressImage(texture.format, rgba.data(), width, height, texture.levels.back());
+		if (width == 1 && height == 1)
+			break;
+
+		std::vector<unsigned char> next;
+		UDownsample(rgba, width, height, next);
+		rgba.swap(next);
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+}
+
+
+std::string UTextureCachePath(const char* filename)
+{
+	return std::string(filename) + ".ktx2";
+}
+
+
+uint64_t UHashFile(const char* filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+		return 0;
+
+	std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	return UHashBytes(bytes.data(), bytes.size());
+}
+
+
+uint64_t UTextureSourceHash(const char* filename, int maxSize)
+{
+	uint64_t hash = UHashFile(filename);
+	if (hash == 0 || maxSize <= 0)
+		return hash;
+	return UHashBytes(&maxSize, sizeof(maxSize), hash);
+}
+
+
+///////////////////////////////////////////////////
+//	UWriteKtx2(const char*, const CompressedTexture&, uint64_t)
+//
+//	filename: file to create
+//	texture: compressed levels
+//	sourceHash: UHashFile of the source image
+//
+//	Level data is written smallest level first, as the format requires
+///////////////////////////////////////////////////
+bool UWriteKtx2(const char* filename, const CompressedTexture& texture, uint64_t sourceHash)
+{
+	const uint32_t levelCount = uint32_t(texture.levels.size());
+	const size_t blockBytes = UBlockBytes(texture.format);
+
+	std::vector<unsigned char> dfd;
+	UWriteDfd(texture.format, dfd);
+
+	std::vector<unsigned char> kvd;
+	UPutKeyValue(kvd, "KTXorientation", "ru", 3);
+	UPutKeyValue(kvd, "KTXwriter", "ProjectOne", 11);
+	UPutKeyValue(kvd, SOURCE_HASH_KEY, &sourceHash, sizeof(sourceHash));
+
+	Ktx2Header header = {};
+	memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+	header.vkFormat = FORMATS[texture.format].vkFormat;
+	header.typeSize = 1;
+	header.pixelWidth = uint32_t(texture.width);
+	header.pixelHeight = uint32_t(texture.height);
+	header.faceCount = 1;
+	header.levelCount = levelCount;
+	header.dfdByteOffset = uint32_t(sizeof(Ktx2Header) + sizeof(Ktx2Level) * levelCount);
+	header.dfdByteLength = uint32_t(dfd.size());
+	header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+	header.kvdByteLength = uint32_t(kvd.size());
+
+	// levels start on a block boundary
+	std::vector<Ktx2Level> levels(levelCount);
+	uint64_t offset = header.kvdByteOffset + header.kvdByteLength;
+	for (int level = int(levelCount) - 1; level >= 0; level--)
+	{
+		offset = (offset + blockBytes - 1) / blockBytes * blockBytes;
+		levels[level].byteOffset = offset;
+		levels[level].byteLength = texture.levels[level].size();
+		levels[level].uncompressedByteLength = texture.levels[level].size();
+		offset += texture.levels[level].size();
+	}
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		std::cout << "ERROR::TEXCACHE::could not create " << filename << std::endl;
+		return false;
+	}
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(levels.data()), sizeof(Ktx2Level) * levels.size());
+	file.write(reinterpret_cast<const char*>(dfd.data()), dfd.size());
+	file.write(reinterpret_cast<const char*>(kvd.data()), kvd.size());
+
+	uint64_t position = header.kvdByteOffset + header.kvdByteLength;
+	const char padding[16] = {};
+	for (int level = int(levelCount) - 1; level >= 0; level--)
+	{
+		file.write(padding, std::streamsize(levels[level].byteOffset - position));
+		file.write(reinterpret_cast<const char*>(texture.levels[level].data()), texture.levels[level].size());
+		position = levels[level].byteOffset + levels[level].byteLength;
+	}
+	file.close();
+
+	if (file.fail())
+	{
+		std::cout << "ERROR::TEXCACHE::failed writing " << filename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+
+///////////////////////////////////////////////////
+//	UReadKtx2Info(const char*, uint64_t, Ktx2Info&)
+//
+//	filename: cache file
+//	sourceHash: UHashFile of the source image the cache must match
+//	info: receives the format, size and where each level is stored
+//
+//	Reads the header, level index and key/value data but no levels. Only
+//	files written by UWriteKtx2 are accepted. Returns false without a
+//	message when the file is missing or out of date.
+///////////////////////////////////////////////////
+bool UReadKtx2Info(const char* filename, uint64_t sourceHash, Ktx2Info& info)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+		return false;
+
+	file.seekg(0, std::ios::end);
+	const uint64_t fileBytes = uint64_t(file.tellg());
+	file.seekg(0, std::ios::beg);
+
+	Ktx2Header header;
+	if (fileBytes < sizeof(header) || !file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+		return false;
+
+	int format = 0;
+	while (format < 3 && FORMATS[format].vkFormat != header.vkFormat && FORMATS[format].unormVkFormat != header.vkFormat)
+		format++;
+
+	if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0 || format == 3
+		|| header.pixelDepth != 0 || header.layerCount != 0 || header.faceCount != 1 || header.levelCount == 0
+		|| header.levelCount > 32 || header.supercompressionScheme != 0
+		|| uint64_t(header.kvdByteOffset) + header.kvdByteLength > fileBytes
+		|| sizeof(header) + sizeof(Ktx2Level) * uint64_t(header.levelCount) > fileBytes)
+	{
+		std::cout << "ERROR::TEXCACHE::" << filename << " is not a texture cache file" << std::endl;
+		return false;
+	}
+
+	std::vector<Ktx2Level> levels(header.levelCount);
+	std::vector<unsigned char> keyValues(header.kvdByteLength);
+	file.read(reinterpret_cast<char*>(levels.data()), sizeof(Ktx2Level) * levels.size());
+	file.seekg(header.kvdByteOffset);
+	file.read(reinterpret_cast<char*>(keyValues.data()), keyValues.size());
+	if (!file)
+		return false;
+
+	size_t valueBytes = 0;
+	const unsigned char* value = UFindKeyValue(keyValues.data(), header.kvdByteLength, SOURCE_HASH_KEY, valueBytes);
+	uint64_t storedHash = 0;
+	if (!value || valueBytes != sizeof(storedHash))
+		return false;
+	memcpy(&storedHash, value, sizeof(storedHash));
+	if (storedHash != sourceHash)
+		return false;
+
+	info.format = BlockFormat(format);
+	info.width = int(header.pixelWidth);
+	info.height = int(header.pixelHeight);
+	info.levelOffsets.resize(header.levelCount);
+
+	for (uint32_t level = 0; level < header.levelCount; level++)
+	{
+		const Ktx2Level& entry = levels[level];
+		size_t expected = UCompressedSize(info.format, std::max(1, info.width >> level), std::max(1, info.height >> level));
+		if (entry.byteLength != expected || entry.byteOffset > fileBytes || entry.byteLength > fileBytes - entry.byteOffset)
+		{
+			std::cout << "ERROR::TEXCACHE::" << filename << " is truncated" << std::endl;
+			return false;
+		}
+		info.levelOffsets[level] = entry.byteOffset;
+	}
+	return true;
+}
+
+
+///////////////////////////////////////////////////
+//	UReadKtx2Level(const char*, const Ktx2Info&, int, std::vector<unsigned char>&)
+//
+//	filename: cache file info was read from
+//	info: from UReadKtx2Info
+//	level: mip level to read, 0 is the full size image
+//	data: receives the level's blocks
+//
+//	Seeks straight to the level, so a fine level can be read long after
+//	the coarse ones without reading the file again
+///////////////////////////////////////////////////
+bool UReadKtx2Level(const char* filename, const Ktx2Info& info, int level, std::vector<unsigned char>& data)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+		return false;
+
+	data.resize(UCompressedSize(info.format, std::max(1, info.width >> level), std::max(1, info.height >> level)));
+	file.seekg(std::streamoff(info.levelOffsets[level]));
+	if (!file.read(reinterpret_cast<char*>(data.data()), data.size()))
+	{
+		std::cout << "ERROR::TEXCACHE::failed reading " << filename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+
+// Read every level of a cache file
+bool UReadKtx2(const char* filename, uint64_t sourceHash, CompressedTexture& texture)
+{
+	Ktx2Info info;
+	if (!UReadKtx2Info(filename, sourceHash, info))
+		return false;
+
+	texture.format = info.format;
+	texture.width = info.width;
+	texture.height = info.height;
+	texture.levels.resize(info.levelOffsets.size());
+
+	for (size_t level = 0; level < texture.levels.size(); level++)
+	{
+		if (!UReadKtx2Level(filename, info, int(level), texture.levels[level]))
+			return false;
+	}
+	return true;
+}
+
+
+// BC7 (BPTC) is core since GL 4.2; BC1 and BC3 need S3TC, and their sRGB
+// variants EXT_texture_sRGB
+bool UCompressedTexturesSupported()
+{
+	return GLEW_EXT_texture_compression_s3tc != 0 && GLEW_EXT_texture_sRGB != 0;
+}
+
+
+GLenum UCompressedFormat(BlockFormat format)
+{
+	return FORMATS[format].glFormat;
+}
+
+
+///////////////////////////////////////////////////
+//	UUploadCompressed(const CompressedTexture&, GLuint&)
+//
+//	texture: compressed mip chain
+//	textureId: receives the texture
+//
+//	Same sampling state as UUploadImage; the mips come from the cache
+//	instead of glGenerateMipmap
+///////////////////////////////////////////////////
+bool UUploadCompressed(const CompressedTexture& texture, GLuint& textureId)
+{
+	const GLenum internalFormat = FORMATS[texture.format].glFormat;
+
+	glGenTextures(1, &textureId);
+	glBindTexture(GL_TEXTURE_2D, textureId);
+
+	// set the texture wrapping parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	// set texture filtering parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	glTexStorage2D(GL_TEXTURE_2D, GLsizei(texture.levels.size()), internalFormat, texture.width, texture.height);
+	for (size_t level = 0; level < texture.levels.size(); level++)
+	{
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, GLint(level), 0, 0, std::max(1, texture.width >> level),
+			std::max(1, texture.height >> level), internalFormat, GLsizei(texture.levels[level].size()),
+			texture.levels[level].data());
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+	return true;
+}
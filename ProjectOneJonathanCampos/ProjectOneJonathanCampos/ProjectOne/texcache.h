@@ -0,0 +1,63 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bcenc.h"
+
+struct Image;
+
+// Block compressed texture with its whole mip chain, bottom row first as
+// OpenGL expects
+struct CompressedTexture
+{
+	BlockFormat format = BLOCK_BC1;
+	int width = 0;
+	int height = 0;
+	std::vector<std::vector<unsigned char>> levels;		// level 0 first
+};
+
+// Compress an image and a mip chain filtered in linear light. Three channel
+// images become BC1 (or BC7), four channel images BC3 (or BC7).
+void UBakeTexture(const Image& image, bool useBC7, CompressedTexture& texture);
+
+// The cache file of a texture sits next to it: "wood.jpg" -> "wood.jpg.ktx2"
+std::string UTextureCachePath(const char* filename);
+
+// Hash of a file's contents, or 0 if it cannot be read
+uint64_t UHashFile(const char* filename);
+
+// Hash a cache file is keyed by: the source image's contents and the size
+// limit it was resampled to, so changing the limit rebakes the cache
+uint64_t UTextureSourceHash(const char* filename, int maxSize);
+
+// KTX2 files holding one 2D texture. The hash of the source image is
+// stored as a key/value entry, and a cache file whose hash does not match
+// is treated as missing.
+bool UWriteKtx2(const char* filename, const CompressedTexture& texture, uint64_t sourceHash);
+bool UReadKtx2(const char* filename, uint64_t sourceHash, CompressedTexture& texture);
+
+// Where the levels of a cache file are, for reading them one at a time
+struct Ktx2Info
+{
+	BlockFormat format = BLOCK_BC1;
+	int width = 0;
+	int height = 0;
+	std::vector<uint64_t> levelOffsets;		// level 0 first
+};
+
+bool UReadKtx2Info(const char* filename, uint64_t sourceHash, Ktx2Info& info);
+bool UReadKtx2Level(const char* filename, const Ktx2Info& info, int level, std::vector<unsigned char>& data);
+
+// True when the GL can sample every format UBakeTexture writes
+bool UCompressedTexturesSupported();
+
+// GL internal format of a block format
+GLenum UCompressedFormat(BlockFormat format);
+
+// Create a texture from the compressed levels. GL thread only.
+bool UUploadCompressed(const CompressedTexture& texture, GLuint& textureId);
@@ -0,0 +1,448 @@
+#include "texstream.h"
+
+#include <algorithm>
+#include <iostream>
+
+
+const int TextureStreamer::INVALID_SLOT;
+const GLuint TextureStreamer::FEEDBACK_BINDING;
+const int TextureStreamer::FEEDBACK_FRAMES;
+
+
+namespace
+{
+	// Slots the feedback buffers start with; they double when full
+	const size_t INITIAL_SLOTS = 256;
+
+	// Levels no larger than this are loaded by Register() and never freed
+	const int TAIL_SIZE = 64;
+
+	// A level is freed once no frame in this many has asked for it
+	const uint64_t WINDOW_FRAMES = 120;
+
+	// Feedback value of a texture nothing sampled
+	const GLuint NOT_SAMPLED = ~GLuint(0);
+}
+
+
+///////////////////////////////////////////////////
+//	Create()
+//
+//	Allocate the feedback buffers and start the worker thread that reads
+//	levels from the cache files
+///////////////////////////////////////////////////
+bool TextureStreamer::Create()
+{
+	glGenBuffers(FEEDBACK_FRAMES, mFeedbackBuffers);
+	UResizeFeedback(INITIAL_SLOTS);
+
+	mStopping = false;
+	mWorker = std::thread(&TextureStreamer::UWorker, this);
+	return true;
+}
+
+
+void TextureStreamer::Destroy()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+		mJobs.clear();
+	}
+	mWake.notify_all();
+	if (mWorker.joinable())
+		mWorker.join();
+
+	for (int i = 0; i < FEEDBACK_FRAMES; i++)
+	{
+		if (mFences[i])
+			glDeleteSync(mFences[i]);
+		mFences[i] = 0;
+	}
+	glDeleteBuffers(FEEDBACK_FRAMES, mFeedbackBuffers);
+	for (int i = 0; i < FEEDBACK_FRAMES; i++)
+		mFeedbackBuffers[i] = 0;
+	mFeedbackSlots = 0;
+
+	mEntries.clear();
+	mLoaded.clear();
+	mResidentBytes = 0;
+	mLoadingBytes = 0;
+	mWholeTextures = 0;
+	mWholeBytes = 0;
+}
+
+
+///////////////////////////////////////////////////
+//	Register(const char*, GLuint&, int)
+//
+//	filename: source image; its cache file is what gets streamed
+//	textureId: receives the texture
+//	maxSize: size limit the cache file was baked with
+//
+//	Reads the levels up to TAIL_SIZE right away. The texture has a
+//	mutable level per mip so single levels can be freed again; the
+//	sampling state matches UUploadCompressed.
+///////////////////////////////////////////////////
+bool TextureStreamer::Register(const char* filename, GLuint& textureId, int maxSize)
+{
+	if (mFeedbackBuffers[0] == 0 || !UCompressedTexturesSupported())
+		return false;
+
+	Entry entry = {};
+	entry.cachePath = UTextureCachePath(filename);
+	if (!UReadKtx2Info(entry.cachePath.c_str(), UTextureSourceHash(filename, maxSize), entry.info))
+		return false;
+
+	const int levelCount = int(entry.info.levelOffsets.size());
+	const int size = std::max(entry.info.width, entry.info.height);
+	while (entry.tailLevel < levelCount - 1 && (size >> entry.tailLevel) > TAIL_SIZE)
+		entry.tailLevel++;
+
+	std::vector<std::vector<unsigned char>> tail(levelCount - entry.tailLevel);
+	for (int level = entry.tailLevel; level < levelCount; level++)
+	{
+		if (!UReadKtx2Level(entry.cachePath.c_str(), entry.info, level, tail[level - entry.tailLevel]))
+			return false;
+	}
+
+	glGenTextures(1, &entry.textureId);
+	glBindTexture(GL_TEXTURE_2D, entry.textureId);
+
+	// set the texture wrapping parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	// set texture filtering parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+
+	// coarsest first, so the base level only ever moves to a finer level
+	entry.baseLevel = levelCount;
+	for (int level = levelCount - 1; level >= entry.tailLevel; level--)
+		UUploadLevel(entry, level, tail[level - entry.tailLevel]);
+
+	entry.wantedLevel = entry.tailLevel;
+	entry.windowLevel = entry.tailLevel;
+	entry.loading = false;
+
+	if (mEntries.size() == mFeedbackSlots)
+		UResizeFeedback(2 * mFeedbackSlots);
+
+	textureId = entry.textureId;
+	mEntries.push_back(entry);
+	return true;
+}
+
+
+///////////////////////////////////////////////////
+//	AddWhole(const char*, uint64_t)
+//
+//	filename: source image, for the error message
+//	bytes: GPU memory of the texture, every level included
+//
+//	Counts a texture that was uploaded whole, without a cache file to
+//	stream from, against the budget. Its levels cannot be read again, so
+//	they are never evicted and the streamed textures get what is left.
+///////////////////////////////////////////////////
+void TextureStreamer::AddWhole(const char* filename, uint64_t bytes)
+{
+	mWholeTextures++;
+	mWholeBytes += bytes;
+	mResidentBytes += bytes;
+	if (mResidentBytes > mBudgetBytes)
+	{
+		std::cout << "ERROR::TEXSTREAM::" << filename << " takes the resident textures to " << mResidentBytes / 1024
+			<< " KB, over the " << mBudgetBytes / 1024 << " KB budget; bake a cache file (--bake-textures) to stream it"
+			<< std::endl;
+	}
+}
+
+
+int TextureStreamer::Slot(GLuint textureId) const
+{
+	for (size_t i = 0; i < mEntries.size(); i++)
+	{
+		if (mEntries[i].textureId == textureId)
+			return int(i);
+	}
+	return INVALID_SLOT;
+}
+
+
+glm::vec2 TextureStreamer::FullSize(int slot) const
+{
+	return glm::vec2(float(mEntries[slot].info.width), float(mEntries[slot].info.height));
+}
+
+
+///////////////////////////////////////////////////
+//	Update()
+//
+//	The feedback of a frame is read FEEDBACK_FRAMES frames later, by which
+//	time its fence has normally signaled. A texture refines one level at a
+//	time while the feedback asks for a finer level, and gives up one level
+//	a frame once a whole window of WINDOW_FRAMES went by without asking
+//	for it.
+///////////////////////////////////////////////////
+void TextureStreamer::Update()
+{
+	if (mFeedbackBuffers[0] == 0)
+		return;
+
+	// the previous frame's draws are done with their feedback buffer
+	if (mFrame > 0)
+	{
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		mFences[(mFrame - 1) % FEEDBACK_FRAMES] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	const int current = int(mFrame % FEEDBACK_FRAMES);
+	if (mFences[current])
+	{
+		glClientWaitSync(mFences[current], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+		glDeleteSync(mFences[current]);
+		mFences[current] = 0;
+		UReadFeedback(mFeedbackBuffers[current]);
+	}
+
+	if (mFrame - mWindowStart >= WINDOW_FRAMES)
+	{
+		for (size_t i = 0; i < mEntries.size(); i++)
+		{
+			mEntries[i].wantedLevel = mEntries[i].windowLevel;
+			mEntries[i].windowLevel = mEntries[i].tailLevel;
+		}
+		mWindowStart = mFrame;
+	}
+
+	for (int uploads = 0; uploads < mUploadsPerFrame; uploads++)
+	{
+		LoadResult result;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (mLoaded.empty())
+				break;
+			result = std::move(mLoaded.front());
+			mLoaded.pop_front();
+		}
+
+		Entry& entry = mEntries[result.slot];
+		entry.loading = false;
+		mLoadingBytes -= LevelBytes(result.slot, result.level);
+		if (result.valid)
+			UUploadLevel(entry, result.level, result.data);
+		else
+			entry.finestLevel = entry.baseLevel;	// stop asking for a level that cannot be read
+	}
+
+	for (size_t i = 0; i < mEntries.size(); i++)
+	{
+		Entry& entry = mEntries[i];
+		if (entry.loading)
+			continue;
+
+		if (entry.wantedLevel < entry.baseLevel && entry.baseLevel > entry.finestLevel)
+		{
+			const uint64_t bytes = LevelBytes(int(i), entry.baseLevel - 1);
+			if (!UMakeRoom(bytes, int(i)))
+				continue;
+
+			entry.loading = true;
+			mLoadingBytes += bytes;
+			LoadJob job = { int(i), entry.baseLevel - 1, entry.cachePath, entry.info };
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mJobs.push_back(std::move(job));
+			}
+			mWake.notify_one();
+		}
+		else if (entry.wantedLevel > entry.baseLevel && entry.baseLevel < entry.tailLevel)
+		{
+			UFreeLevel(entry);
+			mDrops++;
+		}
+	}
+
+	// this frame's draws lower the values with atomicMin
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mFeedbackBuffers[current]);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &NOT_SAMPLED);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FEEDBACK_BINDING, mFeedbackBuffers[current]);
+
+	mFrame++;
+}
+
+
+// Reallocate the feedback buffers with room for slots textures. Feedback
+// still in flight is lost; it only happens while textures are registered.
+void TextureStreamer::UResizeFeedback(size_t slots)
+{
+	for (int i = 0; i < FEEDBACK_FRAMES; i++)
+	{
+		if (mFences[i])
+			glDeleteSync(mFences[i]);
+		mFences[i] = 0;
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mFeedbackBuffers[i]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, slots * sizeof(GLuint), nullptr, GL_DYNAMIC_READ);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	mFeedbackSlots = slots;
+}
+
+
+// Lower each texture's wanted level to what a finished frame sampled
+void TextureStreamer::UReadFeedback(GLuint buffer)
+{
+	if (mEntries.empty())
+		return;
+
+	std::vector<GLuint> feedback(mEntries.size());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, feedback.size() * sizeof(GLuint), feedback.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	for (size_t i = 0; i < mEntries.size(); i++)
+	{
+		if (feedback[i] == NOT_SAMPLED)
+			continue;
+
+		Entry& entry = mEntries[i];
+		int level = int(std::min<GLuint>(feedback[i], GLuint(entry.tailLevel)));
+		entry.wantedLevel = std::min(entry.wantedLevel, level);
+		entry.windowLevel = std::min(entry.windowLevel, level);
+		entry.lastSampledFrame = mFrame;
+	}
+}
+
+
+// Upload the level just finer than the base level and sample from it
+void TextureStreamer::UUploadLevel(Entry& entry, int level, const std::vector<unsigned char>& data)
+{
+	glBindTexture(GL_TEXTURE_2D, entry.textureId);
+	glCompressedTexImage2D(GL_TEXTURE_2D, level, UCompressedFormat(entry.info.format), std::max(1, entry.info.width >> level),
+		std::max(1, entry.info.height >> level), 0, GLsizei(data.size()), data.data());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	if (entry.loadedLevels & (1u << level))
+		mReloads++;
+	entry.loadedLevels |= 1u << level;
+	entry.baseLevel = level;
+	mResidentBytes += data.size();
+}
+
+
+// Move sampling to the next coarser level, then free the base level by
+// respecifying it as empty
+void TextureStreamer::UFreeLevel(Entry& entry)
+{
+	const int level = entry.baseLevel;
+
+	glBindTexture(GL_TEXTURE_2D, entry.textureId);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+	glCompressedTexImage2D(GL_TEXTURE_2D, level, UCompressedFormat(entry.info.format), 0, 0, 0, 0, nullptr);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	entry.baseLevel = level + 1;
+	mResidentBytes -= UCompressedSize(entry.info.format, std::max(1, entry.info.width >> level), std::max(1, entry.info.height >> level));
+}
+
+
+// Free the finest levels of the least recently sampled textures until bytes
+// more fit in the budget. Textures whose latest feedback may not have been
+// read yet are kept; returns false if that is not enough.
+bool TextureStreamer::UMakeRoom(uint64_t bytes, int keepSlot)
+{
+	while (mResidentBytes + mLoadingBytes + bytes > mBudgetBytes)
+	{
+		int oldest = INVALID_SLOT;
+		for (size_t i = 0; i < mEntries.size(); i++)
+		{
+			const Entry& entry = mEntries[i];
+			if (int(i) != keepSlot && !entry.loading && entry.baseLevel < entry.tailLevel
+				&& entry.lastSampledFrame + FEEDBACK_FRAMES + 1 < mFrame
+				&& (oldest == INVALID_SLOT || entry.lastSampledFrame < mEntries[oldest].lastSampledFrame))
+				oldest = int(i);
+		}
+		if (oldest == INVALID_SLOT)
+			return false;
+
+		// the texture is not sampled now; only new feedback brings the level back
+		Entry& entry = mEntries[oldest];
+		UFreeLevel(entry);
+		entry.wantedLevel = std::max(entry.wantedLevel, entry.baseLevel);
+		entry.windowLevel = std::max(entry.windowLevel, entry.baseLevel);
+		mEvictions++;
+	}
+	return true;
+}
+
+
+uint64_t TextureStreamer::LevelBytes(int slot, int level) const
+{
+	const Ktx2Info& info = mEntries[slot].info;
+	return UCompressedSize(info.format, std::max(1, info.width >> level), std::max(1, info.height >> level));
+}
+
+
+uint64_t TextureStreamer::TextureBytes(int slot) const
+{
+	uint64_t bytes = 0;
+	for (int level = mEntries[slot].baseLevel; level < int(mEntries[slot].info.levelOffsets.size()); level++)
+		bytes += LevelBytes(slot, level);
+	return bytes;
+}
+
+
+TextureStreamStats TextureStreamer::Stats() const
+{
+	TextureStreamStats stats = {};
+	stats.textures = mEntries.size();
+	for (const Entry& entry : mEntries)
+		stats.residentLevels += int(entry.info.levelOffsets.size()) - entry.baseLevel;
+	stats.residentBytes = mResidentBytes;
+	stats.wholeTextures = mWholeTextures;
+	stats.wholeBytes = mWholeBytes;
+	stats.budgetBytes = mBudgetBytes;
+	stats.evictions = mEvictions;
+	stats.drops = mDrops;
+	stats.reloads = mReloads;
+	return stats;
+}
+
+
+void TextureStreamer::LogStats() const
+{
+	TextureStreamStats stats = Stats();
+	std::cout << "INFO: Streamed textures: " << stats.textures << " textures, " << stats.residentLevels
+		<< " levels, " << stats.wholeTextures << " whole textures (" << stats.wholeBytes / 1024 << " KB), "
+		<< stats.residentBytes / 1024 << " KB of " << stats.budgetBytes / 1024 << " KB budget, " << stats.evictions << " evictions, " << stats.drops << " drops, " << stats.reloads << " reloads" << std::endl;
+}
+
+
+// Worker thread: read queued levels until Destroy()
+void TextureStreamer::UWorker()
+{
+	for (;;)
+	{
+		LoadJob job;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [this] { return mStopping || !mJobs.empty(); });
+			if (mStopping)
+				return;
+			job = std::move(mJobs.front());
+			mJobs.pop_front();
+		}
+
+		LoadResult result;
+		result.slot = job.slot;
+		result.level = job.level;
+		result.valid = UReadKtx2Level(job.cachePath.c_str(), job.info, job.level, result.data);
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mLoaded.push_back(std::move(result));
+	}
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "texcache.h"
+
+// Counters of the texture streamer, for the log and for tuning the budget
+struct TextureStreamStats
+{
+	size_t textures;
+	int residentLevels;
+	uint64_t residentBytes;		// streamed and whole textures
+	size_t wholeTextures;		// uploaded whole, see AddWhole()
+	uint64_t wholeBytes;
+	uint64_t budgetBytes;
+	uint64_t evictions;		// levels freed to stay under the budget
+	uint64_t drops;			// levels freed because nothing sampled them any more
+	uint64_t reloads;		// levels read again after being freed
+};
+
+// Streams the mip levels of cached textures (see texcache.h) on demand. A
+// texture starts out with only its coarsest levels so it can be drawn right
+// away. While drawing, the fragment shader writes the finest level each
+// texture needs into a feedback buffer; a few frames later that is read back
+// without stalling, finer levels are read from the cache file on a worker
+// thread and uploaded, and levels that stopped being needed are freed again.
+// GL_TEXTURE_BASE_LEVEL always points at the finest resident level.
+//
+// Finer levels are only loaded while they fit in a byte budget. To make
+// room, the finest level of the texture sampled least recently is freed;
+// textures sampled within the feedback latency are never evicted, so a
+// load that does not fit waits instead. An evicted level is read again
+// once the texture is sampled closely enough to need it.
+class TextureStreamer
+{
+public:
+	static const int INVALID_SLOT = -1;
+
+	// Shader storage binding of the feedback buffer: uint mipFeedback[], one
+	// per slot, that the shader lowers with atomicMin
+	static const GLuint FEEDBACK_BINDING = 3;
+
+	bool Create();
+
+	// Frees the feedback buffers. The textures belong to the caller.
+	void Destroy();
+
+	// Creates textureId from the coarsest levels of the file's cache. Returns
+	// false, leaving textureId alone, when there is no up to date cache file
+	// for the image resampled to maxSize (see TextureOptions).
+	bool Register(const char* filename, GLuint& textureId, int maxSize = 0);
+
+	// Counts a texture that is not streamed against the budget; it is never
+	// evicted. Logs an error when it does not fit.
+	void AddWhole(const char* filename, uint64_t bytes);
+
+	// Feedback slot of a streamed texture, or INVALID_SLOT
+	int Slot(GLuint textureId) const;
+
+	// Size of level 0, which the shader measures the wanted level against
+	glm::vec2 FullSize(int slot) const;
+
+	// Start of a frame, before the draws: reads back older feedback, uploads
+	// finished loads, queues loads and frees levels, and binds a cleared
+	// feedback buffer for this frame
+	void Update();
+
+	// The coarsest levels loaded by Register() and the textures passed to
+	// AddWhole() count against the budget but are never evicted
+	void SetBudget(uint64_t budgetBytes) { mBudgetBytes = budgetBytes; }
+	uint64_t Budget() const { return mBudgetBytes; }
+	uint64_t ResidentBytes() const { return mResidentBytes; }
+
+	// GPU bytes of one mip level, and of the resident levels of a texture
+	uint64_t LevelBytes(int slot, int level) const;
+	uint64_t TextureBytes(int slot) const;
+
+	TextureStreamStats Stats() const;
+	void LogStats() const;
+
+	// Uploads allowed per Update() so a burst of loads does not stall a frame
+	void SetUploadsPerFrame(int uploads) { mUploadsPerFrame = uploads; }
+
+private:
+	struct Entry
+	{
+		std::string cachePath;
+		Ktx2Info info;
+		GLuint textureId;
+		int baseLevel;			// finest resident level
+		int tailLevel;			// this level and coarser ones stay resident
+		int finestLevel;		// finest level that can be loaded
+		int wantedLevel;		// finest level asked for lately
+		int windowLevel;		// finest level asked for since mWindowStart
+		uint64_t lastSampledFrame;
+		uint32_t loadedLevels;	// bit per level that was ever resident, to count reloads
+		bool loading;
+	};
+
+	// A level read by the worker
+	struct LoadResult
+	{
+		int slot;
+		int level;
+		bool valid;
+		std::vector<unsigned char> data;
+	};
+
+	struct LoadJob
+	{
+		int slot;
+		int level;
+		std::string cachePath;
+		Ktx2Info info;
+	};
+
+	void UResizeFeedback(size_t slots);
+	void UReadFeedback(GLuint buffer);
+	void UUploadLevel(Entry& entry, int level, const std::vector<unsigned char>& data);
+	void UFreeLevel(Entry& entry);
+	bool UMakeRoom(uint64_t bytes, int keepSlot);
+	void UWorker();
+
+	static const int FEEDBACK_FRAMES = 3;
+
+	std::vector<Entry> mEntries;
+	GLuint mFeedbackBuffers[FEEDBACK_FRAMES] = {};
+	GLsync mFences[FEEDBACK_FRAMES] = {};
+	size_t mFeedbackSlots = 0;
+	uint64_t mFrame = 0;
+	uint64_t mWindowStart = 0;
+	uint64_t mResidentBytes = 0;
+	uint64_t mLoadingBytes = 0;			// queued or being read
+	size_t mWholeTextures = 0;
+	uint64_t mWholeBytes = 0;
+	uint64_t mBudgetBytes = ~uint64_t(0);
+	uint64_t mEvictions = 0;
+	uint64_t mDrops = 0;
+	uint64_t mReloads = 0;
+	int mUploadsPerFrame = 2;
+
+	// shared with the worker
+	std::thread mWorker;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::deque<LoadJob> mJobs;
+	std::deque<LoadResult> mLoaded;
+	bool mStopping = false;
+};
@@ -0,0 +1,396 @@
+#include "texture.h"
+#include "resample.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h" //image loading util
+
+
+namespace
+{
+	// Pixel unpack buffers used in turn, so filling one never waits for
+	// the transfer out of the previous one
+	const int UPLOAD_BUFFER_COUNT = 3;
+
+	struct UploadBuffer
+	{
+		GLuint buffer = 0;
+		GLsizeiptr size = 0;
+		GLsync fence = 0;		// signaled once the last transfer out of the buffer finished
+	};
+
+	UploadBuffer gUploadBuffers[UPLOAD_BUFFER_COUNT];
+	int gNextUploadBuffer = 0;
+
+	// Next buffer of the pool with room for size bytes, bound to GL_PIXEL_UNPACK_BUFFER
+	UploadBuffer& UAcquireUploadBuffer(GLsizeiptr size)
+	{
+		UploadBuffer& upload = gUploadBuffers[gNextUploadBuffer];
+		gNextUploadBuffer = (gNextUploadBuffer + 1) % UPLOAD_BUFFER_COUNT;
+
+		if (upload.fence)
+		{
+			glClientWaitSync(upload.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+			glDeleteSync(upload.fence);
+			upload.fence = 0;
+		}
+
+		if (upload.buffer == 0)
+			glGenBuffers(1, &upload.buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.buffer);
+		if (upload.size < size)
+		{
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+			upload.size = size;
+		}
+		return upload;
+	}
+
+	// Internal format for each channel count, the smallest that holds the
+	// image without loss. Color is sRGB so sampling returns linear values;
+	// one and two channel images are masks (grey, grey plus alpha) and stay
+	// linear, swizzled so the shader still reads grey in .rgb.
+	struct PixelFormat
+	{
+		GLenum internalFormat;
+		GLenum format;
+		GLint texelBytes;
+		GLint swizzle[4];
+	};
+
+	// Indexed by channels - 1. RGB8 is padded to four bytes by most drivers
+	// anyway, so three channel images are stored with an alpha of one.
+	const PixelFormat PIXEL_FORMATS[] = {
+		{ GL_R8, GL_RED, 1, { GL_RED, GL_RED, GL_RED, GL_ONE } },
+		{ GL_RG8, GL_RG, 2, { GL_RED, GL_RED, GL_RED, GL_GREEN } },
+		{ GL_SRGB8_ALPHA8, GL_RGB, 4, { GL_RED, GL_GREEN, GL_BLUE, GL_ONE } },
+		{ GL_SRGB8_ALPHA8, GL_RGBA, 4, { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA } },
+	};
+
+	int UMipLevels(int width, int height)
+	{
+		int levels = 1;
+		while ((width | height) >> levels)
+			levels++;
+		return levels;
+	}
+}
+
+
+void UFreeImage(Image& image)
+{
+	stbi_image_free(image.pixels);
+	image.pixels = nullptr;
+}
+
+
+///////////////////////////////////////////////////
+//	UUploadImage(const Image&, GLuint&)
+//
+//	image: decoded image, top row first
+//	textureId: receives the texture
+//
+//	Generate and load the texture. The rows are copied bottom-up straight
+//	into a mapped pixel unpack buffer, which flips the image for OpenGL in
+//	the same pass, and the texture is filled from that buffer without
+//	waiting for the transfer.
+///////////////////////////////////////////////////
+bool UUploadImage(const Image& image, GLuint& textureId)
+{
+	if (image.channels < 1 || image.channels > 4)
+	{
+		std::cout << "Not implemented to handle image with " << image.channels << " channels" << std::endl;
+		return false;
+	}
+	const PixelFormat& pixelFormat = PIXEL_FORMATS[image.channels - 1];
+
+	const size_t rowBytes = size_t(image.width) * image.channels;
+	const GLsizeiptr imageBytes = GLsizeiptr(rowBytes * image.height);
+
+	UploadBuffer& upload = UAcquireUploadBuffer(imageBytes);
+	unsigned char* mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, imageBytes,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+	if (!mapped)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		std::cout << "ERROR::TEXTURE::could not map the upload buffer" << std::endl;
+		return false;
+	}
+
+	// Images are stored with Y axis going down, but OpenGL's Y axis goes up
+	for (int row = 0; row < image.height; row++)
+		memcpy(mapped + rowBytes * row, image.pixels + rowBytes * (image.height - 1 - row), rowBytes);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	glGenTextures(1, &textureId);
+	glBindTexture(GL_TEXTURE_2D, textureId);
+
+	// set the texture wrapping parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	// set texture filtering parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, pixelFormat.swizzle);
+
+	// rows are tightly packed
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexStorage2D(GL_TEXTURE_2D, UMipLevels(image.width, image.height), pixelFormat.internalFormat, image.width, image.height);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width, image.height, pixelFormat.format, GL_UNSIGNED_BYTE, (void*)0);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	upload.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+
+	return true;
+}
+
+
+///////////////////////////////////////////////////
+//	ULoadTextureData(const char*, const TextureOptions&, TextureData&)
+//
+//	filename: source image
+//	options: cache use, baking and size limit
+//	data: receives the compressed levels or the decoded image
+//
+//	A cache file is only used when it was baked from the current contents
+//	of the source image with the same size limit. Images are decoded at
+//	a reduced scale when that still covers the limit, and resampled down
+//	to it before they are baked or uploaded.
+///////////////////////////////////////////////////
+bool ULoadTextureData(const char* filename, const TextureOptions& options, TextureData& data)
+{
+	uint64_t sourceHash = 0;
+	std::string cachePath;
+	if (options.useCache)
+	{
+		sourceHash = UTextureSourceHash(filename, options.maxSize);
+		cachePath = UTextureCachePath(filename);
+		if (sourceHash != 0 && UReadKtx2(cachePath.c_str(), sourceHash, data.compressed))
+		{
+			data.isCompressed = true;
+			return true;
+		}
+	}
+
+	if (!UDecodeImage(filename, data.image, options.maxSize))
+		return false;
+	ULimitImageSize(data.image, options.maxSize);
+
+	// masks are not baked; the block formats are for sRGB color
+	if (options.useCache && options.bake && data.image.channels >= 3)
+	{
+		UBakeTexture(data.image, options.useBC7, data.compressed);
+		if (UWriteKtx2(cachePath.c_str(), data.compressed, sourceHash))
+			std::cout << "INFO: Baked " << cachePath << std::endl;
+		data.isCompressed = true;
+		UFreeImage(data.image);
+	}
+	return true;
+}
+
+
+bool UUploadTextureData(const TextureData& data, GLuint& textureId)
+{
+	if (data.isCompressed)
+		return UUploadCompressed(data.compressed, textureId);
+	return UUploadImage(data.image, textureId);
+}
+
+
+///////////////////////////////////////////////////
+//	UTextureBytes(const TextureData&)
+//
+//	data: loaded texture
+//
+//	GPU memory the texture takes once uploaded, every mip level included
+///////////////////////////////////////////////////
+size_t UTextureBytes(const TextureData& data)
+{
+	size_t bytes = 0;
+	if (data.isCompressed)
+	{
+		for (const std::vector<unsigned char>& level : data.compressed.levels)
+			bytes += level.size();
+		return bytes;
+	}
+
+	if (data.image.channels < 1 || data.image.channels > 4)
+		return 0;
+	const int levels = UMipLevels(data.image.width, data.image.height);
+	for (int level = 0; level < levels; level++)
+	{
+		bytes += size_t(std::max(1, data.image.width >> level)) * std::max(1, data.image.height >> level)
+			* PIXEL_FORMATS[data.image.channels - 1].texelBytes;
+	}
+	return bytes;
+}
+
+
+void ULogTextureBytes(const char* filename, const TextureData& data)
+{
+	const int width = data.isCompressed ? data.compressed.width : data.image.width;
+	const int height = data.isCompressed ? data.compressed.height : data.image.height;
+	std::cout << "INFO: Texture " << filename << ": " << width << "x" << height << ", "
+		<< UTextureBytes(data) / 1024 << " KB" << std::endl;
+}
+
+
+void UFreeTextureData(TextureData& data)
+{
+	UFreeImage(data.image);
+	data.compressed = CompressedTexture();
+	data.isCompressed = false;
+}
+
+
+bool UCreateTexture(const char* filename, GLuint& textureId, const TextureOptions& options)
+{
+	TextureOptions supported = options;
+	supported.useCache = options.useCache && UCompressedTexturesSupported();
+
+	TextureData data;
+	if (!ULoadTextureData(filename, supported, data))
+		return false;
+
+	bool uploaded = UUploadTextureData(data, textureId);
+	if (uploaded)
+		ULogTextureBytes(filename, data);
+	UFreeTextureData(data);
+	return uploaded;
+}
+
+
+void UDestroyTexture(GLuint textureId)
+{
+	glDeleteTextures(1, &textureId);
+}
+
+
+// Release the pixel unpack buffers kept between uploads
+void UDestroyUploadBuffers()
+{
+	for (UploadBuffer& upload : gUploadBuffers)
+	{
+		glDeleteSync(upload.fence);
+		glDeleteBuffers(1, &upload.buffer);
+		upload = UploadBuffer();
+	}
+}
+
+
+TextureLoader::~TextureLoader()
+{
+	UStop();
+	for (Job& job : mDecoded)
+		UFreeTextureData(job.data);
+}
+
+
+void TextureLoader::Request(const char* filename, GLuint& textureId)
+{
+	Job job;
+	job.filename = filename;
+	job.textureId = &textureId;
+	job.options = mOptions;
+	job.options.useCache = mOptions.useCache && UCompressedTexturesSupported();
+	job.loaded = false;
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mJobs.push_back(std::move(job));
+		mPending++;
+	}
+	mWake.notify_one();
+
+	// one worker per request, up to the number of hardware threads
+	unsigned maxWorkers = std::max(1u, std::thread::hardware_concurrency());
+	if (mWorkers.size() < maxWorkers)
+		mWorkers.emplace_back(&TextureLoader::UWorker, this);
+}
+
+
+///////////////////////////////////////////////////
+//	Finish()
+//
+//	Upload the images as their decodes finish, so the first upload
+//	overlaps the remaining decodes. Failures are reported per file and
+//	do not stop the other uploads.
+///////////////////////////////////////////////////
+bool TextureLoader::Finish()
+{
+	bool loaded = true;
+	for (;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			if (mPending == 0)
+				break;
+			mDone.wait(lock, [this] { return !mDecoded.empty(); });
+			job = std::move(mDecoded.front());
+			mDecoded.pop_front();
+			mPending--;
+		}
+
+		if (!job.loaded || !UUploadTextureData(job.data, *job.textureId))
+		{
+			std::cout << "Failed to load texture " << job.filename << std::endl;
+			loaded = false;
+		}
+		else
+		{
+			ULogTextureBytes(job.filename.c_str(), job.data);
+			mUploaded.emplace_back(job.filename, UTextureBytes(job.data));
+		}
+		UFreeTextureData(job.data);
+	}
+
+	UStop();
+	return loaded;
+}
+
+
+// Worker thread: load queued images until stopped
+void TextureLoader::UWorker()
+{
+	for (;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [this] { return mStopping || !mJobs.empty(); });
+			if (mJobs.empty())
+				return;
+			job = std::move(mJobs.front());
+			mJobs.pop_front();
+		}
+
+		job.loaded = ULoadTextureData(job.filename.c_str(), job.options, job.data);
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mDecoded.push_back(std::move(job));
+		}
+		mDone.notify_one();
+	}
+}
+
+
+void TextureLoader::UStop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mWake.notify_all();
+	for (std::thread& worker : mWorkers)
+		worker.join();
+	mWorkers.clear();
+	mStopping = false;
+}
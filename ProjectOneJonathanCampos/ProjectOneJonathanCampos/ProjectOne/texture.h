@@ -0,0 +1,114 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "texcache.h"
+
+// Decoded image, top row first as stored in the file
+struct Image
+{
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+	unsigned char* pixels = nullptr;	// allocated with malloc, release with UFreeImage
+};
+
+// Decode an image file with the registered decoders (see imagedecoder.h).
+// With minSize, JPEG files are decoded at the smallest of 1/2, 1/4 or 1/8
+// size whose longest side is still at least minSize. Safe to call from any
+// thread.
+bool UDecodeImage(const char* filename, Image& image, int minSize = 0);
+void UFreeImage(Image& image);
+
+// Create a mipmapped texture from a decoded image with 1 to 4 channels,
+// stored as R8, RG8 or SRGB8_ALPHA8. GL thread only.
+bool UUploadImage(const Image& image, GLuint& textureId);
+
+// How textures are read. With useCache a texture whose KTX2 cache file is
+// up to date is loaded from it; with bake as well, missing or stale cache
+// files are written from the decoded image.
+struct TextureOptions
+{
+	bool useCache = true;
+	bool bake = false;
+	bool useBC7 = false;		// bake BC7 instead of BC1/BC3
+	int maxSize = 0;			// longest side after resampling (see resample.h), 0 for the full size
+};
+
+// A texture ready to upload: from the cache when possible, else decoded
+struct TextureData
+{
+	Image image;
+	CompressedTexture compressed;
+	bool isCompressed = false;
+};
+
+// Fill data from the cache or the image file. Safe to call from any thread.
+bool ULoadTextureData(const char* filename, const TextureOptions& options, TextureData& data);
+bool UUploadTextureData(const TextureData& data, GLuint& textureId);
+void UFreeTextureData(TextureData& data);
+
+// GPU bytes of the uploaded texture, mips included, and an INFO line with them
+size_t UTextureBytes(const TextureData& data);
+void ULogTextureBytes(const char* filename, const TextureData& data);
+
+// Load and upload in one step
+bool UCreateTexture(const char* filename, GLuint& textureId, const TextureOptions& options = TextureOptions());
+void UDestroyTexture(GLuint textureId);
+
+// Release the pixel unpack buffers pooled across uploads
+void UDestroyUploadBuffers();
+
+// Decodes images on a pool of worker threads while the GL thread does
+// other work, then uploads each one as soon as its decode finishes
+class TextureLoader
+{
+public:
+	~TextureLoader();
+
+	// Applies to the requests that follow
+	void SetOptions(const TextureOptions& options) { mOptions = options; }
+
+	// Queue an image; textureId is written by Finish(). Workers start on the first request.
+	void Request(const char* filename, GLuint& textureId);
+
+	// Upload every requested image in the order the decodes finish and stop
+	// the workers. Returns false if any image failed to load.
+	bool Finish();
+
+	// File name and GPU bytes of each texture Finish() uploaded
+	const std::vector<std::pair<std::string, size_t>>& Uploaded() const { return mUploaded; }
+
+private:
+	struct Job
+	{
+		std::string filename;
+		GLuint* textureId;
+		TextureOptions options;
+		TextureData data;
+		bool loaded;
+	};
+
+	void UWorker();
+	void UStop();
+
+	std::vector<std::thread> mWorkers;
+	std::mutex mMutex;
+	std::condition_variable mWake;		// jobs queued or stopping
+	std::condition_variable mDone;		// a decode finished
+	std::deque<Job> mJobs;
+	std::deque<Job> mDecoded;
+	std::vector<std::pair<std::string, size_t>> mUploaded;
+	size_t mPending = 0;				// requested and not yet uploaded
+	TextureOptions mOptions;
+	bool mStopping = false;
+};
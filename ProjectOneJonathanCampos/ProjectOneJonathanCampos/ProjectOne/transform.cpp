@@ -0,0 +1,143 @@
+#include "transform.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+const GLuint TransformStage::TRANSFORM_BINDING;
+
+
+namespace
+{
+	// One object; the AVX2 path computes the same thing
+	void UComputeTransform(const glm::mat4& viewProjection, const glm::mat4& model, ObjectTransform& transform)
+	{
+		transform.mvp = viewProjection * model;
+		transform.model = model;
+
+		// the inverse of a 3x3 matrix with columns a, b, c has the rows
+		// b x c, c x a and a x b over its determinant
+		glm::vec3 a(model[0]), b(model[1]), c(model[2]);
+		glm::vec3 bc = glm::cross(b, c), ca = glm::cross(c, a), ab = glm::cross(a, b);
+		float determinant = glm::dot(a, bc);
+		float scale = determinant != 0.0f ? 1.0f / determinant : 0.0f;
+		transform.normal = glm::mat3x4(glm::vec4(bc * scale, 0.0f), glm::vec4(ca * scale, 0.0f), glm::vec4(ab * scale, 0.0f));
+	}
+
+#if defined(__AVX2__)
+	///////////////////////////////////////////////////
+	//	UComputeTransforms8(const glm::mat4&, const glm::mat4*, ObjectTransform*)
+	//
+	//	viewProjection: projection * view
+	//	models: eight model matrices
+	//	transforms: receives their matrices
+	//
+	//	Each lane holds one object: the matrices are gathered element by
+	//	element, so every product and cross product runs on eight objects
+	///////////////////////////////////////////////////
+	void UComputeTransforms8(const glm::mat4& viewProjection, const glm::mat4* models, ObjectTransform* transforms)
+	{
+		const float* elements = &models[0][0][0];
+		const __m256i objectOffsets = _mm256_setr_epi32(0, 16, 32, 48, 64, 80, 96, 112);
+
+		__m256 m[16];	// m[4 * column + row]
+		for (int e = 0; e < 16; e++)
+			m[e] = _mm256_i32gather_ps(elements + e, objectOffsets, 4);
+
+		alignas(32) float mvp[16][8];
+		for (int column = 0; column < 4; column++)
+		{
+			for (int row = 0; row < 4; row++)
+			{
+				__m256 sum = _mm256_mul_ps(_mm256_set1_ps(viewProjection[0][row]), m[4 * column]);
+				for (int k = 1; k < 4; k++)
+					sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(viewProjection[k][row]), m[4 * column + k]));
+				_mm256_store_ps(mvp[4 * column + row], sum);
+			}
+		}
+
+		// columns a, b, c of the upper 3x3
+		const __m256* a = &m[0];
+		const __m256* b = &m[4];
+		const __m256* c = &m[8];
+		auto cross = [](const __m256* u, const __m256* v, __m256* out) {
+			out[0] = _mm256_sub_ps(_mm256_mul_ps(u[1], v[2]), _mm256_mul_ps(u[2], v[1]));
+			out[1] = _mm256_sub_ps(_mm256_mul_ps(u[2], v[0]), _mm256_mul_ps(u[0], v[2]));
+			out[2] = _mm256_sub_ps(_mm256_mul_ps(u[0], v[1]), _mm256_mul_ps(u[1], v[0]));
+		};
+		__m256 normal[9];
+		cross(b, c, &normal[0]);
+		cross(c, a, &normal[3]);
+		cross(a, b, &normal[6]);
+
+		__m256 determinant = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a[0], normal[0]), _mm256_mul_ps(a[1], normal[1])),
+			_mm256_mul_ps(a[2], normal[2]));
+		__m256 invertible = _mm256_cmp_ps(determinant, _mm256_setzero_ps(), _CMP_NEQ_OQ);
+		__m256 scale = _mm256_and_ps(_mm256_div_ps(_mm256_set1_ps(1.0f), determinant), invertible);
+
+		alignas(32) float normals[9][8];
+		for (int e = 0; e < 9; e++)
+			_mm256_store_ps(normals[e], _mm256_mul_ps(normal[e], scale));
+
+		for (int i = 0; i < 8; i++)
+		{
+			ObjectTransform& transform = transforms[i];
+			for (int e = 0; e < 16; e++)
+				transform.mvp[e / 4][e % 4] = mvp[e][i];
+			transform.model = models[i];
+			for (int column = 0; column < 3; column++)
+				transform.normal[column] = glm::vec4(normals[3 * column][i], normals[3 * column + 1][i], normals[3 * column + 2][i], 0.0f);
+		}
+	}
+#endif
+}
+
+
+void UComputeTransforms(const glm::mat4& viewProjection, const glm::mat4* models, size_t count, ObjectTransform* transforms)
+{
+	size_t i = 0;
+#if defined(__AVX2__)
+	for (; i + 8 <= count; i += 8)
+		UComputeTransforms8(viewProjection, models + i, transforms + i);
+#endif
+	for (; i < count; i++)
+		UComputeTransform(viewProjection, models[i], transforms[i]);
+}
+
+
+///////////////////////////////////////////////////
+//	Update(const glm::mat4&, const std::vector<glm::mat4>&)
+//
+//	viewProjection: projection * view of this frame
+//	models: matrix each scene object is drawn with, by scene index
+//
+//	The buffer is orphaned every frame so the upload never waits for the
+//	draws of the previous one
+///////////////////////////////////////////////////
+void TransformStage::Update(const glm::mat4& viewProjection, const std::vector<glm::mat4>& models)
+{
+	// the shader reads index 0 even for an empty scene
+	mTransforms.resize(models.empty() ? 1 : models.size());
+	UComputeTransforms(viewProjection, models.data(), models.size(), mTransforms.data());
+
+	if (mBuffer == 0)
+		glGenBuffers(1, &mBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mBuffer);
+	if (mTransforms.size() > mCapacity)
+		mCapacity = mTransforms.size();
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(ObjectTransform) * mCapacity, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(ObjectTransform) * mTransforms.size(), mTransforms.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TRANSFORM_BINDING, mBuffer);
+}
+
+
+void TransformStage::Destroy()
+{
+	if (mBuffer != 0)
+		glDeleteBuffers(1, &mBuffer);
+	mBuffer = 0;
+	mCapacity = 0;
+	mTransforms.clear();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+// Matrices of one object for a frame as the vertex shader reads them (std430)
+struct ObjectTransform
+{
+	glm::mat4 mvp;			// object to clip space
+	glm::mat4 model;		// object to world space, for lighting
+	glm::mat3x4 normal;		// inverse transpose of the model's upper 3x3 (mat3x4 in the shader)
+};
+
+// Fill transforms[i] for models[i]. Eight objects at a time with AVX2, the
+// rest one by one.
+void UComputeTransforms(const glm::mat4& viewProjection, const glm::mat4* models, size_t count, ObjectTransform* transforms);
+
+// Computes the clip space and normal matrices of every object once per
+// frame on the CPU, instead of once per vertex in the vertex shader, and
+// binds them to TRANSFORM_BINDING. The shader finds an object's matrices by
+// its scene index, the same per-instance attribute the materials use.
+class TransformStage
+{
+public:
+	static const GLuint TRANSFORM_BINDING = 5;
+
+	// models: matrix each scene object is drawn with this frame, by scene index
+	void Update(const glm::mat4& viewProjection, const std::vector<glm::mat4>& models);
+	void Destroy();
+
+private:
+	std::vector<ObjectTransform> mTransforms;
+	GLuint mBuffer = 0;
+	size_t mCapacity = 0;		// objects mBuffer has room for
+};
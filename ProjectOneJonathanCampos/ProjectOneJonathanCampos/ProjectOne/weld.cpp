@@ -0,0 +1,277 @@
+#include "weld.h"
+#include "geometry.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+
+
+namespace
+{
+	// Inputs smaller than this are not worth starting threads for
+	const size_t PARALLEL_THRESHOLD = 16384;
+
+	const int64_t CELL_BIAS = int64_t(1) << 20;
+
+	struct CellEntry
+	{
+		uint64_t key;
+		GLuint vertex;
+
+		bool operator<(const CellEntry& other) const
+		{
+			return key < other.key || (key == other.key && vertex < other.vertex);
+		}
+	};
+
+	// Pack three 21-bit cell coordinates into one key
+	inline uint64_t UCellKey(int64_t x, int64_t y, int64_t z)
+	{
+		const uint64_t mask = (uint64_t(1) << 21) - 1;
+		return (uint64_t(x + CELL_BIAS) & mask) | ((uint64_t(y + CELL_BIAS) & mask) << 21)
+			| ((uint64_t(z + CELL_BIAS) & mask) << 42);
+	}
+
+	struct WeldContext
+	{
+		const float* streams[STREAM_COUNT];
+		float positionEpsilon;
+		float cosNormalAngle;
+		float uvEpsilon;
+		float cellSize;
+		std::vector<CellEntry> cells;	// sorted by key, then vertex
+
+		// open addressing table from cell key to the cell's first entry in cells
+		std::vector<uint64_t> slotKeys;
+		std::vector<GLuint> slotStarts;
+		uint64_t slotMask;
+	};
+
+	inline size_t USlot(const WeldContext& context, uint64_t key)
+	{
+		return size_t((key * 0x9E3779B97F4A7C15ull) >> 20) & context.slotMask;
+	}
+
+	void UBuildCellTable(WeldContext& context)
+	{
+		size_t slots = 16;
+		while (slots < context.cells.size() * 2)
+			slots *= 2;
+		context.slotKeys.assign(slots, ~uint64_t(0));
+		context.slotStarts.assign(slots, 0);
+		context.slotMask = slots - 1;
+
+		for (size_t i = 0; i < context.cells.size(); i++)
+		{
+			if (i > 0 && context.cells[i].key == context.cells[i - 1].key)
+				continue;
+
+			size_t slot = USlot(context, context.cells[i].key);
+			while (context.slotKeys[slot] != ~uint64_t(0))
+				slot = (slot + 1) & context.slotMask;
+			context.slotKeys[slot] = context.cells[i].key;
+			context.slotStarts[slot] = GLuint(i);
+		}
+	}
+
+	// First entry of the cell in context.cells, or cells.size() when the cell is empty
+	inline size_t UFindCell(const WeldContext& context, uint64_t key)
+	{
+		size_t slot = USlot(context, key);
+		while (context.slotKeys[slot] != ~uint64_t(0))
+		{
+			if (context.slotKeys[slot] == key)
+				return context.slotStarts[slot];
+			slot = (slot + 1) & context.slotMask;
+		}
+		return context.cells.size();
+	}
+
+	inline glm::ivec3 UCell(const WeldContext& context, size_t i)
+	{
+		return glm::ivec3(
+			int(std::floor(context.streams[STREAM_PX][i] / context.cellSize)),
+			int(std::floor(context.streams[STREAM_PY][i] / context.cellSize)),
+			int(std::floor(context.streams[STREAM_PZ][i] / context.cellSize)));
+	}
+
+	bool UCompatible(const WeldContext& context, size_t a, size_t b)
+	{
+		const float* const* s = context.streams;
+		for (int c = STREAM_PX; c <= STREAM_PZ; c++)
+		{
+			if (std::fabs(s[c][a] - s[c][b]) > context.positionEpsilon)
+				return false;
+		}
+		for (int c = STREAM_U; c <= STREAM_V; c++)
+		{
+			if (std::fabs(s[c][a] - s[c][b]) > context.uvEpsilon)
+				return false;
+		}
+
+		glm::vec3 na(s[STREAM_NX][a], s[STREAM_NY][a], s[STREAM_NZ][a]);
+		glm::vec3 nb(s[STREAM_NX][b], s[STREAM_NY][b], s[STREAM_NZ][b]);
+		float lengths = std::sqrt(glm::dot(na, na) * glm::dot(nb, nb));
+		if (lengths == 0.0f)
+			return glm::dot(na, na) == glm::dot(nb, nb);
+		return glm::dot(na, nb) >= context.cosNormalAngle * lengths;
+	}
+
+	// Lowest vertex index compatible with each vertex in [begin, end). The
+	// cell size is at least twice the position epsilon, so any match lies in
+	// the 2x2x2 block of cells on the vertex's side of its own cell.
+	void UFindCandidates(const WeldContext& context, size_t begin, size_t end, GLuint* candidates)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			glm::vec3 scaled = glm::vec3(context.streams[STREAM_PX][i], context.streams[STREAM_PY][i],
+				context.streams[STREAM_PZ][i]) / context.cellSize;
+			glm::vec3 cellFloor = glm::floor(scaled);
+			glm::ivec3 cell(cellFloor);
+			glm::ivec3 side = glm::ivec3(glm::step(glm::vec3(0.5f), scaled - cellFloor)) * 2 - 1;
+			GLuint best = GLuint(i);
+
+			for (int n = 0; n < 8; n++)
+			{
+				glm::ivec3 neighbour = cell + glm::ivec3(n & 1, (n >> 1) & 1, (n >> 2) & 1) * side;
+				uint64_t key = UCellKey(neighbour.x, neighbour.y, neighbour.z);
+
+				// entries are sorted by vertex inside a cell, so stop at the current best
+				for (size_t e = UFindCell(context, key); e < context.cells.size() && context.cells[e].key == key
+					&& context.cells[e].vertex < best; e++)
+				{
+					if (UCompatible(context, i, context.cells[e].vertex))
+					{
+						best = context.cells[e].vertex;
+						break;
+					}
+				}
+			}
+			candidates[i] = best;
+		}
+	}
+
+	// Run fn(begin, end) over [0, count), split across hardware threads for large inputs
+	template <typename Fn>
+	void UParallelFor(size_t count, Fn fn)
+	{
+		unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+		if (count < PARALLEL_THRESHOLD || threads == 1)
+		{
+			fn(size_t(0), count);
+			return;
+		}
+
+		std::vector<std::thread> workers;
+		size_t chunk = (count + threads - 1) / threads;
+		for (size_t begin = 0; begin < count; begin += chunk)
+			workers.emplace_back(fn, begin, std::min(count, begin + chunk));
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+}
+
+
+///////////////////////////////////////////////////
+//	UWeldGeometry(Geometry&, std::vector<GLuint>&, const WeldOptions&, WeldStats*)
+//
+//	geometry: vertices to weld, replaced by the unique vertices
+//	indices: triangle indices, remapped to the welded vertices
+//	options: tolerances
+//	stats: optionally receives the vertex counts
+//
+//	Vertex i is welded to the lowest compatible vertex j <= i. Candidates
+//	are found in parallel; a short serial pass then resolves chains so that
+//	every vertex is within tolerance of the vertex it is welded to.
+///////////////////////////////////////////////////
+void UWeldGeometry(Geometry& geometry, std::vector<GLuint>& indices, const WeldOptions& options, WeldStats* stats)
+{
+	const size_t count = geometry.Size();
+
+	if (indices.empty())
+	{
+		indices.resize(count);
+		for (size_t i = 0; i < count; i++)
+			indices[i] = GLuint(i);
+	}
+
+	WeldContext context;
+	for (int s = 0; s < STREAM_COUNT; s++)
+		context.streams[s] = geometry.Stream(GeometryStream(s));
+	context.positionEpsilon = options.positionEpsilon;
+	context.cosNormalAngle = std::cos(glm::radians(options.normalAngle));
+	context.uvEpsilon = options.uvEpsilon;
+
+	// keep the cell coordinates inside the 21 bits of the key
+	glm::vec3 minCorner, maxCorner;
+	geometry.ComputeBounds(minCorner, maxCorner);
+	glm::vec3 reach = glm::max(glm::abs(minCorner), glm::abs(maxCorner));
+	float extent = count > 0 ? std::max(reach.x, std::max(reach.y, reach.z)) : 0.0f;
+	context.cellSize = std::max(std::max(2.0f * options.positionEpsilon, 1e-12f), extent / float(CELL_BIAS - 2));
+
+	// spatial hash: vertices sorted by cell
+	context.cells.resize(count);
+	UParallelFor(count, [&context](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			glm::ivec3 cell = UCell(context, i);
+			context.cells[i].key = UCellKey(cell.x, cell.y, cell.z);
+			context.cells[i].vertex = GLuint(i);
+		}
+	});
+	std::sort(context.cells.begin(), context.cells.end());
+	UBuildCellTable(context);
+
+	std::vector<GLuint> candidates(count);
+	UParallelFor(count, [&context, &candidates](size_t begin, size_t end) {
+		UFindCandidates(context, begin, end, candidates.data());
+	});
+
+	// Resolve chains: weld to the candidate's representative when it is still
+	// within tolerance, otherwise keep the vertex
+	std::vector<GLuint> representative(count);
+	std::vector<GLuint> remap(count);
+	GLuint unique = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		GLuint root = representative[candidates[i]];
+		if (candidates[i] != i && UCompatible(context, i, root))
+		{
+			representative[i] = root;
+			remap[i] = remap[root];
+		}
+		else
+		{
+			representative[i] = GLuint(i);
+			remap[i] = unique++;
+		}
+	}
+
+	if (unique < count)
+	{
+		Geometry welded(unique);
+		for (int s = 0; s < STREAM_COUNT; s++)
+		{
+			const float* src = geometry.Stream(GeometryStream(s));
+			float* dst = welded.Stream(GeometryStream(s));
+			for (size_t i = 0; i < count; i++)
+			{
+				if (representative[i] == i)
+					dst[remap[i]] = src[i];
+			}
+		}
+		geometry = std::move(welded);
+
+		for (GLuint& index : indices)
+			index = remap[index];
+	}
+
+	if (stats)
+	{
+		stats->inputVertices = count;
+		stats->outputVertices = unique;
+	}
+}
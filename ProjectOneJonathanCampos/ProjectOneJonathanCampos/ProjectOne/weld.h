@@ -0,0 +1,35 @@
+#pragma once
+
+
+#include <GLEW/include/GL/glew.h>
+
+#include <cstddef>
+#include <vector>
+
+class Geometry;
+
+// Tolerances deciding when two vertices are the same vertex
+struct WeldOptions
+{
+	float positionEpsilon = 1e-5f;	// per axis distance
+	float normalAngle = 1.0f;		// degrees between normals
+	float uvEpsilon = 1e-5f;		// per axis distance; larger differences are kept as UV seams
+};
+
+struct WeldStats
+{
+	size_t inputVertices = 0;
+	size_t outputVertices = 0;
+
+	// input / output vertex count
+	float Ratio() const { return outputVertices > 0 ? float(inputVertices) / float(outputVertices) : 1.0f; }
+};
+
+// Merge vertices whose position, normal and texture coords all match within
+// the tolerances, using a spatial hash over the positions. Indices are
+// remapped in place; an empty index list means the geometry was a
+// non-indexed triangle list and receives one index per input vertex.
+// Large inputs are searched in parallel; the result does not depend on the
+// number of threads.
+void UWeldGeometry(Geometry& geometry, std::vector<GLuint>& indices, const WeldOptions& options = WeldOptions(),
+	WeldStats* stats = nullptr);